@@ -0,0 +1,137 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  admission.c
+ *
+ *    Description:  Implementation of the limits on the number of scripts executed at the same time
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 23:52:04
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "procedures.h"
+#include "stats.h"
+#include "admission.h"
+
+/**
+ * \brief Execution waiting for its turn
+ *
+ * The structure lives on the stack of the waiting thread.
+ */
+typedef struct Waiter {
+	Procedure *proc;	//!< Procedure which program is executed
+	pthread_cond_t admitted;	//!< Condition signaled when the execution is admitted
+	int done;	//!< Tells if the execution is admitted
+	struct Waiter *next;	//!< Next waiting execution, which came later
+} Waiter;
+
+/**
+ * \brief State of the admission control
+ */
+static struct {
+	pthread_mutex_t lock;	//!< Lock protecting the state and the number of running executions of the procedures
+	size_t limit;	//!< Maximum number of executions at the same time, 0 for no limit
+	size_t queue;	//!< Maximum number of waiting executions
+	size_t running;	//!< Number of running executions
+	size_t waiting;	//!< Number of waiting executions
+	Waiter *first;	//!< Oldest waiting execution
+	Waiter *last;	//!< Newest waiting execution
+	AdmissionStats stats;	//!< Counters
+} admission={PTHREAD_MUTEX_INITIALIZER,0,ADMISSION_QUEUE};
+
+/**
+ * \brief Tell if an execution can start now
+ *
+ * The lock should be held by the caller.
+ * \param proc Procedure which program is executed
+ * \return 1 if neither the global limit nor the limit of the procedure is reached, 0 otherwise
+ */
+static int can_run(const Procedure *proc) {
+	return (admission.limit==0 || admission.running<admission.limit) && (proc->limit==0 || proc->running<proc->limit);
+}
+
+/**
+ * \brief Count an execution as running
+ *
+ * The lock should be held by the caller.
+ * \param proc Procedure which program is executed
+ */
+static void start(Procedure *proc) {
+	++admission.running;
+	++proc->running;
+	++admission.stats.admitted;
+}
+
+void init_admission(size_t limit,size_t queue) {
+	admission.limit=limit;
+	admission.queue=queue;
+}
+
+int admission_enter(Procedure *proc,int wait) {
+	unsigned long long begin=stats_clock();
+	pthread_mutex_lock(&admission.lock);
+	if (can_run(proc)) {	// The waiting executions can not run, otherwise they would have been admitted when the last execution ended
+		start(proc);
+		pthread_mutex_unlock(&admission.lock);
+		stats_wait(begin);
+		return 0;
+	}
+	if (!wait || admission.waiting>=admission.queue) {
+		++admission.stats.rejected;
+		pthread_mutex_unlock(&admission.lock);
+		return -EAGAIN;
+	}
+	Waiter waiter;
+	waiter.proc=proc;
+	pthread_cond_init(&waiter.admitted,0);
+	waiter.done=0;
+	waiter.next=0;
+	if (admission.last==0) admission.first=&waiter; else admission.last->next=&waiter;
+	admission.last=&waiter;
+	++admission.waiting;
+	while (!waiter.done) pthread_cond_wait(&waiter.admitted,&admission.lock);	// The waiter is removed from the queue and counted as running by admission_leave
+	++admission.stats.waited;
+	pthread_mutex_unlock(&admission.lock);
+	pthread_cond_destroy(&waiter.admitted);
+	stats_wait(begin);
+	return 0;
+}
+
+void admission_leave(Procedure *proc) {
+	pthread_mutex_lock(&admission.lock);
+	--admission.running;
+	--proc->running;
+	Waiter *w=admission.first,*previous=0;
+	while (w!=0 && (admission.limit==0 || admission.running<admission.limit)) {	// Admit the oldest executions which can run now
+		Waiter *next=w->next;
+		if (can_run(w->proc)) {
+			if (previous==0) admission.first=next; else previous->next=next;
+			if (admission.last==w) admission.last=previous;
+			--admission.waiting;
+			start(w->proc);
+			w->done=1;
+			pthread_cond_signal(&w->admitted);
+		} else previous=w;
+		w=next;
+	}
+	pthread_mutex_unlock(&admission.lock);
+}
+
+void admission_stats(AdmissionStats *stats) {
+	pthread_mutex_lock(&admission.lock);
+	*stats=admission.stats;
+	stats->running=admission.running;
+	stats->waiting=admission.waiting;
+	pthread_mutex_unlock(&admission.lock);
+}
@@ -0,0 +1,74 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  admission.h
+ *
+ *    Description:  Limits on the number of scripts executed at the same time
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 23:46:20
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  ADMISSION_INC
+#define  ADMISSION_INC
+
+#include <sys/types.h>
+#include "procedures.h"
+
+#define	ADMISSION_QUEUE 0x40	//!< Default maximum number of executions waiting for their turn
+
+/**
+ * \brief Counters of the admission control
+ */
+typedef struct AdmissionStats {
+	unsigned long admitted;	//!< Number of executions admitted
+	unsigned long waited;	//!< Number of executions admitted after waiting in the queue
+	unsigned long rejected;	//!< Number of executions rejected because the queue was full
+	size_t running;	//!< Number of executions running now
+	size_t waiting;	//!< Number of executions waiting now
+} AdmissionStats;
+
+/**
+ * \brief Set the limits of the admission control
+ *
+ * The limits of each procedure are read from the procedure itself. This function should be called before any execution.
+ * \param limit Maximum number of programs executed at the same time, 0 for no limit
+ * \param queue Maximum number of executions waiting for their turn, the next ones being rejected
+ */
+void init_admission(size_t limit,size_t queue);
+
+/**
+ * \brief Ask for the right to execute the program of a procedure
+ *
+ * The execution is admitted at once if neither the global limit nor the limit of the procedure is reached. Otherwise the caller waits in a FIFO queue, and is admitted when an execution which prevented it ends, before the executions which came after it. The time spent waiting is counted in the statistics. Each admitted execution must be followed by a call to admission_leave. This function is thread-safe.
+ * \param proc Procedure which program is executed
+ * \param wait Tells if the caller accepts to wait, otherwise the execution is rejected if it can not be admitted at once
+ * \return 0 if the execution is admitted, -EAGAIN if it is rejected
+ */
+int admission_enter(Procedure *proc,int wait);
+
+/**
+ * \brief Tell that an admitted execution has ended
+ *
+ * The oldest waiting executions which can now run are admitted. This function is thread-safe.
+ * \param proc Procedure which program was executed
+ */
+void admission_leave(Procedure *proc);
+
+/**
+ * \brief Read the counters of the admission control
+ *
+ * \param stats Structure receiving the counters
+ */
+void admission_stats(AdmissionStats *stats);
+
+#endif   /* ----- #ifndef ADMISSION_INC  ----- */
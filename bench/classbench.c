@@ -0,0 +1,255 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  classbench.c
+ *
+ *    Description:  Micro-benchmark of the classification of files by the procedures
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 22:41:26
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_XOPEN_SOURCE 700	//!< Needed for nftw and mkdtemp
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "procedures.h"
+#include "operations.h"
+#include "cache.h"
+
+#define	DEFAULT_PASSES 20	//!< Number of passes over the corpus for each measure if no other value is given on the command line
+#define	CORPUS_FILES 400	//!< Number of files of the generated corpus
+#define	CORPUS_EXTENSIONS 150	//!< Number of different extensions of the files of the generated corpus, some of them matched by no pattern
+
+static char **corpus=0;	//!< Paths of the files of the corpus, relative to the mirror folder
+static size_t corpus_count=0;	//!< Number of files of the corpus
+static size_t corpus_allocated=0;	//!< Number of slots of the corpus array
+static size_t root_length=0;	//!< Length of the path of the corpus folder, removed from the paths found by nftw
+static char generated[]="/tmp/classbench.XXXXXX";	//!< Folder of the generated corpus, replaced by its actual name when it is created
+static int generated_exists=0;	//!< Tells if the generated corpus has to be removed at the end of the program
+
+/**
+ * \brief Read the monotonic clock
+ *
+ * \return Current time in nanoseconds
+ */
+unsigned long long now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/**
+ * \brief Add a regular file to the corpus, called by nftw
+ *
+ * \param path Path of the file
+ * \param st Attributes of the file
+ * \param flag Kind of file
+ * \param ftw Position of the file in the tree
+ * \return 0 so that the walk goes on
+ */
+int collect(const char *path,const struct stat *st,int flag,struct FTW *ftw) {
+	if (flag!=FTW_F || !S_ISREG(st->st_mode)) return 0;
+	if (corpus_count==corpus_allocated) {
+		corpus_allocated=(corpus_allocated==0)?0x100:corpus_allocated*2;
+		corpus=(char**)realloc(corpus,corpus_allocated*sizeof(char*));
+		if (corpus==0) {perror("realloc");exit(1);}
+	}
+	path+=root_length;
+	while (*path=='/') ++path;
+	corpus[corpus_count++]=strdup(path);
+	return 0;
+}
+
+/**
+ * \brief Remove a file of the generated corpus, called by nftw
+ *
+ * \param path Path of the file
+ * \param st Attributes of the file
+ * \param flag Kind of file
+ * \param ftw Position of the file in the tree
+ * \return 0 so that the walk goes on
+ */
+int discard(const char *path,const struct stat *st,int flag,struct FTW *ftw) {
+	remove(path);
+	return 0;
+}
+
+/**
+ * \brief Remove the generated corpus, registered with atexit
+ */
+void remove_corpus() {
+	if (generated_exists) nftw(generated,discard,0x40,FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * \brief Write the files of the generated corpus
+ *
+ * One file out of four is a shell script, one is an executable without shebang and the others are plain files. Their extensions go through CORPUS_EXTENSIONS values, so that a pattern procedure matches files at every position of a list of up to 100 procedures, and some files match no pattern at all.
+ * \param folder Folder receiving the files, which already exists
+ */
+void write_corpus(const char *folder) {
+	char path[strlen(folder)+32];
+	size_t i;
+	for (i=0;i<CORPUS_FILES;++i) {
+		sprintf(path,"%s/file%zu.x%zu",folder,i,i%CORPUS_EXTENSIONS);
+		int fd=open(path,O_WRONLY | O_CREAT | O_TRUNC,(i%4<2)?0755:0644);
+		if (fd<0) {perror(path);exit(1);}
+		const char *content=(i%4==0)?"#!/bin/sh\necho script\n":"plain content of the file\n";
+		if (write(fd,content,strlen(content))<0) perror(path);
+		close(fd);
+	}
+}
+
+/**
+ * \brief Build a list of procedures from their descriptions
+ *
+ * The descriptions have the syntax of the -p option of the file system, and the patterns of the list are compiled as the file system does.
+ * \param descriptions Array of descriptions
+ * \param count Number of descriptions
+ * \return List of procedures, or a null pointer if one description is not valid
+ */
+Procedures *build_procedures(char **descriptions,size_t count) {
+	Procedures *first=0,*last=0;
+	size_t i;
+	for (i=0;i<count;++i) {
+		Procedure *proc=get_procedure_from_string(descriptions[i]);
+		if (proc==0) {fprintf(stderr,"Invalid procedure: %s\n",descriptions[i]);free_procedures(first);return 0;}
+		Procedures *procs=(Procedures*)malloc(sizeof(Procedures));
+		procs->procedure=proc;
+		procs->next=0;
+		procs->patterns=0;
+		if (last==0) first=procs; else last->next=procs;
+		last=procs;
+	}
+	compile_patterns(first);
+	return first;
+}
+
+/**
+ * \brief Measure the classification of the corpus by a list of procedures
+ *
+ * The function calls get_script on every file of the corpus, as many times as the number of passes. The verdict cache is cleared before each pass of the first measure, so that every call runs the tests, and kept during the second measure, which gives the cost of a call answered by the cache. The best pass of each measure is printed, in nanoseconds per call.
+ * \param procs List of procedures
+ * \param name Description of the list, printed with the results
+ * \param passes Number of passes over the corpus
+ */
+void measure(const Procedures *procs,const char *name,size_t passes) {
+	unsigned long long best_tests=~0ULL,best_cached=~0ULL,t0,t1;
+	size_t i,j,scripts=0;
+	for (i=0;i<passes;++i) {
+		verdict_cache_clear();
+		scripts=0;
+		t0=now();
+		for (j=0;j<corpus_count;++j) if (get_script(procs,corpus[j])!=0) ++scripts;
+		t1=now();
+		if (t1-t0<best_tests) best_tests=t1-t0;
+	}
+	for (i=0;i<passes;++i) {
+		t0=now();
+		for (j=0;j<corpus_count;++j) get_script(procs,corpus[j]);
+		t1=now();
+		if (t1-t0<best_cached) best_cached=t1-t0;
+	}
+	printf("%-24s %8zu %8zu %12.1f %12.1f\n",name,corpus_count,scripts,(double)best_tests/corpus_count,(double)best_cached/corpus_count);
+}
+
+/**
+ * \brief Display the syntax of the program and exit
+ *
+ * \param code Exit code of the program
+ */
+void print_usage(int code) {
+	printf("Syntax: classbench [-n passes] [-p procedure]... [folder]\n");
+	printf("	-n passes\n\t\tNumber of passes over the corpus for each measure (default %d)\n",DEFAULT_PASSES);
+	printf("	-p procedure\n\t\tProcedure, with the syntax of the file system, which can be repeated. Without this option, lists of 1, 10 and 100 pattern procedures followed by an automatic procedure are measured\n");
+	printf("	folder\n\t\tFolder which regular files are the corpus. Without it, a corpus of %d files is generated in a temporary folder\n",CORPUS_FILES);
+	exit(code);
+}
+
+/**
+ * \brief Main program, runs the benchmark
+ *
+ * The program classifies the files of a corpus with get_script, without mounting anything, and prints the cost of a call in nanoseconds with and without the verdict cache. Test servers and worker programs are not started, so the procedures should not use them.
+ * Syntax: classbench [-n passes] [-p procedure]... [folder]
+ * \param argc Number of command line arguments
+ * \param argv Array of command line arguments
+ * \param envp Array of environment variables
+ * \return Error code, 0 if everything went fine
+ */
+int main(int argc,char **argv,char **envp) {
+	size_t passes=DEFAULT_PASSES;
+	char **descriptions=(char**)malloc(argc*sizeof(char*));
+	size_t count=0;
+	int c;
+	while ((c=getopt(argc,argv,"n:p:h"))!=-1) switch (c) {
+		case 'n': passes=strtoul(optarg,0,10);break;
+		case 'p': descriptions[count++]=optarg;break;
+		case 'h': print_usage(0);
+		default: print_usage(1);
+	}
+	if (optind<argc-1 || passes==0) print_usage(1);
+	init_resources();
+	persistent.envp=envp;
+	const char *folder=(optind<argc)?argv[optind]:0;
+	if (folder==0) {
+		if (mkdtemp(generated)==0) {perror(generated);return 1;}
+		generated_exists=1;
+		atexit(remove_corpus);
+		folder=generated;
+		write_corpus(folder);
+	}
+	persistent.mirror=realpath(folder,0);
+	if (persistent.mirror==0) {perror(folder);return 1;}
+	persistent.mirror_len=strlen(persistent.mirror);
+	persistent.mirror_fd=open(persistent.mirror,O_RDONLY);
+	if (persistent.mirror_fd<0) {perror(folder);return 1;}
+	root_length=persistent.mirror_len;
+	nftw(persistent.mirror,collect,0x40,FTW_PHYS);
+	if (corpus_count==0) {fprintf(stderr,"No regular file in %s\n",folder);return 1;}
+	if (count>0 && (persistent.procs=build_procedures(descriptions,count))==0) return 1;
+	printf("%-24s %8s %8s %12s %12s\n","procedures","files","scripts","tests(ns)","cached(ns)");
+	if (count>0) measure(persistent.procs,"command line",passes);
+	else {
+		// Lists of pattern procedures, each one matching one extension, which only the last files of the list reach
+		const size_t sizes[]={1,10,100};
+		char **list=(char**)malloc(101*sizeof(char*));
+		size_t i,j;
+		for (i=0;i<sizeof(sizes)/sizeof(size_t);++i) {
+			for (j=0;j<sizes[i];++j) {
+				list[j]=(char*)malloc(48);
+				sprintf(list[j],"/bin/cat;&\\.x%zu$",j);
+			}
+			list[sizes[i]]="auto";
+			Procedures *procs=build_procedures(list,sizes[i]+1);
+			for (j=0;j<sizes[i];++j) free(list[j]);
+			if (procs==0) return 1;
+			char name[48];
+			snprintf(name,sizeof(name),"%zu patterns + auto",sizes[i]);
+			measure(procs,name,passes);
+			free_procedures(procs);
+		}
+		free(list);
+	}
+	size_t i;
+	for (i=0;i<corpus_count;++i) free(corpus[i]);
+	free(corpus);
+	free(descriptions);
+	close(persistent.mirror_fd);
+	free_resources();
+	return 0;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Load benchmark of scriptfs: builds a synthetic mirror tree with gentree, mounts scriptfs on it,
+# runs loadbench against the mount point and writes its JSON report, then unmounts the file system.
+#
+# Syntax: fsbench.sh bin report
+#	bin	Folder holding the scriptfs, gentree and loadbench executables
+#	report	File receiving the JSON report
+# The options of each step are read from the environment variables BENCH_TREE (gentree),
+# BENCH_MOUNT (scriptfs) and BENCH_LOAD (loadbench).
+
+BIN=${1:-.}
+REPORT=${2:-bench.json}
+WORK=`mktemp -d /tmp/scriptfs-bench.XXXXXX` || exit 1
+MIRROR=$WORK/mirror
+MOUNT=$WORK/mount
+
+cleanup() {
+	fusermount -u $MOUNT 2>/dev/null
+	rm -rf $WORK
+}
+trap cleanup EXIT INT TERM
+
+mkdir $MIRROR $MOUNT || exit 1
+$BIN/gentree $BENCH_TREE $MIRROR || exit 1
+$BIN/scriptfs $BENCH_MOUNT $MIRROR $MOUNT || exit 1
+$BIN/loadbench $BENCH_LOAD -o $REPORT $MOUNT || exit 1
+echo "Report written in $REPORT"
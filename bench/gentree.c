@@ -0,0 +1,171 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  gentree.c
+ *
+ *    Description:  Generator of synthetic mirror trees for the load benchmark
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 21:48:19
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define	DEFAULT_DEPTH 3	//!< Default number of levels of folders below the root
+#define	DEFAULT_FANOUT 4	//!< Default number of subfolders of each folder
+#define	DEFAULT_FILES 16	//!< Default number of files in each folder
+#define	DEFAULT_RATIO 0.25	//!< Default fraction of the files which are scripts
+#define	DEFAULT_RUNTIME 0	//!< Default time in milliseconds each script runs
+#define	DEFAULT_SIZE 0x10000	//!< Default size in bytes of the plain files
+#define	DEFAULT_OUTPUT 0x1000	//!< Default size in bytes of the output of the scripts
+
+/**
+ * \brief Shape of the generated tree
+ */
+typedef struct Shape {
+	unsigned int depth;	//!< Number of levels of folders below the root
+	unsigned int fanout;	//!< Number of subfolders of each folder
+	unsigned int files;	//!< Number of files in each folder
+	double ratio;	//!< Fraction of the files which are scripts
+	unsigned int runtime;	//!< Time in milliseconds each script runs
+	size_t size;	//!< Size in bytes of the plain files
+	size_t output;	//!< Size in bytes of the output of the scripts
+} Shape;
+
+static unsigned long long seed=0x2545f4914f6cdd1dULL;	//!< State of the pseudo-random generator, always started with the same value so that the trees are reproducible
+
+/**
+ * \brief Draw a pseudo-random number between 0 and 1
+ *
+ * \return Number drawn with a xorshift generator
+ */
+double draw() {
+	seed^=seed<<13;
+	seed^=seed>>7;
+	seed^=seed<<17;
+	return (double)(seed>>11)/(double)(1ULL<<53);
+}
+
+/**
+ * \brief Write a whole buffer in a new file
+ *
+ * \param path Path of the file
+ * \param data Content of the file
+ * \param size Number of bytes of the content
+ * \param mode Permissions of the file
+ * \return 0 if the file was written, -1 otherwise
+ */
+int write_file(const char *path,const char *data,size_t size,mode_t mode) {
+	int fd=open(path,O_WRONLY | O_CREAT | O_TRUNC,mode);
+	if (fd<0) return -1;
+	size_t done=0;
+	while (done<size) {
+		ssize_t num=write(fd,data+done,size-done);
+		if (num<=0) {close(fd);return -1;}
+		done+=num;
+	}
+	return close(fd);
+}
+
+/**
+ * \brief Fill a folder and its subfolders
+ *
+ * Scripts are named file<i>.sh and are shell scripts which sleep for the runtime and write their output, plain files are named file<i>.dat and subfolders dir<i>.
+ * \param path Path of the folder, which already exists
+ * \param level Number of levels of folders still to create below this one
+ * \param shape Shape of the tree
+ * \param script Content of the scripts
+ * \param plain Content of the plain files
+ * \return Number of files created, or -1 if something went wrong
+ */
+long fill(const char *path,unsigned int level,const Shape *shape,const char *script,const char *plain) {
+	char name[strlen(path)+32];
+	unsigned int i;
+	long count=0;
+	for (i=0;i<shape->files;++i) {
+		int isscript=(draw()<shape->ratio);
+		sprintf(name,"%s/file%u.%s",path,i,isscript?"sh":"dat");
+		if (((isscript)?write_file(name,script,strlen(script),0755):write_file(name,plain,shape->size,0644))!=0) {perror(name);return -1;}
+		++count;
+	}
+	if (level==0) return count;
+	for (i=0;i<shape->fanout;++i) {
+		sprintf(name,"%s/dir%u",path,i);
+		if (mkdir(name,0755)!=0 && errno!=EEXIST) {perror(name);return -1;}
+		long sub=fill(name,level-1,shape,script,plain);
+		if (sub<0) return -1;
+		count+=sub;
+	}
+	return count;
+}
+
+/**
+ * \brief Display the syntax of the program and exit
+ *
+ * \param code Exit code of the program
+ */
+void print_usage(int code) {
+	printf("Syntax: gentree [-d depth] [-f fanout] [-n files] [-s ratio] [-r runtime] [-b size] [-o output] folder\n");
+	printf("	-d depth\n\t\tNumber of levels of folders below the root (default %d)\n",DEFAULT_DEPTH);
+	printf("	-f fanout\n\t\tNumber of subfolders of each folder (default %d)\n",DEFAULT_FANOUT);
+	printf("	-n files\n\t\tNumber of files in each folder (default %d)\n",DEFAULT_FILES);
+	printf("	-s ratio\n\t\tFraction of the files which are scripts (default %.2f)\n",DEFAULT_RATIO);
+	printf("	-r runtime\n\t\tTime in milliseconds each script runs (default %d)\n",DEFAULT_RUNTIME);
+	printf("	-b size\n\t\tSize in bytes of the plain files (default %d)\n",DEFAULT_SIZE);
+	printf("	-o output\n\t\tSize in bytes of the output of the scripts (default %d)\n",DEFAULT_OUTPUT);
+	exit(code);
+}
+
+/**
+ * \brief Main program, generates a tree
+ *
+ * The tree is always the same for the same arguments. The folder is created if it does not exist.
+ * Syntax: gentree [-d depth] [-f fanout] [-n files] [-s ratio] [-r runtime] [-b size] [-o output] folder
+ * \param argc Number of command line arguments
+ * \param argv Array of command line arguments
+ * \return Error code, 0 if everything went fine
+ */
+int main(int argc,char **argv) {
+	Shape shape={DEFAULT_DEPTH,DEFAULT_FANOUT,DEFAULT_FILES,DEFAULT_RATIO,DEFAULT_RUNTIME,DEFAULT_SIZE,DEFAULT_OUTPUT};
+	int c;
+	while ((c=getopt(argc,argv,"d:f:n:s:r:b:o:h"))!=-1) switch (c) {
+		case 'd': shape.depth=strtoul(optarg,0,10);break;
+		case 'f': shape.fanout=strtoul(optarg,0,10);break;
+		case 'n': shape.files=strtoul(optarg,0,10);break;
+		case 's': shape.ratio=strtod(optarg,0);break;
+		case 'r': shape.runtime=strtoul(optarg,0,10);break;
+		case 'b': shape.size=strtoul(optarg,0,10);break;
+		case 'o': shape.output=strtoul(optarg,0,10);break;
+		case 'h': print_usage(0);
+		default: print_usage(1);
+	}
+	if (optind!=argc-1) print_usage(1);
+	const char *root=argv[optind];
+	if (mkdir(root,0755)!=0 && errno!=EEXIST) {perror(root);return 1;}
+	// The scripts sleep for the runtime, then write as many characters as the output size
+	char script[256];
+	if (shape.runtime>0) snprintf(script,sizeof(script),"#!/bin/sh\nsleep %u.%03u\nhead -c %zu /dev/zero | tr '\\0' x\n",shape.runtime/1000,shape.runtime%1000,shape.output);
+	else snprintf(script,sizeof(script),"#!/bin/sh\nhead -c %zu /dev/zero | tr '\\0' x\n",shape.output);
+	char *plain=(char*)malloc(shape.size+1);
+	size_t i;
+	for (i=0;i<shape.size;++i) plain[i]=(i%64==63)?'\n':'a'+(i%26);
+	long count=fill(root,shape.depth,&shape,script,plain);
+	free(plain);
+	if (count<0) return 1;
+	printf("%ld files created in %s\n",count,root);
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  loadbench.c
+ *
+ *    Description:  Multithreaded load benchmark of a mounted file system
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 22:03:41
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_XOPEN_SOURCE 700	//!< Needed for nftw
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define	DEFAULT_THREADS 4	//!< Default number of threads running each workload
+#define	DEFAULT_DURATION 5.0	//!< Default time in seconds each workload runs
+#define	READ_BUFFER 0x20000	//!< Size of the buffer of the read calls
+
+/**
+ * \brief Kind of workload
+ */
+typedef enum Workload {
+	WORK_STAT,	//!< Read of the attributes of any file or folder, measuring sfs_lookup and sfs_getattr
+	WORK_READDIR,	//!< Read of all the entries of a folder, measuring sfs_opendir and sfs_readdir
+	WORK_SCRIPT,	//!< Opening and read of a script until the end of its output, measuring sfs_open and sfs_read of scripts
+	WORK_STREAM,	//!< Opening and read of a plain file until its end, measuring sfs_read of regular files
+	WORK_COUNT	//!< Number of workloads
+} Workload;
+
+static const char *workload_names[WORK_COUNT]={"stat","readdir","script","stream"};	//!< Names of the workloads on the command line and in the report
+
+/**
+ * \brief List of paths
+ */
+typedef struct Paths {
+	char **items;	//!< Array of the paths
+	size_t count;	//!< Number of paths in the array
+	size_t allocated;	//!< Number of slots of the array
+} Paths;
+
+static Paths all;	//!< Every file and folder of the tree
+static Paths folders;	//!< Folders of the tree
+static Paths scripts;	//!< Scripts of the tree, which names end with .sh
+static Paths plains;	//!< Plain files of the tree, which names end with .dat
+
+/**
+ * \brief Measures of one thread
+ */
+typedef struct Run {
+	pthread_t thread;	//!< Thread running the workload
+	Workload work;	//!< Workload
+	unsigned int index;	//!< Index of the thread, which decides the first path it uses
+	unsigned long long end;	//!< Time at which the workload stops
+	unsigned long long *latencies;	//!< Duration in nanoseconds of each operation
+	size_t count;	//!< Number of operations
+	size_t allocated;	//!< Number of slots of the array of latencies
+	unsigned long errors;	//!< Number of operations which failed
+	unsigned long long bytes;	//!< Number of bytes read
+} Run;
+
+/**
+ * \brief Read the monotonic clock
+ *
+ * \return Current time in nanoseconds
+ */
+unsigned long long now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+/**
+ * \brief Add a path to a list
+ *
+ * \param paths List of paths
+ * \param path Path, which is copied
+ */
+void add_path(Paths *paths,const char *path) {
+	if (paths->count==paths->allocated) {
+		paths->allocated=(paths->allocated==0)?0x100:paths->allocated*2;
+		paths->items=(char**)realloc(paths->items,paths->allocated*sizeof(char*));
+		if (paths->items==0) {perror("realloc");exit(1);}
+	}
+	paths->items[paths->count++]=strdup(path);
+}
+
+/**
+ * \brief Sort a path found in the tree, called by nftw
+ *
+ * \param path Path of the file
+ * \param st Attributes of the file
+ * \param flag Kind of file
+ * \param ftw Position of the file in the tree
+ * \return 0 so that the walk goes on
+ */
+int collect(const char *path,const struct stat *st,int flag,struct FTW *ftw) {
+	add_path(&all,path);
+	size_t length=strlen(path);
+	if (flag==FTW_D) add_path(&folders,path);
+	else if (length>3 && strcmp(path+length-3,".sh")==0) add_path(&scripts,path);
+	else if (length>4 && strcmp(path+length-4,".dat")==0) add_path(&plains,path);
+	return 0;
+}
+
+/**
+ * \brief Read a file until its end
+ *
+ * \param path Path of the file
+ * \param buffer Buffer of READ_BUFFER bytes receiving the content
+ * \return Number of bytes read, or -1 if the file could not be read
+ */
+long long read_file(const char *path,char *buffer) {
+	int fd=open(path,O_RDONLY);
+	if (fd<0) return -1;
+	long long total=0;
+	ssize_t num;
+	while ((num=read(fd,buffer,READ_BUFFER))>0) total+=num;
+	close(fd);
+	return (num<0)?-1:total;
+}
+
+/**
+ * \brief Read all the entries of a folder
+ *
+ * \param path Path of the folder
+ * \return Number of entries, or -1 if the folder could not be read
+ */
+long long read_folder(const char *path) {
+	DIR *dir=opendir(path);
+	if (dir==0) return -1;
+	long long count=0;
+	while (readdir(dir)!=0) ++count;
+	closedir(dir);
+	return count;
+}
+
+/**
+ * \brief Run a workload until its end time, started in a new thread
+ *
+ * The threads go through the same list of paths with different starting points and strides, so that they hit different files at the same time while the sequence stays the same from one run to the other.
+ * \param arg Pointer to the Run structure of the thread
+ * \return Null pointer
+ */
+void *run_workload(void *arg) {
+	Run *run=(Run*)arg;
+	const Paths *paths=(run->work==WORK_STAT)?&all:((run->work==WORK_READDIR)?&folders:((run->work==WORK_SCRIPT)?&scripts:&plains));
+	char *buffer=(char*)malloc(READ_BUFFER);
+	size_t position=(run->index*7919)%paths->count;
+	size_t stride=1+(run->index*104729)%paths->count;
+	struct stat st;
+	unsigned long long t0,t1;
+	do {
+		const char *path=paths->items[position];
+		position=(position+stride)%paths->count;
+		long long result;
+		t0=now();
+		switch (run->work) {
+			case WORK_STAT: result=stat(path,&st);break;
+			case WORK_READDIR: result=read_folder(path);break;
+			default: result=read_file(path,buffer);
+		}
+		t1=now();
+		if (result<0) {++run->errors;continue;}
+		if (run->work==WORK_SCRIPT || run->work==WORK_STREAM) run->bytes+=result;
+		if (run->count==run->allocated) {
+			run->allocated=(run->allocated==0)?0x1000:run->allocated*2;
+			run->latencies=(unsigned long long*)realloc(run->latencies,run->allocated*sizeof(unsigned long long));
+			if (run->latencies==0) {perror("realloc");exit(1);}
+		}
+		run->latencies[run->count++]=t1-t0;
+	} while (t1<run->end);
+	free(buffer);
+	return 0;
+}
+
+/**
+ * \brief Compare two latencies, used to sort the measures
+ *
+ * \param a Pointer to the first latency
+ * \param b Pointer to the second latency
+ * \return Negative, null or positive value as the first latency is lower, equal or greater than the second one
+ */
+int compare_latencies(const void *a,const void *b) {
+	unsigned long long x=*(const unsigned long long*)a,y=*(const unsigned long long*)b;
+	return (x<y)?-1:((x>y)?1:0);
+}
+
+/**
+ * \brief Get a percentile of sorted latencies
+ *
+ * \param latencies Sorted array of latencies in nanoseconds
+ * \param count Number of latencies
+ * \param p Fraction of the operations, between 0 and 1
+ * \return Latency in microseconds below which the given fraction of the operations ended, 0 if there is no latency
+ */
+double percentile(const unsigned long long *latencies,size_t count,double p) {
+	if (count==0) return 0;
+	size_t rank=(size_t)(p*count);
+	if ((double)rank<p*count) ++rank;
+	if (rank>0) --rank;
+	return latencies[rank]/1000.0;
+}
+
+/**
+ * \brief Run a workload in several threads and write its results
+ *
+ * \param f Stream of the report
+ * \param work Workload
+ * \param threads Number of threads
+ * \param duration Time in seconds the workload runs
+ * \param first Tells if this is the first workload written in the report
+ */
+void measure(FILE *f,Workload work,unsigned int threads,double duration,int first) {
+	const Paths *paths=(work==WORK_STAT)?&all:((work==WORK_READDIR)?&folders:((work==WORK_SCRIPT)?&scripts:&plains));
+	fprintf(f,"%s\n    \"%s\": {",first?"":",",workload_names[work]);
+	if (paths->count==0) {fprintf(f,"\"skipped\": true}");return;}
+	Run *runs=(Run*)calloc(threads,sizeof(Run));
+	unsigned long long start=now();
+	unsigned int i;
+	for (i=0;i<threads;++i) {
+		runs[i].work=work;
+		runs[i].index=i;
+		runs[i].end=start+(unsigned long long)(duration*1e9);
+		if (pthread_create(&runs[i].thread,0,run_workload,runs+i)!=0) {perror("pthread_create");exit(1);}
+	}
+	size_t count=0;
+	unsigned long errors=0;
+	unsigned long long bytes=0;
+	for (i=0;i<threads;++i) {
+		pthread_join(runs[i].thread,0);
+		count+=runs[i].count;
+		errors+=runs[i].errors;
+		bytes+=runs[i].bytes;
+	}
+	double elapsed=(now()-start)/1e9;
+	unsigned long long *latencies=(unsigned long long*)malloc((count+1)*sizeof(unsigned long long));
+	size_t j=0;
+	for (i=0;i<threads;++i) {
+		if (runs[i].count>0) memcpy(latencies+j,runs[i].latencies,runs[i].count*sizeof(unsigned long long));
+		j+=runs[i].count;
+		free(runs[i].latencies);
+	}
+	free(runs);
+	qsort(latencies,count,sizeof(unsigned long long),compare_latencies);
+	fprintf(f,"\"ops\": %zu, \"errors\": %lu, \"seconds\": %.3f, \"ops_per_s\": %.1f, \"bytes_per_s\": %.1f, ",count,errors,elapsed,count/elapsed,bytes/elapsed);
+	fprintf(f,"\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f}",percentile(latencies,count,0.5),percentile(latencies,count,0.99),percentile(latencies,count,0.999));
+	free(latencies);
+}
+
+/**
+ * \brief Display the syntax of the program and exit
+ *
+ * \param code Exit code of the program
+ */
+void print_usage(int code) {
+	printf("Syntax: loadbench [-t threads] [-d duration] [-w workloads] [-o report] folder\n");
+	printf("	-t threads\n\t\tNumber of threads running each workload (default %d)\n",DEFAULT_THREADS);
+	printf("	-d duration\n\t\tTime in seconds each workload runs (default %.0f)\n",DEFAULT_DURATION);
+	printf("	-w workloads\n\t\tComma-separated list of workloads among stat, readdir, script and stream (default all of them)\n");
+	printf("	-o report\n\t\tFile receiving the report (default standard output)\n");
+	exit(code);
+}
+
+/**
+ * \brief Main program, runs the benchmark
+ *
+ * The program walks the folder, which should be the mount point of a tree built by gentree, then runs each workload one after the other and writes a JSON report with the number of operations, the throughput and the 50th, 99th and 99.9th percentiles of the latency of each one. The walk itself warms the caches of the kernel and of the file system up.
+ * Syntax: loadbench [-t threads] [-d duration] [-w workloads] [-o report] folder
+ * \param argc Number of command line arguments
+ * \param argv Array of command line arguments
+ * \return Error code, 0 if everything went fine
+ */
+int main(int argc,char **argv) {
+	unsigned int threads=DEFAULT_THREADS;
+	double duration=DEFAULT_DURATION;
+	int selected[WORK_COUNT]={1,1,1,1};
+	const char *report=0;
+	int c,i;
+	while ((c=getopt(argc,argv,"t:d:w:o:h"))!=-1) switch (c) {
+		case 't': threads=strtoul(optarg,0,10);break;
+		case 'd': duration=strtod(optarg,0);break;
+		case 'w': {
+			memset(selected,0,sizeof(selected));
+			char *list=strdup(optarg);
+			char *saveptr;
+			char *name;
+			for (name=strtok_r(list,",",&saveptr);name!=0;name=strtok_r(0,",",&saveptr)) {
+				for (i=0;i<WORK_COUNT && strcmp(name,workload_names[i])!=0;++i);
+				if (i==WORK_COUNT) {fprintf(stderr,"Unknown workload %s\n",name);print_usage(1);}
+				selected[i]=1;
+			}
+			free(list);
+		};break;
+		case 'o': report=optarg;break;
+		case 'h': print_usage(0);
+		default: print_usage(1);
+	}
+	if (optind!=argc-1 || threads==0 || duration<=0) print_usage(1);
+	if (nftw(argv[optind],collect,0x40,FTW_PHYS)!=0) {perror(argv[optind]);return 1;}
+	FILE *f=(report==0)?stdout:fopen(report,"w");
+	if (f==0) {perror(report);return 1;}
+	fprintf(f,"{\n  \"threads\": %u,\n  \"duration_s\": %.3f,\n",threads,duration);
+	fprintf(f,"  \"tree\": {\"entries\": %zu, \"folders\": %zu, \"scripts\": %zu, \"plain_files\": %zu},\n",all.count,folders.count,scripts.count,plains.count);
+	fprintf(f,"  \"workloads\": {");
+	int first=1;
+	for (i=0;i<WORK_COUNT;++i) if (selected[i]) {
+		measure(f,(Workload)i,threads,duration,first);
+		first=0;
+		fflush(f);
+	}
+	fprintf(f,"\n  }\n}\n");
+	if (f!=stdout) fclose(f);
+	return 0;
+}
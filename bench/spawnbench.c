@@ -0,0 +1,112 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  spawnbench.c
+ *
+ *    Description:  Micro-benchmark of the methods used to create processes
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 11:40:07
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "spawner.h"
+
+#define	DEFAULT_ITERATIONS 200	//!< Number of processes created for each measure if no other value is given on the command line
+#define	PROGRAM "/bin/true"	//!< Program executed by the created processes
+
+extern char **environ;
+
+/**
+ * \brief Compare two durations, used to sort the measures
+ *
+ * \param a Pointer to the first duration
+ * \param b Pointer to the second duration
+ * \return Negative, null or positive value as the first duration is lower, equal or greater than the second one
+ */
+int compare_durations(const void *a,const void *b) {
+	double x=*(const double*)a,y=*(const double*)b;
+	return (x<y)?-1:((x>y)?1:0);
+}
+
+/**
+ * \brief Measure the latency of one method of process creation
+ *
+ * The function creates the given number of processes executing PROGRAM, waits for each one, and prints the mean, median and 99th percentile of the time needed from the creation of the process to the end of its execution.
+ * \param spawner Method used to create the processes
+ * \param name Name of the method, printed with the results
+ * \param rss Size of the memory used by the benchmark, printed with the results
+ * \param iterations Number of processes to create
+ */
+void measure(Spawner spawner,const char *name,size_t rss,size_t iterations) {
+	const char *args[]={PROGRAM,0};
+	SpawnRequest req;
+	req.exec_fd=open(PROGRAM,O_RDONLY | O_CLOEXEC);
+	req.args=args;
+	req.envp=environ;
+	req.in=-1;
+	req.out=-1;
+	req.script=-1;
+	req.group=0;
+	if (req.exec_fd<0) {perror(PROGRAM);exit(1);}
+	double *durations=(double*)malloc(iterations*sizeof(double));
+	double total=0;
+	size_t i;
+	struct timespec t0,t1;
+	for (i=0;i<iterations;++i) {
+		clock_gettime(CLOCK_MONOTONIC,&t0);
+		pid_t pid=spawn_process(spawner,&req);
+		if (pid<0) {perror(name);exit(1);}
+		wait_process(pid);
+		clock_gettime(CLOCK_MONOTONIC,&t1);
+		durations[i]=(t1.tv_sec-t0.tv_sec)*1e6+(t1.tv_nsec-t0.tv_nsec)/1e3;
+		total+=durations[i];
+	}
+	qsort(durations,iterations,sizeof(double),compare_durations);
+	printf("%-8zu %-12s %10.1f %10.1f %10.1f\n",rss>>20,name,total/iterations,durations[iterations/2],durations[(iterations*99)/100]);
+	free(durations);
+	close(req.exec_fd);
+}
+
+/**
+ * \brief Main program, runs the benchmark
+ *
+ * The program grows its resident memory to 10 MB, 1 GB and 4 GB, and for each size measures the latency of fork, vfork, posix_spawn and the zygote. Sizes which can not be allocated are skipped.
+ * Syntax: spawnbench [iterations]
+ * \param argc Number of command line arguments
+ * \param argv Array of command line arguments
+ * \return Error code, 0 if everything went fine
+ */
+int main(int argc,char **argv) {
+	size_t iterations=(argc>1)?strtoul(argv[1],0,10):DEFAULT_ITERATIONS;
+	if (iterations==0) iterations=DEFAULT_ITERATIONS;
+	const size_t sizes[]={(size_t)10<<20,(size_t)1<<30,(size_t)4<<30};
+	size_t i;
+	int zygote=(start_zygote()==0);	// The zygote is forked before the memory grows
+	printf("%-8s %-12s %10s %10s %10s\n","rss(MB)","method","mean(us)","p50(us)","p99(us)");
+	for (i=0;i<sizeof(sizes)/sizeof(size_t);++i) {
+		char *block=(char*)mmap(0,sizes[i],PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+		if (block==MAP_FAILED) {printf("%-8zu skipped, memory can not be allocated\n",sizes[i]>>20);continue;}
+		memset(block,1,sizes[i]);	// Touch every page so that it is resident and mapped in the page tables
+		measure(SPAWN_FORK,"fork",sizes[i],iterations);
+		measure(SPAWN_VFORK,"vfork",sizes[i],iterations);
+		measure(SPAWN_POSIX,"posix_spawn",sizes[i],iterations);
+		if (zygote) measure(SPAWN_ZYGOTE,"zygote",sizes[i],iterations);
+		munmap(block,sizes[i]);
+	}
+	if (zygote) stop_zygote();
+	return 0;
+}
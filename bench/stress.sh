@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# Concurrency check of scriptfs: mounts scriptfs on a mirror of scripts which outputs are known,
+# then opens them from many parallel readers at the same time, the readers of a round reading
+# either the same script or different ones, and compares every output with the expected one.
+# Every script sleeps a known time before writing its output, so that the executions of a round
+# overlap: the check fails if any output differs, if a read fails, if a reader does not end in
+# time, or if a round lasts half as long as its executions would one after the other, which
+# means that they were serialized.
+#
+# Syntax: stress.sh bin
+#	bin	Folder holding the scriptfs executable
+# The options of the mount are read from the environment variable STRESS_MOUNT, the number of
+# parallel readers from STRESS_READERS (default 16), the number of rounds from STRESS_ROUNDS
+# (default 20) and the time in seconds each script sleeps from STRESS_SLEEP (default 1).
+
+BIN=${1:-.}
+READERS=${STRESS_READERS:-16}
+ROUNDS=${STRESS_ROUNDS:-20}
+SLEEP=${STRESS_SLEEP:-1}
+SCRIPTS=8
+LIMIT=`expr $READERS \* $SLEEP \* 500`	# Longest time a round may last, in milliseconds
+WORK=`mktemp -d /tmp/scriptfs-stress.XXXXXX` || exit 1
+MIRROR=$WORK/mirror
+MOUNT=$WORK/mount
+EXPECTED=$WORK/expected
+RESULTS=$WORK/results
+
+cleanup() {
+	fusermount -u $MOUNT 2>/dev/null
+	rm -rf $WORK
+}
+trap cleanup EXIT INT TERM
+
+mkdir $MIRROR $MOUNT $EXPECTED $RESULTS || exit 1
+# The scripts write a few kilobytes, except the last one which writes a large output read in many chunks
+i=0
+while [ $i -lt $SCRIPTS ]; do
+	if [ $i -eq `expr $SCRIPTS - 1` ]; then
+		printf 'head -c 2000000 /dev/zero | tr "\\0" %s\n' $i > $WORK/body$i
+	else
+		printf 'j=0\nwhile [ $j -lt 500 ]; do echo "line $j of script %s"; j=`expr $j + 1`; done\n' $i > $WORK/body$i
+	fi
+	sh $WORK/body$i > $EXPECTED/script$i.sh || exit 1
+	printf '#!/bin/sh\nsleep %s\n' $SLEEP | cat - $WORK/body$i > $MIRROR/script$i.sh
+	chmod +x $MIRROR/script$i.sh
+	i=`expr $i + 1`
+done
+$BIN/scriptfs $STRESS_MOUNT $MIRROR $MOUNT || exit 1
+
+# Even rounds open the same script from every reader, odd rounds spread the readers over the scripts
+failures=0
+slow=0
+round=0
+while [ $round -lt $ROUNDS ]; do
+	start=`date +%s%N`
+	reader=0
+	while [ $reader -lt $READERS ]; do
+		if [ `expr $round % 2` -eq 0 ]; then n=`expr $round / 2 % $SCRIPTS`; else n=`expr $reader % $SCRIPTS`; fi
+		( timeout 60 cat $MOUNT/script$n.sh > $RESULTS/$reader.out 2>/dev/null && cmp -s $RESULTS/$reader.out $EXPECTED/script$n.sh ) || echo "round $round reader $reader: wrong output of script$n.sh" > $RESULTS/$reader.fail &
+		reader=`expr $reader + 1`
+	done
+	wait
+	elapsed=`expr \( \`date +%s%N\` - $start \) / 1000000`
+	if [ $READERS -ge 4 ] && [ $elapsed -ge $LIMIT ]; then	# With fewer readers, the limit would be too close to the time of one execution
+		echo "round $round: $elapsed ms for $READERS readers of scripts sleeping $SLEEP s, the executions were serialized"
+		slow=`expr $slow + 1`
+	fi
+	for f in $RESULTS/*.fail; do
+		[ -f "$f" ] || continue
+		cat "$f"
+		failures=`expr $failures + 1`
+		rm -f "$f"
+	done
+	round=`expr $round + 1`
+done
+if [ $failures -ne 0 ] || [ $slow -ne 0 ]; then
+	echo "$failures of `expr $READERS \* $ROUNDS` reads failed, $slow of $ROUNDS rounds were serialized"
+	exit 1
+fi
+echo "`expr $READERS \* $ROUNDS` parallel reads gave the expected outputs"
@@ -0,0 +1,682 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  cache.c
+ *
+ *    Description:  Implementation of the caches of results computed on files
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 09:14:02
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "procedures.h"
+#include "operations.h"
+#include "cache.h"
+
+#define	OUTPUT_CACHE_BUCKETS 0x400	//!< Number of buckets of the hash table of the output cache, must be a power of two
+#define	OUTPUT_NAME_LENGTH (2*HASH_DIGEST_LENGTH+1)	//!< Length of the name of a file of the disk tier (hexadecimal digest and null character)
+
+/********************************************/
+/*                 HASHING                  */
+/********************************************/
+static const uint32_t hash_constants[64]={	//!< Round constants of SHA-256
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+#define	ROTR(x,n) (((x)>>(n)) | ((x)<<(32-(n))))	//!< Right rotation of a 32-bit word
+
+/**
+ * \brief Process a block of 64 bytes
+ *
+ * \param state Intermediate digest, updated by the function
+ * \param block Block of bytes
+ */
+static void hash_block(uint32_t *state,const unsigned char *block) {
+	uint32_t w[64];
+	int i;
+	for (i=0;i<16;++i) w[i]=((uint32_t)block[4*i]<<24) | ((uint32_t)block[4*i+1]<<16) | ((uint32_t)block[4*i+2]<<8) | block[4*i+3];
+	for (i=16;i<64;++i) {
+		uint32_t s0=ROTR(w[i-15],7)^ROTR(w[i-15],18)^(w[i-15]>>3);
+		uint32_t s1=ROTR(w[i-2],17)^ROTR(w[i-2],19)^(w[i-2]>>10);
+		w[i]=w[i-16]+s0+w[i-7]+s1;
+	}
+	uint32_t a=state[0],b=state[1],c=state[2],d=state[3],e=state[4],f=state[5],g=state[6],h=state[7];
+	for (i=0;i<64;++i) {
+		uint32_t t1=h+(ROTR(e,6)^ROTR(e,11)^ROTR(e,25))+((e & f)^(~e & g))+hash_constants[i]+w[i];
+		uint32_t t2=(ROTR(a,2)^ROTR(a,13)^ROTR(a,22))+((a & b)^(a & c)^(b & c));
+		h=g;g=f;f=e;e=d+t1;d=c;c=b;b=a;a=t1+t2;
+	}
+	state[0]+=a;state[1]+=b;state[2]+=c;state[3]+=d;state[4]+=e;state[5]+=f;state[6]+=g;state[7]+=h;
+}
+
+void hash_init(Hasher *hasher) {
+	static const uint32_t initial[8]={0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19};
+	memcpy(hasher->state,initial,sizeof(initial));
+	hasher->length=0;
+}
+
+void hash_update(Hasher *hasher,const void *data,size_t size) {
+	const unsigned char *d=(const unsigned char*)data;
+	size_t used=hasher->length%64;
+	hasher->length+=size;
+	if (used>0) {	// Complete the pending block first
+		size_t n=(size<64-used)?size:64-used;
+		memcpy(hasher->block+used,d,n);
+		d+=n;
+		size-=n;
+		if (used+n<64) return;
+		hash_block(hasher->state,hasher->block);
+	}
+	for (;size>=64;d+=64,size-=64) hash_block(hasher->state,d);
+	memcpy(hasher->block,d,size);
+}
+
+void hash_final(Hasher *hasher,unsigned char *digest) {
+	unsigned long long bits=hasher->length*8;
+	size_t used=hasher->length%64;
+	hasher->block[used++]=0x80;
+	if (used>56) {	// No room left for the length in this block
+		memset(hasher->block+used,0,64-used);
+		hash_block(hasher->state,hasher->block);
+		used=0;
+	}
+	memset(hasher->block+used,0,56-used);
+	int i;
+	for (i=0;i<8;++i) hasher->block[56+i]=(unsigned char)(bits>>(56-8*i));
+	hash_block(hasher->state,hasher->block);
+	for (i=0;i<32;++i) digest[i]=(unsigned char)(hasher->state[i/4]>>(24-8*(i%4)));
+}
+
+unsigned long long hash_string(const char *str) {
+	unsigned long long h=0xcbf29ce484222325ULL;
+	while (*str!=0) {
+		h^=(unsigned char)*(str++);
+		h*=0x100000001b3ULL;
+	}
+	return h;
+}
+
+/********************************************/
+/*              VERDICT CACHE               */
+/********************************************/
+/**
+ * \brief Entry of the verdict cache
+ *
+ * An entry stores the result of get_script for one version of a file. The fields copied from the stat structure identify the version of the file.
+ */
+typedef struct Verdict {
+	int valid;	//!< Tells if the entry holds a verdict
+	dev_t dev;	//!< Device of the file
+	ino_t ino;	//!< Inode of the file
+	struct timespec mtim;	//!< Last modification time of the file
+	struct timespec ctim;	//!< Last change time of the file
+	off_t size;	//!< Size of the file
+	unsigned long long name;	//!< Hash of the path of the file, since some tests depend on the name and not only on the content of the file
+	const Procedures *procs;	//!< List of procedures used to compute the verdict
+	Procedure *proc;	//!< Procedure matching the file, null if the file is not a script
+} Verdict;
+
+static Verdict verdicts[VERDICT_CACHE_SIZE];	//!< Slots of the verdict cache
+static pthread_mutex_t verdict_locks[VERDICT_CACHE_LOCKS];	//!< Locks protecting the slots, slot i is protected by lock i modulo VERDICT_CACHE_LOCKS
+static unsigned long verdict_hits;	//!< Number of successful lookups
+static unsigned long verdict_misses;	//!< Number of failed lookups
+
+/**
+ * \brief Compute the slot of a file in a cache indexed by the identity of files
+ *
+ * \param st Attributes of the file
+ * \param size Number of slots of the cache, which must be a power of two
+ * \return Index of the slot
+ */
+static size_t file_slot(const struct stat *st,size_t size) {
+	unsigned long long h=(unsigned long long)st->st_ino*0x9e3779b97f4a7c15ULL;
+	h^=(unsigned long long)st->st_dev+(h>>29);
+	return (size_t)(h>>17) & (size-1);
+}
+
+/**
+ * \brief Tell if the attributes of a file match those of the version stored in a cache entry
+ *
+ * \param dev Device of the stored version
+ * \param ino Inode of the stored version
+ * \param mtim Last modification time of the stored version
+ * \param ctim Last change time of the stored version
+ * \param size Size of the stored version
+ * \param st Current attributes of the file
+ * \return 1 if the versions are the same, 0 otherwise
+ */
+static int same_version(dev_t dev,ino_t ino,const struct timespec *mtim,const struct timespec *ctim,off_t size,const struct stat *st) {
+	return ino==st->st_ino && dev==st->st_dev && size==st->st_size
+		&& mtim->tv_sec==st->st_mtim.tv_sec && mtim->tv_nsec==st->st_mtim.tv_nsec
+		&& ctim->tv_sec==st->st_ctim.tv_sec && ctim->tv_nsec==st->st_ctim.tv_nsec;
+}
+
+void init_verdict_cache() {
+	size_t i;
+	for (i=0;i<VERDICT_CACHE_LOCKS;++i) pthread_mutex_init(verdict_locks+i,0);
+	memset(verdicts,0,sizeof(verdicts));
+	verdict_hits=0;
+	verdict_misses=0;
+}
+
+void free_verdict_cache() {
+	size_t i;
+	for (i=0;i<VERDICT_CACHE_LOCKS;++i) pthread_mutex_destroy(verdict_locks+i);
+}
+
+/**
+ * \brief Tell if an entry of the verdict cache matches a version of a file
+ *
+ * The lock of the slot of the entry must be held by the caller.
+ * \param v Entry
+ * \param procs List of procedures used to compute the verdict
+ * \param name Hash of the path of the file
+ * \param st Attributes of the file
+ * \return 1 if the entry holds the verdict of the file, 0 otherwise
+ */
+static int verdict_match(const Verdict *v,const Procedures *procs,unsigned long long name,const struct stat *st) {
+	return v->valid && v->name==name && v->procs==procs && same_version(v->dev,v->ino,&v->mtim,&v->ctim,v->size,st);
+}
+
+int verdict_cache_lookup(const Procedures *procs,const char *file,const struct stat *st,Procedure **proc) {
+	size_t slot=file_slot(st,VERDICT_CACHE_SIZE);
+	unsigned long long name=hash_string(file);
+	int found=0;
+	pthread_mutex_lock(verdict_locks+(slot & (VERDICT_CACHE_LOCKS-1)));
+	Verdict *v=verdicts+slot;
+	if (verdict_match(v,procs,name,st)) {
+		*proc=v->proc;
+		found=1;
+	}
+	pthread_mutex_unlock(verdict_locks+(slot & (VERDICT_CACHE_LOCKS-1)));
+	__atomic_fetch_add(found?&verdict_hits:&verdict_misses,1,__ATOMIC_RELAXED);
+	return found;
+}
+
+void verdict_cache_store(const Procedures *procs,const char *file,const struct stat *st,Procedure *proc) {
+	size_t slot=file_slot(st,VERDICT_CACHE_SIZE);
+	unsigned long long name=hash_string(file);
+	pthread_mutex_lock(verdict_locks+(slot & (VERDICT_CACHE_LOCKS-1)));
+	Verdict *v=verdicts+slot;
+	v->valid=1;
+	v->dev=st->st_dev;
+	v->ino=st->st_ino;
+	v->mtim=st->st_mtim;
+	v->ctim=st->st_ctim;
+	v->size=st->st_size;
+	v->name=name;
+	v->procs=procs;
+	v->proc=proc;
+	pthread_mutex_unlock(verdict_locks+(slot & (VERDICT_CACHE_LOCKS-1)));
+}
+
+void verdict_cache_forget(const char *file) {
+	unsigned long long name=hash_string(file);
+	size_t i,j;
+	for (i=0;i<VERDICT_CACHE_LOCKS;++i) {	// Take each lock once and scan the slots it protects
+		pthread_mutex_lock(verdict_locks+i);
+		for (j=i;j<VERDICT_CACHE_SIZE;j+=VERDICT_CACHE_LOCKS) if (verdicts[j].name==name) verdicts[j].valid=0;
+		pthread_mutex_unlock(verdict_locks+i);
+	}
+}
+
+void verdict_cache_clear() {
+	size_t i;
+	for (i=0;i<VERDICT_CACHE_SIZE;++i) {
+		pthread_mutex_lock(verdict_locks+(i & (VERDICT_CACHE_LOCKS-1)));
+		verdicts[i].valid=0;
+		pthread_mutex_unlock(verdict_locks+(i & (VERDICT_CACHE_LOCKS-1)));
+	}
+}
+
+void verdict_cache_stats(CacheStats *stats) {
+	stats->hits=__atomic_load_n(&verdict_hits,__ATOMIC_RELAXED);
+	stats->misses=__atomic_load_n(&verdict_misses,__ATOMIC_RELAXED);
+}
+
+/********************************************/
+/*               HEADER CACHE               */
+/********************************************/
+/**
+ * \brief Entry of the header cache
+ */
+typedef struct HeaderEntry {
+	int valid;	//!< Tells if the entry holds a header
+	dev_t dev;	//!< Device of the file
+	ino_t ino;	//!< Inode of the file
+	struct timespec mtim;	//!< Last modification time of the file
+	struct timespec ctim;	//!< Last change time of the file
+	off_t size;	//!< Size of the file
+	FileHeader header;	//!< Header of the file
+} HeaderEntry;
+
+static HeaderEntry headers[HEADER_CACHE_SIZE];	//!< Slots of the header cache
+static pthread_mutex_t header_locks[HEADER_CACHE_LOCKS];	//!< Locks protecting the slots, slot i is protected by lock i modulo HEADER_CACHE_LOCKS
+static unsigned long header_hits;	//!< Number of successful lookups
+static unsigned long header_misses;	//!< Number of failed lookups
+
+void init_header_cache() {
+	size_t i;
+	for (i=0;i<HEADER_CACHE_LOCKS;++i) pthread_mutex_init(header_locks+i,0);
+	memset(headers,0,sizeof(headers));
+	header_hits=0;
+	header_misses=0;
+}
+
+void free_header_cache() {
+	size_t i;
+	for (i=0;i<HEADER_CACHE_LOCKS;++i) pthread_mutex_destroy(header_locks+i);
+}
+
+int header_cache_lookup(const struct stat *st,FileHeader *header) {
+	size_t slot=file_slot(st,HEADER_CACHE_SIZE);
+	int found=0;
+	pthread_mutex_lock(header_locks+(slot & (HEADER_CACHE_LOCKS-1)));
+	HeaderEntry *h=headers+slot;
+	if (h->valid && same_version(h->dev,h->ino,&h->mtim,&h->ctim,h->size,st)) {
+		*header=h->header;
+		found=1;
+	}
+	pthread_mutex_unlock(header_locks+(slot & (HEADER_CACHE_LOCKS-1)));
+	__atomic_fetch_add(found?&header_hits:&header_misses,1,__ATOMIC_RELAXED);
+	return found;
+}
+
+void header_cache_store(const struct stat *st,const FileHeader *header) {
+	size_t slot=file_slot(st,HEADER_CACHE_SIZE);
+	pthread_mutex_lock(header_locks+(slot & (HEADER_CACHE_LOCKS-1)));
+	HeaderEntry *h=headers+slot;
+	h->valid=1;
+	h->dev=st->st_dev;
+	h->ino=st->st_ino;
+	h->mtim=st->st_mtim;
+	h->ctim=st->st_ctim;
+	h->size=st->st_size;
+	h->header=*header;
+	pthread_mutex_unlock(header_locks+(slot & (HEADER_CACHE_LOCKS-1)));
+}
+
+void header_cache_stats(CacheStats *stats) {
+	stats->hits=__atomic_load_n(&header_hits,__ATOMIC_RELAXED);
+	stats->misses=__atomic_load_n(&header_misses,__ATOMIC_RELAXED);
+}
+
+/********************************************/
+/*               OUTPUT CACHE               */
+/********************************************/
+/**
+ * \brief Entry of the output cache
+ *
+ * An entry holds the output of a script either in memory (output is not null) or in a file of the disk tier named after the key. The outputs of the memory tier are shared with the opened files. While its file is being written, an entry is in the hash table but in the list of no tier, and its output is still shared.
+ */
+typedef struct OutputEntry {
+	OutputKey key;	//!< Key of the entry
+	Output *output;	//!< Reference to the output if the entry is in the memory tier or being written to the disk tier, null if it is in the disk tier
+	size_t size;	//!< Size of the output
+	int writing;	//!< Tells if the file of the entry is being written, outside the lock of the cache
+	struct OutputEntry *pending;	//!< Next entry to write to the disk tier, in the list of the thread writing them
+	struct OutputEntry *prev;	//!< Previous (more recently used) entry in the list of the tier
+	struct OutputEntry *next;	//!< Next (less recently used) entry in the list of the tier
+	struct OutputEntry *chain;	//!< Next entry in the same bucket of the hash table
+} OutputEntry;
+
+/**
+ * \brief Storage tier of the output cache
+ *
+ * A tier is a list of entries sorted from the most recently used to the least recently used, with a budget in bytes.
+ */
+typedef struct OutputTier {
+	OutputEntry *head;	//!< Most recently used entry
+	OutputEntry *tail;	//!< Least recently used entry
+	size_t used;	//!< Number of bytes of outputs in the tier
+	size_t budget;	//!< Maximum number of bytes of outputs in the tier
+} OutputTier;
+
+/**
+ * \brief State of the output cache
+ */
+static struct {
+	int enabled;	//!< Tells if the cache has been initialized with a non-null budget
+	pthread_mutex_t lock;	//!< Lock protecting the whole state of the cache
+	OutputEntry *buckets[OUTPUT_CACHE_BUCKETS];	//!< Hash table of the entries
+	OutputTier memory;	//!< Memory tier
+	OutputTier disk;	//!< Disk tier
+	char *dir;	//!< Path of the folder of the disk tier
+	int own_dir;	//!< Tells if the folder was created by the cache and should be removed at the end
+	int dir_fd;	//!< Descriptor of the folder of the disk tier, -1 if there is no disk tier
+	unsigned long hits;	//!< Number of successful lookups
+	unsigned long misses;	//!< Number of failed lookups
+} outputs;
+
+/**
+ * \brief Write the name of the file of the disk tier holding an entry
+ *
+ * \param key Key of the entry
+ * \param name Buffer of at least OUTPUT_NAME_LENGTH characters receiving the name
+ */
+static void output_name(const OutputKey *key,char *name) {
+	int i;
+	for (i=0;i<HASH_DIGEST_LENGTH;++i) sprintf(name+2*i,"%02x",key->digest[i]);
+}
+
+/**
+ * \brief Remove an entry from the list of its tier
+ *
+ * \param tier Tier holding the entry
+ * \param e Entry
+ */
+static void tier_remove(OutputTier *tier,OutputEntry *e) {
+	if (e->prev) e->prev->next=e->next; else tier->head=e->next;
+	if (e->next) e->next->prev=e->prev; else tier->tail=e->prev;
+	e->prev=e->next=0;
+	tier->used-=e->size;
+}
+
+/**
+ * \brief Insert an entry at the head of the list of a tier
+ *
+ * \param tier Tier which will hold the entry
+ * \param e Entry
+ */
+static void tier_push(OutputTier *tier,OutputEntry *e) {
+	e->prev=0;
+	e->next=tier->head;
+	if (tier->head) tier->head->prev=e; else tier->tail=e;
+	tier->head=e;
+	tier->used+=e->size;
+}
+
+/**
+ * \brief Get the bucket of the hash table holding an entry
+ *
+ * \param key Key of the entry
+ * \return Pointer to the head of the chain of the bucket
+ */
+static OutputEntry **output_bucket(const OutputKey *key) {
+	uint32_t h;
+	memcpy(&h,key->digest,sizeof(h));	// The bytes of the digest are already uniformly distributed
+	return outputs.buckets+(h & (OUTPUT_CACHE_BUCKETS-1));
+}
+
+/**
+ * \brief Find an entry in the hash table
+ *
+ * \param key Key of the entry
+ * \return Pointer to the entry, null if it is not in the cache
+ */
+static OutputEntry *output_find(const OutputKey *key) {
+	OutputEntry *e=*output_bucket(key);
+	while (e!=0 && memcmp(e->key.digest,key->digest,HASH_DIGEST_LENGTH)!=0) e=e->chain;
+	return e;
+}
+
+/**
+ * \brief Remove an entry from the hash table and release it
+ *
+ * The entry should already be removed from the list of its tier. If the entry is in the disk tier, its file is deleted.
+ * \param e Entry
+ */
+static void output_discard(OutputEntry *e) {
+	OutputEntry **p=output_bucket(&e->key);
+	while (*p!=e) p=&((*p)->chain);
+	*p=e->chain;
+	if (e->output==0) {
+		char name[OUTPUT_NAME_LENGTH];
+		output_name(&e->key,name);
+		unlinkat(outputs.dir_fd,name,0);
+	}
+	output_unref(e->output);
+	free(e);
+}
+
+/**
+ * \brief Write the content of an output on a file descriptor
+ *
+ * \param fd Descriptor of the file
+ * \param output Output
+ * \return 0 if all the bytes were written, -1 otherwise
+ */
+static int write_output(int fd,Output *output) {
+	char buffer[0x4000];
+	off_t offset=0;
+	ssize_t num,done;
+	while ((num=output_read(output,buffer,sizeof(buffer),offset))>0) {
+		for (done=0;done<num;) {
+			ssize_t w=write(fd,buffer+done,num-done);
+			if (w<=0) return -1;
+			done+=w;
+		}
+		offset+=num;
+	}
+	return (num<0)?-1:0;
+}
+
+/**
+ * \brief Make room in the disk tier
+ *
+ * The least recently used entries of the disk tier are discarded until the tier can accept the given number of additional bytes.
+ * \param size Number of bytes which will be added to the tier
+ */
+static void disk_shrink(size_t size) {
+	while (outputs.disk.tail!=0 && outputs.disk.used+size>outputs.disk.budget) {
+		OutputEntry *e=outputs.disk.tail;
+		tier_remove(&outputs.disk,e);
+		output_discard(e);
+	}
+}
+
+/**
+ * \brief Write the file of the disk tier holding an output
+ *
+ * An output which has been moved to a spill file is linked in the folder of the disk tier when both are on the same file system, its anonymous file becoming the file of the entry. Otherwise its bytes are copied. This function is called without the lock of the cache.
+ * \param key Key of the entry
+ * \param output Complete output
+ * \return 0 if the file was written, -1 otherwise
+ */
+static int output_write(const OutputKey *key,Output *output) {
+	char name[OUTPUT_NAME_LENGTH];
+	output_name(key,name);
+	unlinkat(outputs.dir_fd,name,0);	// A file left by a previous entry with the same key would make linkat fail
+	if (output->fd>=0) {
+		char path[32];
+		snprintf(path,sizeof(path),"/proc/self/fd/%d",output->fd);
+		if (linkat(AT_FDCWD,path,outputs.dir_fd,name,AT_SYMLINK_FOLLOW)==0) return 0;
+	}
+	int fd=openat(outputs.dir_fd,name,O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC,S_IRUSR | S_IWUSR);
+	int code=(fd<0)?-1:write_output(fd,output);
+	if (fd>=0) close(fd);
+	if (code!=0) unlinkat(outputs.dir_fd,name,0);
+	return code;
+}
+
+/**
+ * \brief Prepare the move of an entry to the disk tier
+ *
+ * The entry should already be removed from the list of the memory tier, or not be in any tier yet. It is added to the list of the entries which the caller writes with output_flush once the lock is released, or discarded if the disk tier is not large enough. The lock should be held by the caller.
+ * \param e Entry
+ * \param pending Head of the list of the entries to write
+ */
+static void output_spill(OutputEntry *e,OutputEntry **pending) {
+	if (outputs.dir_fd<0 || e->size>outputs.disk.budget) {output_discard(e);return;}
+	e->writing=1;
+	e->pending=*pending;
+	*pending=e;
+}
+
+/**
+ * \brief Write the entries moved to the disk tier
+ *
+ * The files are written without the lock, so that the lookups of other threads do not wait for the disk. The lock is then taken again to put each entry in the disk tier, or discard it if its file could not be written. The disk tier may exceed its budget while the files are written.
+ * \param pending List of the entries to write, built by output_spill
+ */
+static void output_flush(OutputEntry *pending) {
+	while (pending!=0) {
+		OutputEntry *e=pending;
+		pending=e->pending;
+		int code=output_write(&e->key,e->output);	// The entry is not removed while it is being written, since it is in no tier list
+		pthread_mutex_lock(&outputs.lock);
+		Output *output=e->output;
+		e->writing=0;
+		if (code!=0) {
+			e->output=0;	// The reference is released below, outside the lock
+			output_discard(e);
+		} else {
+			e->output=0;
+			disk_shrink(e->size);
+			tier_push(&outputs.disk,e);
+		}
+		pthread_mutex_unlock(&outputs.lock);
+		output_unref(output);
+	}
+}
+
+int init_output_cache(size_t memory,size_t disk,const char *dir) {
+	memset(&outputs,0,sizeof(outputs));
+	outputs.dir_fd=-1;
+	if (memory==0 && disk==0) return 0;
+	pthread_mutex_init(&outputs.lock,0);
+	outputs.memory.budget=memory;
+	outputs.disk.budget=disk;
+	if (disk>0) {
+		if (dir==0) {
+			char temp_dirname[]="/tmp/sfs-cache.XXXXXX";
+			if (mkdtemp(temp_dirname)==0) return -1;
+			outputs.dir=strdup(temp_dirname);
+			outputs.own_dir=1;
+		} else {
+			if (mkdir(dir,S_IRWXU)!=0 && errno!=EEXIST) return -1;
+			outputs.dir=realpath(dir,0);
+			if (outputs.dir==0) return -1;
+		}
+		outputs.dir_fd=open(outputs.dir,O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (outputs.dir_fd<0) return -1;
+	}
+	outputs.enabled=1;
+	return 0;
+}
+
+void free_output_cache() {
+	if (!outputs.enabled) return;
+	size_t i;
+	for (i=0;i<OUTPUT_CACHE_BUCKETS;++i) while (outputs.buckets[i]!=0) output_discard(outputs.buckets[i]);
+	if (outputs.dir_fd>=0) close(outputs.dir_fd);
+	if (outputs.own_dir) rmdir(outputs.dir);
+	free(outputs.dir);
+	pthread_mutex_destroy(&outputs.lock);
+	outputs.enabled=0;
+}
+
+int output_cache_enabled() {
+	return outputs.enabled;
+}
+
+int output_cache_key(const Procedure *proc,const char *file,OutputKey *key) {
+	Hasher hasher;
+	hash_init(&hasher);
+	// Identity of the program
+	const Program *prog=proc->program;
+	if (prog->path!=0) hash_update(&hasher,prog->path,strlen(prog->path)+1); else hash_update(&hasher,"",1);
+	char **a=prog->args;
+	if (a!=0) for (;*a!=0 || a==prog->filearg;++a) {
+		if (*a!=0) hash_update(&hasher,*a,strlen(*a)+1); else hash_update(&hasher,"!",2);
+	}
+	hash_update(&hasher,"",1);
+	// Location of the script, on which its output may depend
+	hash_update(&hasher,file,strlen(file)+1);
+	// Content of the script
+	int fd=openat(persistent.mirror_fd,file,O_RDONLY | O_CLOEXEC);
+	if (fd<0) return 0;
+	char buffer[0x4000];
+	ssize_t num;
+	while ((num=read(fd,buffer,sizeof(buffer)))>0) hash_update(&hasher,buffer,num);
+	close(fd);
+	if (num<0) return 0;
+	hash_final(&hasher,key->digest);
+	return 1;
+}
+
+Output *output_cache_fetch(const OutputKey *key) {
+	if (!outputs.enabled) return 0;
+	Output *output=0;
+	pthread_mutex_lock(&outputs.lock);
+	OutputEntry *e=output_find(key);
+	if (e!=0) {
+		if (e->output!=0) {	// Memory tier, share the output
+			if (!e->writing) {
+				tier_remove(&outputs.memory,e);
+				tier_push(&outputs.memory,e);
+			}
+			output=output_ref(e->output);
+		} else {	// Disk tier, give the file itself
+			tier_remove(&outputs.disk,e);
+			tier_push(&outputs.disk,e);
+			char name[OUTPUT_NAME_LENGTH];
+			output_name(key,name);
+			int fd=openat(outputs.dir_fd,name,O_RDONLY | O_CLOEXEC);
+			if (fd>=0 && (output=output_from_fd(fd))==0) close(fd);
+		}
+	}
+	pthread_mutex_unlock(&outputs.lock);
+	__atomic_fetch_add((output!=0)?&outputs.hits:&outputs.misses,1,__ATOMIC_RELAXED);
+	return output;
+}
+
+void output_cache_store(const OutputKey *key,Output *output) {
+	if (!outputs.enabled) return;
+	size_t size=output->size;	// The output is complete and does not change any more
+	if (size>outputs.memory.budget && size>outputs.disk.budget) return;
+	OutputEntry *e=(OutputEntry*)malloc(sizeof(OutputEntry));
+	e->key=*key;
+	e->output=output_ref(output);
+	e->size=size;
+	e->writing=0;
+	e->prev=e->next=0;
+	OutputEntry *pending=0;
+	pthread_mutex_lock(&outputs.lock);
+	if (output_find(key)!=0) {	// Another thread has already stored the same output
+		pthread_mutex_unlock(&outputs.lock);
+		output_unref(output);
+		free(e);
+		return;
+	}
+	OutputEntry **bucket=output_bucket(key);
+	e->chain=*bucket;
+	*bucket=e;
+	if (size<=outputs.memory.budget && output->fd<0) {	// Outputs which have been moved to a spill file go directly to the disk tier
+		tier_push(&outputs.memory,e);
+		while (outputs.memory.used>outputs.memory.budget) {	// Move least recently used outputs to the disk tier
+			OutputEntry *old=outputs.memory.tail;
+			tier_remove(&outputs.memory,old);
+			output_spill(old,&pending);
+		}
+	} else output_spill(e,&pending);
+	pthread_mutex_unlock(&outputs.lock);
+	output_flush(pending);
+}
+void output_cache_stats(CacheStats *stats) {
+	stats->hits=__atomic_load_n(&outputs.hits,__ATOMIC_RELAXED);
+	stats->misses=__atomic_load_n(&outputs.misses,__ATOMIC_RELAXED);
+}
@@ -0,0 +1,284 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  cache.h
+ *
+ *    Description:  Caches of results computed on the files of the mirror file system
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 09:12:40
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  CACHE_INC
+#define  CACHE_INC
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "procedures.h"
+#include "output.h"
+
+#define	VERDICT_CACHE_SIZE 0x4000	//!< Number of slots in the classification verdict cache, must be a power of two
+#define	VERDICT_CACHE_LOCKS 0x40	//!< Number of locks protecting the slots of the verdict cache, must be a power of two
+#define	HEADER_CACHE_SIZE 0x1000	//!< Number of slots in the file header cache, must be a power of two
+#define	HEADER_CACHE_LOCKS 0x40	//!< Number of locks protecting the slots of the header cache, must be a power of two
+#define	HEADER_LENGTH 0x100	//!< Number of bytes read at the beginning of a file, which is also the longest shebang line accepted by the kernel
+
+/********************************************/
+/*                 COUNTERS                 */
+/********************************************/
+/**
+ * \brief Usage counters of a cache
+ *
+ * This structure holds a snapshot of the counters of one of the caches. The counters are updated atomically by the cache functions and can be read at any time.
+ */
+typedef struct CacheStats {
+	unsigned long hits;	//!< Number of lookups which found a valid entry
+	unsigned long misses;	//!< Number of lookups which did not find any valid entry
+} CacheStats;
+
+/********************************************/
+/*                 HASHING                  */
+/********************************************/
+#define	HASH_DIGEST_LENGTH 32	//!< Number of bytes of a digest
+
+/**
+ * \brief State of an incremental hash computation
+ *
+ * The hasher computes the SHA-256 digest of a stream of bytes, used to address contents in the output cache. A cryptographic digest is needed there, since two different scripts with the same digest would share their output.
+ */
+typedef struct Hasher {
+	uint32_t state[8];	//!< Intermediate digest
+	unsigned char block[64];	//!< Bytes of the current block, not processed yet
+	unsigned long long length;	//!< Number of bytes hashed so far
+} Hasher;
+
+/**
+ * \brief Start a new hash computation
+ *
+ * \param hasher Hasher which will be initialized
+ */
+void hash_init(Hasher *hasher);
+
+/**
+ * \brief Add bytes to a hash computation
+ *
+ * \param hasher Hasher holding the current state of the computation
+ * \param data Bytes which should be hashed
+ * \param size Number of bytes
+ */
+void hash_update(Hasher *hasher,const void *data,size_t size);
+
+/**
+ * \brief End a hash computation
+ *
+ * \param hasher Hasher holding the current state of the computation, which can not be used any more afterwards
+ * \param digest Buffer of HASH_DIGEST_LENGTH bytes receiving the digest
+ */
+void hash_final(Hasher *hasher,unsigned char *digest);
+
+/**
+ * \brief Hash a null-terminated string
+ *
+ * This function computes the 64-bit FNV-1a hash of a string. It is used to identify paths in the caches without keeping a copy of them.
+ * \param str String which should be hashed
+ * \return Hash value of the string
+ */
+unsigned long long hash_string(const char *str);
+
+/********************************************/
+/*              VERDICT CACHE               */
+/********************************************/
+/**
+ * \brief Initialize the classification verdict cache
+ *
+ * The verdict cache remembers, for each version of a file of the mirror file system, which procedure was found by get_script. A version of a file is identified by its device, inode, modification and change times and size, so any modification of the file or of its attributes automatically invalidates the entry. The cache has a fixed number of slots and a new entry replaces the previous entry of its slot. This function should be called once before the first use of the cache.
+ */
+void init_verdict_cache();
+
+/**
+ * \brief Release the resources used by the classification verdict cache
+ */
+void free_verdict_cache();
+
+/**
+ * \brief Look for the verdict of a file in the cache
+ *
+ * The function searches the cache for the verdict of a file. The verdict is only found if the file still has the same identity and attributes as when the verdict was stored, and if it was computed with the same list of procedures. This function is thread-safe.
+ * \param procs List of procedures used to compute the verdict
+ * \param file Path of the file relative to the mirror folder
+ * \param st Attributes of the file, as returned by a recent call to stat
+ * \param proc Pointer to a variable which will hold the matching procedure if the verdict is found, or a null pointer if the file is known not to be a script
+ * \return 1 if a verdict was found in the cache, 0 otherwise
+ */
+int verdict_cache_lookup(const Procedures *procs,const char *file,const struct stat *st,Procedure **proc);
+
+/**
+ * \brief Store the verdict of a file in the cache
+ *
+ * This function is thread-safe.
+ * \param procs List of procedures used to compute the verdict
+ * \param file Path of the file relative to the mirror folder
+ * \param st Attributes of the file at the time the verdict was computed
+ * \param proc Procedure matching the file, or a null pointer if the file is not a script
+ */
+void verdict_cache_store(const Procedures *procs,const char *file,const struct stat *st,Procedure *proc);
+
+/**
+ * \brief Remove the entries of a file from the verdict cache
+ *
+ * The function removes the entries of every version of the file, found by the hash of its path. It is called when the file is known to have changed. This function is thread-safe.
+ * \param file Path of the file relative to the mirror folder
+ */
+void verdict_cache_forget(const char *file);
+
+/**
+ * \brief Remove all entries from the verdict cache
+ */
+void verdict_cache_clear();
+
+/**
+ * \brief Read the usage counters of the verdict cache
+ *
+ * \param stats Structure filled with the counters of the cache
+ */
+void verdict_cache_stats(CacheStats *stats);
+
+/********************************************/
+/*               HEADER CACHE               */
+/********************************************/
+/**
+ * \brief Beginning of a file and what was deduced from it
+ *
+ * The header is read with a single pread and shared by the test functions which look at the nature of a file and by the preparation of the execution of a script, so that a file is only opened once to be classified and executed.
+ */
+typedef struct FileHeader {
+	size_t length;	//!< Number of bytes read at the beginning of the file
+	char data[HEADER_LENGTH];	//!< First bytes of the file
+	int shebang;	//!< Tells if the file starts with a shebang
+	char interpreter[HEADER_LENGTH];	//!< Path of the interpretor named after the shebang, empty if there is none
+	char argument[HEADER_LENGTH];	//!< Optional argument of the interpretor following its path on the shebang line, empty if there is none
+	int executable;	//!< Tells if the file has the executable attribute for the user of the file system
+} FileHeader;
+
+/**
+ * \brief Initialize the file header cache
+ *
+ * The header cache remembers the header of each version of a file, identified as in the verdict cache, so that the header is not read again when the same file is tested by several procedures, classified again after a rename or executed. This function should be called once before the first use of the cache.
+ */
+void init_header_cache();
+
+/**
+ * \brief Release the resources used by the file header cache
+ */
+void free_header_cache();
+
+/**
+ * \brief Look for the header of a file in the cache
+ *
+ * This function is thread-safe.
+ * \param st Attributes of the file, as returned by a recent call to stat
+ * \param header Structure filled with the header of the file if it is found
+ * \return 1 if the header was found in the cache, 0 otherwise
+ */
+int header_cache_lookup(const struct stat *st,FileHeader *header);
+
+/**
+ * \brief Store the header of a file in the cache
+ *
+ * This function is thread-safe.
+ * \param st Attributes of the file at the time the header was read
+ * \param header Header of the file
+ */
+void header_cache_store(const struct stat *st,const FileHeader *header);
+
+/**
+ * \brief Read the usage counters of the header cache
+ *
+ * \param stats Structure filled with the counters of the cache
+ */
+void header_cache_stats(CacheStats *stats);
+
+/********************************************/
+/*               OUTPUT CACHE               */
+/********************************************/
+/**
+ * \brief Key of an entry in the output cache
+ *
+ * The key is the SHA-256 digest of the path of the script, of its content and of the identity of the program used to execute it (path and arguments). The path is part of the key since a script may depend on its location, for example through relative paths, so two copies of the same script have separate entries.
+ */
+typedef struct OutputKey {
+	unsigned char digest[HASH_DIGEST_LENGTH];	//!< Digest
+} OutputKey;
+
+/**
+ * \brief Initialize the output cache
+ *
+ * The output cache keeps the output of the executions of scripts, so that a script which content has not changed is not executed again. The outputs are stored in memory as long as the memory budget allows it. The least recently used outputs are then moved to files in a folder, as long as the disk budget allows it, and finally discarded. If both budgets are null, the cache is disabled. This function should be called once before the first use of the cache.
+ * \param memory Maximum number of bytes of outputs kept in memory
+ * \param disk Maximum number of bytes of outputs kept on the disk
+ * \param dir Folder in which the outputs are stored on the disk, or a null pointer to create a new temporary folder. The folder is created if it does not exist
+ * \return 0 if everything went fine, -1 if the folder could not be created
+ */
+int init_output_cache(size_t memory,size_t disk,const char *dir);
+
+/**
+ * \brief Release the resources used by the output cache
+ *
+ * The function frees the memory used by the outputs and removes the files of the disk tier. The temporary folder is also removed if it was created by init_output_cache.
+ */
+void free_output_cache();
+
+/**
+ * \brief Tell if the output cache is enabled
+ *
+ * \return 1 if the output cache was initialized with a non-null budget, 0 otherwise
+ */
+int output_cache_enabled();
+
+/**
+ * \brief Compute the key of the output of a script in the cache
+ *
+ * The function reads the whole content of the script and hashes it with its path and the identity of the program of the procedure.
+ * \param proc Procedure used to execute the script
+ * \param file Path of the script relative to the mirror folder
+ * \param key Key filled by the function
+ * \return 1 if the key was computed, 0 if the script could not be read
+ */
+int output_cache_key(const Procedure *proc,const char *file,OutputKey *key);
+
+/**
+ * \brief Get the output stored in the cache for a key
+ *
+ * If the output is found in the memory tier, a new reference to the shared output is returned without any copy. If it is found in the disk tier, a new output reading the file of the tier is returned. The caller is responsible for releasing the output with output_unref. This function is thread-safe.
+ * \param key Key of the output
+ * \return Pointer to the output, null if the key is not in the cache
+ */
+Output *output_cache_fetch(const OutputKey *key);
+
+/**
+ * \brief Store an output in the cache
+ *
+ * The function stores a complete output in the cache under the key. An output kept in memory is shared with the caller by taking a new reference on it, while an output which has been moved to a spill file is copied to the disk tier. Least recently used outputs are moved to the disk tier or discarded if the budgets are exceeded. This function is thread-safe.
+ * \param key Key of the output
+ * \param output Complete output
+ */
+void output_cache_store(const OutputKey *key,Output *output);
+
+/**
+ * \brief Read the usage counters of the output cache
+ *
+ * \param stats Structure filled with the counters of the cache
+ */
+void output_cache_stats(CacheStats *stats);
+
+#endif   /* ----- #ifndef CACHE_INC  ----- */
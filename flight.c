@@ -0,0 +1,137 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  flight.c
+ *
+ *    Description:  Implementation of the sharing of one execution between concurrent openings
+ *
+ *        Version:  1.0
+ *        Created:  17/10/2026 00:31:07
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "procedures.h"
+#include "output.h"
+#include "flight.h"
+
+/**
+ * \brief Execution of a script in flight
+ *
+ * The structure does not hold a reference to the output, so that a streamed program still stops when all its readers are gone. The output is kept alive by the executing thread until it removes the execution from the table.
+ */
+struct Flight {
+	dev_t dev;	//!< Device of the script
+	ino_t ino;	//!< Inode number of the script
+	off_t size;	//!< Size of the script
+	struct timespec mtim;	//!< Time of the last modification of the script
+	struct timespec ctim;	//!< Time of the last change of the attributes of the script
+	const Procedure *proc;	//!< Procedure executing the script
+	Output *output;	//!< Output of the execution, null until it is published
+	int error;	//!< Error reported to the waiting openings if the execution ended without publishing its output
+	int ended;	//!< Tells if the execution was removed from the table
+	unsigned int waiters;	//!< Number of openings waiting for the output to be published
+	pthread_cond_t changed;	//!< Condition signaled when the output is published or the execution ends
+	struct Flight *next;	//!< Next execution in the same bucket
+};
+
+static pthread_mutex_t flight_lock=PTHREAD_MUTEX_INITIALIZER;	//!< Lock protecting the table and the executions
+static Flight *flights[FLIGHT_BUCKETS];	//!< Table of the executions in flight, indexed by the inode number of the script
+static FlightStats counters;	//!< Counters of the executions in flight
+
+/**
+ * \brief Get the bucket of a script
+ *
+ * \param ino Inode number of the script
+ * \return Pointer to the head of the bucket
+ */
+static Flight **bucket(ino_t ino) {
+	return flights+(size_t)(((unsigned long long)ino*0x9e3779b97f4a7c15ULL)>>40)%FLIGHT_BUCKETS;
+}
+
+/**
+ * \brief Release an execution
+ *
+ * \param flight Execution, already removed from the table and without waiters
+ */
+static void free_flight(Flight *flight) {
+	pthread_cond_destroy(&flight->changed);
+	free(flight);
+}
+
+Flight *flight_enter(const struct stat *st,const Procedure *proc,Output **output) {
+	*output=0;
+	Flight **head=bucket(st->st_ino);
+	pthread_mutex_lock(&flight_lock);
+	Flight *f;
+	for (f=*head;f!=0;f=f->next) if (f->proc==proc && f->ino==st->st_ino && f->dev==st->st_dev && f->size==st->st_size
+		&& f->mtim.tv_sec==st->st_mtim.tv_sec && f->mtim.tv_nsec==st->st_mtim.tv_nsec
+		&& f->ctim.tv_sec==st->st_ctim.tv_sec && f->ctim.tv_nsec==st->st_ctim.tv_nsec) break;
+	if (f!=0) {	// Join the execution in flight
+		++counters.joined;
+		if (f->output!=0) *output=output_ref(f->output);
+		else {
+			++f->waiters;
+			while (f->output==0 && !f->ended) pthread_cond_wait(&f->changed,&flight_lock);
+			--f->waiters;
+			if (f->output!=0) *output=f->output;	// The reference was taken by flight_start
+			else errno=f->error;
+			if (f->ended && f->waiters==0) free_flight(f);
+		}
+		pthread_mutex_unlock(&flight_lock);
+		return 0;
+	}
+	f=(Flight*)calloc(1,sizeof(Flight));
+	if (f==0) {pthread_mutex_unlock(&flight_lock);errno=ENOMEM;return 0;}
+	f->dev=st->st_dev;
+	f->ino=st->st_ino;
+	f->size=st->st_size;
+	f->mtim=st->st_mtim;
+	f->ctim=st->st_ctim;
+	f->proc=proc;
+	pthread_cond_init(&f->changed,0);
+	f->next=*head;
+	*head=f;
+	++counters.started;
+	pthread_mutex_unlock(&flight_lock);
+	return f;
+}
+
+void flight_start(Flight *flight,Output *output) {
+	pthread_mutex_lock(&flight_lock);
+	flight->output=output;
+	unsigned int i;
+	for (i=0;i<flight->waiters;++i) output_ref(output);	// Each waiting opening gets its own reference before the output can disappear
+	pthread_cond_broadcast(&flight->changed);
+	pthread_mutex_unlock(&flight_lock);
+}
+
+void flight_end(Flight *flight,int error) {
+	pthread_mutex_lock(&flight_lock);
+	Flight **f=bucket(flight->ino);
+	while (*f!=0 && *f!=flight) f=&(*f)->next;
+	if (*f!=0) *f=flight->next;
+	flight->ended=1;
+	if (flight->output==0) {
+		flight->error=(error!=0)?error:EIO;
+		++counters.failed;
+	}
+	pthread_cond_broadcast(&flight->changed);
+	if (flight->waiters==0) free_flight(flight);
+	pthread_mutex_unlock(&flight_lock);
+}
+
+void flight_stats(FlightStats *stats) {
+	pthread_mutex_lock(&flight_lock);
+	*stats=counters;
+	pthread_mutex_unlock(&flight_lock);
+}
@@ -0,0 +1,78 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  flight.h
+ *
+ *    Description:  Sharing of one execution between concurrent openings of the same script
+ *
+ *        Version:  1.0
+ *        Created:  17/10/2026 00:24:51
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  FLIGHT_INC
+#define  FLIGHT_INC
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "procedures.h"
+#include "output.h"
+
+#define	FLIGHT_BUCKETS 0x40	//!< Number of buckets of the table of the executions in flight
+
+typedef struct Flight Flight;	//!< Execution of a script in flight, which other openings of the same script can join
+
+/**
+ * \brief Counters of the executions in flight
+ */
+typedef struct FlightStats {
+	unsigned long started;	//!< Number of executions registered in the table
+	unsigned long joined;	//!< Number of openings which shared the output of an execution in flight instead of executing the script again
+	unsigned long failed;	//!< Number of executions which could not start, the openings which joined them failing with the same error
+} FlightStats;
+
+/**
+ * \brief Join the execution in flight of a script, or register a new one
+ *
+ * Executions are identified by the procedure and by the version of the file, made of its device, inode number, size and times of modification. If an execution of the same version by the same procedure is in flight, the function waits until its program has started and returns a new reference to its output, or returns a null pointer with errno set if the program could not start. Otherwise a new execution is registered and returned, and the caller should start it with flight_start and end it with flight_end. This function is thread-safe.
+ * \param st Attributes of the script
+ * \param proc Procedure matching the script
+ * \param output Pointer to a variable receiving the reference to the shared output if an execution was joined, null otherwise
+ * \return New execution registered for the caller, or a null pointer if an execution in flight was joined
+ */
+Flight *flight_enter(const struct stat *st,const Procedure *proc,Output **output);
+
+/**
+ * \brief Publish the output of a registered execution
+ *
+ * The openings waiting for the start of the execution receive a reference to the output. The output must stay alive until flight_end is called. This function is thread-safe.
+ * \param flight Execution returned by flight_enter
+ * \param output Output of the execution
+ */
+void flight_start(Flight *flight,Output *output);
+
+/**
+ * \brief Remove a registered execution from the table
+ *
+ * The next openings of the script start a new execution. If the output of the execution was never published, the openings waiting for it fail with the given error. This function is thread-safe, and the execution should not be used after it.
+ * \param flight Execution returned by flight_enter
+ * \param error Error reported to the waiting openings if the output was never published, EIO if null
+ */
+void flight_end(Flight *flight,int error);
+
+/**
+ * \brief Read the counters of the executions in flight
+ *
+ * \param stats Structure receiving the counters
+ */
+void flight_stats(FlightStats *stats);
+
+#endif   /* ----- #ifndef FLIGHT_INC  ----- */
@@ -0,0 +1,277 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  inode.c
+ *
+ *    Description:  Implementation of the table of the inodes of the mirror folder
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 17:41:29
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_GNU_SOURCE	//!< Needed for O_PATH and AT_EMPTY_PATH
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "inode.h"
+
+#define	INODE_BUCKETS 0x10000	//!< Number of buckets of the inode table, must be a power of two
+
+/**
+ * \brief State of the inode table
+ */
+static struct {
+	pthread_mutex_t lock;	//!< Lock protecting the table, the lookup counters and the names of the inodes
+	Inode *buckets[INODE_BUCKETS];	//!< Hash table of the inodes, indexed by their identity
+	Inode root;	//!< Inode of the mirror folder
+	unsigned long epoch;	//!< Current path epoch
+} inodes;
+
+/**
+ * \brief Compute the bucket of a file in the inode table
+ *
+ * \param dev Device of the file
+ * \param ino Inode number of the file on its device
+ * \return Pointer to the bucket
+ */
+static Inode **inode_bucket(dev_t dev,ino_t ino) {
+	unsigned long long h=(unsigned long long)ino*0x9e3779b97f4a7c15ULL;
+	h^=(unsigned long long)dev+(h>>29);
+	return inodes.buckets+((size_t)(h>>17) & (INODE_BUCKETS-1));
+}
+
+/**
+ * \brief Release an inode which is no longer used
+ *
+ * The inode is removed from the table and its parent loses a reference, which may release it too. The lock of the table must be held by the caller.
+ * \param inode Inode, which lookup counter and references are null
+ */
+static void inode_release(Inode *inode) {
+	while (inode!=&inodes.root && inode->nlookup==0 && inode->refs==0) {
+		Inode **p=inode_bucket(inode->dev,inode->ino);
+		while (*p!=inode) p=&((*p)->chain);
+		*p=inode->chain;
+		Inode *parent=inode->parent;
+		close(inode->fd);
+		free(inode->name);
+		pthread_mutex_destroy(&inode->lock);
+		free(inode);
+		if (parent==0) break;
+		--parent->refs;
+		inode=parent;
+	}
+}
+
+/**
+ * \brief Give a new name to an inode
+ *
+ * The lock of the table must be held by the caller. The previous parent is not released, even if it loses its last reference, so the caller should call inode_release on it. Since the verdict and the size of the output were computed for the previous path, the function starts a new path epoch, which also discards the verdicts being computed meanwhile.
+ * \param inode Inode
+ * \param parent New parent folder
+ * \param name New name in the parent folder
+ * \return Previous parent of the inode
+ */
+static Inode *inode_rename(Inode *inode,Inode *parent,const char *name) {
+	Inode *old=inode->parent;
+	if (old==parent && strcmp(inode->name,name)==0) return 0;
+	++parent->refs;
+	--old->refs;
+	inode->parent=parent;
+	free(inode->name);
+	inode->name=strdup(name);
+	inode_new_epoch();
+	return old;
+}
+
+int init_inodes(int mirror_fd) {
+	memset(&inodes,0,sizeof(inodes));
+	pthread_mutex_init(&inodes.lock,0);
+	Inode *root=&inodes.root;
+	root->fd=fcntl(mirror_fd,F_DUPFD_CLOEXEC,0);
+	struct stat st;
+	if (root->fd<0 || fstat(root->fd,&st)!=0) return -1;
+	root->dev=st.st_dev;
+	root->ino=st.st_ino;
+	root->nlookup=1;
+	root->output_size=-1;
+	pthread_mutex_init(&root->lock,0);
+	return 0;
+}
+
+void free_inodes() {
+	size_t i;
+	for (i=0;i<INODE_BUCKETS;++i) while (inodes.buckets[i]!=0) {
+		Inode *inode=inodes.buckets[i];
+		inodes.buckets[i]=inode->chain;
+		close(inode->fd);
+		free(inode->name);
+		pthread_mutex_destroy(&inode->lock);
+		free(inode);
+	}
+	if (inodes.root.fd>=0) close(inodes.root.fd);
+	pthread_mutex_destroy(&inodes.root.lock);
+	pthread_mutex_destroy(&inodes.lock);
+}
+
+Inode *inode_root() {
+	return &inodes.root;
+}
+
+Inode *inode_lookup(Inode *parent,const char *name,struct stat *st) {
+	int fd=openat(parent->fd,name,O_PATH | O_NOFOLLOW | O_CLOEXEC);
+	if (fd<0) return 0;
+	if (fstatat(fd,"",st,AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW)!=0) {
+		int error=errno;
+		close(fd);
+		errno=error;
+		return 0;
+	}
+	pthread_mutex_lock(&inodes.lock);
+	Inode **bucket=inode_bucket(st->st_dev,st->st_ino);
+	Inode *inode=*bucket;
+	while (inode!=0 && (inode->ino!=st->st_ino || inode->dev!=st->st_dev)) inode=inode->chain;
+	if (inode==&inodes.root) inode=0;	// The mirror folder found inside itself through a bind mount is a different inode for the kernel
+	if (inode!=0) {	// The file is already known, possibly under another name
+		close(fd);
+		++inode->nlookup;
+		Inode *old=inode_rename(inode,parent,name);
+		if (old!=0) inode_release(old);
+	} else {
+		inode=(Inode*)calloc(1,sizeof(Inode));
+		inode->fd=fd;
+		inode->dev=st->st_dev;
+		inode->ino=st->st_ino;
+		inode->nlookup=1;
+		inode->parent=parent;
+		inode->name=strdup(name);
+		inode->output_size=-1;
+		pthread_mutex_init(&inode->lock,0);
+		++parent->refs;
+		inode->chain=*bucket;
+		*bucket=inode;
+	}
+	pthread_mutex_unlock(&inodes.lock);
+	return inode;
+}
+
+void inode_forget(Inode *inode,unsigned long nlookup) {
+	if (inode==&inodes.root) return;
+	pthread_mutex_lock(&inodes.lock);
+	inode->nlookup=(nlookup<inode->nlookup)?inode->nlookup-nlookup:0;
+	inode_release(inode);
+	pthread_mutex_unlock(&inodes.lock);
+}
+
+Inode *inode_find(dev_t dev,ino_t ino) {
+	if (dev==inodes.root.dev && ino==inodes.root.ino) return &inodes.root;
+	pthread_mutex_lock(&inodes.lock);
+	Inode *inode=*inode_bucket(dev,ino);
+	while (inode!=0 && (inode->ino!=ino || inode->dev!=dev)) inode=inode->chain;
+	pthread_mutex_unlock(&inodes.lock);
+	return inode;
+}
+
+char *inode_path(Inode *inode,const char *name) {
+	pthread_mutex_lock(&inodes.lock);
+	size_t length=(name!=0)?strlen(name)+1:0;
+	Inode *i;
+	for (i=inode;i->parent!=0;i=i->parent) length+=strlen(i->name)+1;
+	if (length==0) {	// Path of the mirror folder itself
+		pthread_mutex_unlock(&inodes.lock);
+		return strdup(".");
+	}
+	char *path=(char*)malloc(length);
+	char *p=path+length-1;
+	*p=0;
+	if (name!=0) {
+		p-=strlen(name);
+		memcpy(p,name,strlen(name));
+		if (inode->parent!=0) *(--p)='/';
+	}
+	for (i=inode;i->parent!=0;i=i->parent) {
+		size_t len=strlen(i->name);
+		p-=len;
+		memcpy(p,i->name,len);
+		if (i->parent->parent!=0) *(--p)='/';
+	}
+	pthread_mutex_unlock(&inodes.lock);
+	return path;
+}
+
+void inode_moved(Inode *newparent,const char *newname) {
+	inode_new_epoch();
+	struct stat st;
+	if (fstatat(newparent->fd,newname,&st,AT_SYMLINK_NOFOLLOW)!=0) return;
+	pthread_mutex_lock(&inodes.lock);
+	Inode *inode=*inode_bucket(st.st_dev,st.st_ino);
+	while (inode!=0 && (inode->ino!=st.st_ino || inode->dev!=st.st_dev)) inode=inode->chain;
+	if (inode!=0) {
+		Inode *old=inode_rename(inode,newparent,newname);
+		if (old!=0) inode_release(old);
+	}
+	pthread_mutex_unlock(&inodes.lock);
+}
+
+void inode_new_epoch() {
+	__atomic_fetch_add(&inodes.epoch,1,__ATOMIC_RELEASE);
+}
+
+unsigned long inode_epoch() {
+	return __atomic_load_n(&inodes.epoch,__ATOMIC_ACQUIRE);
+}
+
+/**
+ * \brief Tell if the verdict attached to an inode is still valid
+ *
+ * The lock of the inode must be held by the caller.
+ * \param inode Inode
+ * \param st Current attributes of the file
+ * \return 1 if the verdict is valid, 0 otherwise
+ */
+static int verdict_valid(const Inode *inode,const struct stat *st) {
+	return inode->classified && inode->epoch==inode_epoch() && inode->size==st->st_size
+		&& inode->mtim.tv_sec==st->st_mtim.tv_sec && inode->mtim.tv_nsec==st->st_mtim.tv_nsec
+		&& inode->ctim.tv_sec==st->st_ctim.tv_sec && inode->ctim.tv_nsec==st->st_ctim.tv_nsec;
+}
+
+int inode_verdict(Inode *inode,const struct stat *st,Procedure **proc,off_t *output_size) {
+	pthread_mutex_lock(&inode->lock);
+	int valid=verdict_valid(inode,st);
+	if (valid) {
+		*proc=inode->proc;
+		if (output_size!=0) *output_size=inode->output_size;
+	}
+	pthread_mutex_unlock(&inode->lock);
+	return valid;
+}
+
+void inode_set_verdict(Inode *inode,const struct stat *st,Procedure *proc,unsigned long epoch) {
+	pthread_mutex_lock(&inode->lock);
+	inode->classified=1;
+	inode->epoch=epoch;
+	inode->mtim=st->st_mtim;
+	inode->ctim=st->st_ctim;
+	inode->size=st->st_size;
+	inode->proc=proc;
+	inode->output_size=-1;
+	pthread_mutex_unlock(&inode->lock);
+}
+
+void inode_set_output_size(Inode *inode,const struct stat *st,off_t size) {
+	pthread_mutex_lock(&inode->lock);
+	if (verdict_valid(inode,st)) inode->output_size=size;
+	pthread_mutex_unlock(&inode->lock);
+}
@@ -0,0 +1,172 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  inode.h
+ *
+ *    Description:  Table of the inodes of the mirror folder known by the kernel
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 17:36:12
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  INODE_INC
+#define  INODE_INC
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "procedures.h"
+
+/**
+ * \brief File of the mirror folder known by the kernel
+ *
+ * Each file returned to the kernel by a lookup gets an inode, which holds an O_PATH descriptor of the file. The operations on the file use this descriptor instead of a path, so that the path is never resolved again. The inode also remembers under which name the file was found, so that its path relative to the mirror folder can be rebuilt when it is needed by the execution of a script, and the procedure matching the file.
+ *
+ * A file with several hard links has a single inode, named after the link under which it was found last. Since the procedure matching a script and its output may depend on its path, the verdict attached to the inode is discarded each time it takes another name.
+ */
+typedef struct Inode {
+	int fd;	//!< O_PATH descriptor of the file
+	dev_t dev;	//!< Device of the file
+	ino_t ino;	//!< Inode number of the file on its device
+	unsigned long nlookup;	//!< Number of lookups of the inode not yet forgotten by the kernel
+	unsigned long refs;	//!< Number of inodes of the table which have this one as their parent
+	struct Inode *parent;	//!< Folder in which the file was found, null for the mirror folder itself
+	char *name;	//!< Name of the file in its parent folder, null for the mirror folder itself
+	struct Inode *chain;	//!< Next inode in the same bucket of the table
+	pthread_mutex_t lock;	//!< Lock protecting the verdict attached to the inode
+	int classified;	//!< Tells if the verdict attached to the inode is valid
+	unsigned long epoch;	//!< Value of the path epoch when the verdict was computed
+	struct timespec mtim;	//!< Last modification time of the file when the verdict was computed
+	struct timespec ctim;	//!< Last change time of the file when the verdict was computed
+	off_t size;	//!< Size of the file when the verdict was computed
+	Procedure *proc;	//!< Procedure matching the file, null if the file is not a script
+	off_t output_size;	//!< Size of the output of the script, -1 if it is not known
+} Inode;
+
+/**
+ * \brief Initialize the inode table
+ *
+ * The table starts with the inode of the mirror folder, which is never released. This function should be called once the mirror folder is opened.
+ * \param mirror_fd Descriptor of the mirror folder
+ * \return 0 if everything went fine, -1 otherwise
+ */
+int init_inodes(int mirror_fd);
+
+/**
+ * \brief Release all the inodes of the table
+ */
+void free_inodes();
+
+/**
+ * \brief Get the inode of the mirror folder
+ *
+ * \return Pointer to the root inode
+ */
+Inode *inode_root();
+
+/**
+ * \brief Find a file in a folder and count a new lookup of its inode
+ *
+ * The name is resolved in the folder with a single openat call, without following symbolic links. If the file already has an inode, its lookup counter is incremented and its name is updated, which starts a new path epoch if the file was found under another name, for example through another hard link. Otherwise a new inode is created. This function is thread-safe.
+ * \param parent Inode of the folder
+ * \param name Name of the file in the folder
+ * \param st Structure filled with the attributes of the file
+ * \return Pointer to the inode, or a null pointer if the file can not be found, errno being set
+ */
+Inode *inode_lookup(Inode *parent,const char *name,struct stat *st);
+
+/**
+ * \brief Forget lookups of an inode
+ *
+ * The inode is released when the kernel has forgotten all its lookups and no other inode has it as parent. This function is thread-safe.
+ * \param inode Inode
+ * \param nlookup Number of lookups forgotten by the kernel
+ */
+void inode_forget(Inode *inode,unsigned long nlookup);
+
+/**
+ * \brief Find the inode of a file by its identity
+ *
+ * The returned pointer can be released at any time by another thread, so it should only be used to identify the inode when talking to the kernel. This function is thread-safe.
+ * \param dev Device of the file
+ * \param ino Inode number of the file on its device
+ * \return Pointer to the inode, or a null pointer if the file is not in the table
+ */
+Inode *inode_find(dev_t dev,ino_t ino);
+
+/**
+ * \brief Build the path of a file relative to the mirror folder
+ *
+ * The path is rebuilt from the names under which the inode and its parents were found. This function is thread-safe.
+ * \param inode Inode of the file, or of its folder if a name is given
+ * \param name Name of the file in the folder designated by inode, or a null pointer if the path of inode itself is requested
+ * \return Newly-allocated path, which the caller should release
+ */
+char *inode_path(Inode *inode,const char *name);
+
+/**
+ * \brief Update the table after a file has been renamed
+ *
+ * The inode of the renamed file, if it is in the table, takes its new name. Since the paths of all the files of a renamed folder change, the function also starts a new path epoch. This function is thread-safe.
+ * \param newparent Inode of the destination folder
+ * \param newname New name of the file
+ */
+void inode_moved(Inode *newparent,const char *newname);
+
+/**
+ * \brief Start a new path epoch
+ *
+ * The verdicts attached to the inodes depend on the path of the files, since some tests match the path against a pattern. A new epoch invalidates all of them, and is started each time a folder may have been renamed.
+ */
+void inode_new_epoch();
+
+/**
+ * \brief Get the verdict attached to an inode
+ *
+ * The verdict is only valid if the file has not changed since it was computed and no path epoch has started since. This function is thread-safe.
+ * \param inode Inode
+ * \param st Current attributes of the file
+ * \param proc Pointer to a variable which will hold the procedure matching the file
+ * \param output_size Pointer to a variable which will hold the size of the output of the script, -1 if it is not known, or a null pointer
+ * \return 1 if the verdict is valid, 0 otherwise
+ */
+int inode_verdict(Inode *inode,const struct stat *st,Procedure **proc,off_t *output_size);
+
+/**
+ * \brief Attach a verdict to an inode
+ *
+ * This function is thread-safe.
+ * \param inode Inode
+ * \param st Attributes of the file when the verdict was computed
+ * \param proc Procedure matching the file, null if the file is not a script
+ * \param epoch Value of the path epoch before the verdict was computed, as returned by inode_epoch
+ */
+void inode_set_verdict(Inode *inode,const struct stat *st,Procedure *proc,unsigned long epoch);
+
+/**
+ * \brief Get the current path epoch
+ *
+ * \return Value of the epoch
+ */
+unsigned long inode_epoch();
+
+/**
+ * \brief Remember the size of the output of the script of an inode
+ *
+ * The size is only stored if the verdict attached to the inode is still valid for the given attributes. This function is thread-safe.
+ * \param inode Inode
+ * \param st Attributes of the file when the output was produced
+ * \param size Size of the output
+ */
+void inode_set_output_size(Inode *inode,const struct stat *st,off_t size);
+
+#endif   /* ----- #ifndef INODE_INC  ----- */
@@ -16,56 +16,146 @@
  * =====================================================================================
  */
 
+#define	_GNU_SOURCE	//!< Needed for pipe2 and splice
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include "procedures.h"
 #include "operations.h"
+#include "cache.h"
+#include "spawner.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+#include "admission.h"
+#include "flight.h"
+#include "watchdog.h"
 
 /********************************************/
 /*         DATA TYPES AND FUNCTIONS         */
 /********************************************/
+struct Persistent persistent;
+
 void init_resources() {
 	persistent.mirror=0;
 	persistent.mirror_len=0;
 	persistent.procs=0;
+	persistent.cache_memory=0;
+	persistent.cache_disk=0;
+	persistent.cache_dir=0;
+	persistent.spawner=SPAWN_POSIX;
+	persistent.spill_threshold=0;
+	persistent.spill_dir=0;
+	persistent.stream=0;
+	persistent.page_cache=0;
+	persistent.watch=0;
+	persistent.readdir_plus=0;
+	persistent.max_executions=0;
+	persistent.max_queue=ADMISSION_QUEUE;
+	persistent.prefetch=0;
+	persistent.test_servers=1;
+	persistent.test_timeout=SERVER_TIMEOUT;
+	persistent.workers=1;
+	persistent.worker_requests=0;
+	persistent.trace=0;
+	persistent.trace_events=TRACE_EVENTS;
+	init_verdict_cache();
+	init_header_cache();
+	init_stats();
 }
 
 void free_resources() {
 	free(persistent.mirror);
 	free_procedures(persistent.procs);
+	free(persistent.cache_dir);
+	free(persistent.spill_dir);
+	free_verdict_cache();
+	free_header_cache();
+	free_output_cache();
 }
 
 /********************************************/
 /*             COMMON FUNCTIONS             */
 /********************************************/
 /**
- * \brief Make a temporary copy of a file
+ * \brief Build the array of arguments of a call to an external program
  *
- * The function tries to copy the file in argument in a temporary folder, on a random name. The file name is relative to the folder which descriptor is in the global variable persistent.mirror_fd. If it succeeds, it returns a newly-allocated string with the name of the temporary file. Otherwise, it returns 0.
- * \param file Source file which should be copied
- * \return New string with the name of the temporary file. The user is responsible for releasing the memory allocated for this string.
+ * The function copies the array of arguments of a Program or Test structure into a new array, and puts the name of the file at the position of the exclamation mark. The structure itself is never modified, so that several threads can call the same program at the same time on different files. The strings are not copied.
+ * \param args Array of arguments of the structure, null if the structure holds no external program
+ * \param filearg Position of the exclamation mark in the array, null if there is no exclamation mark
+ * \param file Name of the file replacing the exclamation mark
+ * \return Newly-allocated array of arguments ending with a null pointer, or a null pointer if args is null. The user is responsible for releasing the array but not its elements.
  */
-char *temp_copy(const char *file) {
-	char *res=0;
-	int fin=openat(persistent.mirror_fd,file,O_RDONLY);
-	if (fin==-1) return 0;
-	res=tempnam("/tmp","sfs.");
-	int fout=open(res,O_CREAT | O_WRONLY | O_TRUNC | O_EXCL,S_IRUSR | S_IXUSR);
-	if (fout==-1) {close(fin);return 0;}
-	ssize_t num;
-	char buf[0x1000];
-	while ((num=read(fin,&buf,0x1000*sizeof(char)))>0) write(fout,&buf,num);
-	close(fin);
-	close(fout);
+const char **build_args(char **args,char **filearg,const char *file) {
+	if (args==0) return 0;
+	size_t num=0;
+	while (args[num]!=0 || args+num==filearg) ++num;
+	const char **res=(const char**)malloc((num+1)*sizeof(char*));
+	size_t i;
+	for (i=0;i<num;++i) res[i]=(args+i==filearg)?file:args[i];
+	res[num]=0;
 	return res;
 }
 
+/**
+ * \brief Find the interpretor named on the shebang line of a header
+ *
+ * Like the kernel, the function splits the first line of the file into the path of the interpretor and one optional argument holding the rest of the line.
+ * \param header Header which first bytes have been read, the other fields being filled by the function
+ */
+static void parse_shebang(FileHeader *header) {
+	const char *line=header->data;
+	header->shebang=(header->length>=2 && line[0]=='#' && line[1]=='!');
+	header->interpreter[0]=0;
+	header->argument[0]=0;
+	if (!header->shebang) return;
+	const char *end=(const char*)memchr(line,'\n',header->length);
+	size_t n=(end!=0)?(size_t)(end-line):header->length;
+	size_t k=2;
+	while (k<n && (line[k]==' ' || line[k]=='\t')) ++k;
+	size_t l=k;
+	while (l<n && (line[l-1]=='\\' || (line[l]!=' ' && line[l]!='\t'))) ++l;
+	memcpy(header->interpreter,line+k,l-k);
+	header->interpreter[l-k]=0;
+	while (l<n && (line[l]==' ' || line[l]=='\t')) ++l;
+	while (n>l && (line[n-1]==' ' || line[n-1]=='\t' || line[n-1]=='\r')) --n;
+	memcpy(header->argument,line+l,n-l);
+	header->argument[n-l]=0;
+}
+
+/**
+ * \brief Get the header of a file
+ *
+ * The header is taken from the header cache if the file has not changed since it was last read. Otherwise the first bytes of the file are read with a single pread, and the shebang line and executable attribute are stored with them in the cache.
+ * \param file Path of the file relative to the mirror folder
+ * \param fd Descriptor of the file opened for reading, or -1 if the function should open the file itself
+ * \param header Structure filled with the header of the file
+ * \return 0 if the header was found, -1 if the file does not exist
+ */
+static int read_header(const char *file,int fd,FileHeader *header) {
+	struct stat st;
+	int own=(fd<0);
+	if ((own?fstatat(persistent.mirror_fd,file,&st,0):fstat(fd,&st))!=0) return -1;
+	if (header_cache_lookup(&st,header)) return 0;
+	if (own) fd=openat(persistent.mirror_fd,file,O_RDONLY | O_CLOEXEC);
+	ssize_t n=(fd>=0)?pread(fd,header->data,HEADER_LENGTH,0):-1;
+	if (own && fd>=0) close(fd);
+	header->length=(n>0)?n:0;
+	parse_shebang(header);
+	header->executable=(faccessat(persistent.mirror_fd,file,X_OK,0)==0);
+	if (n>=0) header_cache_store(&st,header);	// A file which can not be read is looked at again next time
+	return 0;
+}
+
 /********************************************/
 /*              TEST FUNCTIONS              */
 /********************************************/
@@ -73,14 +163,8 @@ int test_true(PTest test,const char *file) {return 1;}
 int test_false(PTest test,const char *file) {return 0;}
 
 int test_shell(PTest test,const char *file) {
-	int fd=openat(persistent.mirror_fd,file,O_RDONLY);
-	FILE *f=fdopen(fd,"r");
-	if (f==0) return 0;
-	char magic[2];
-	size_t s=fread(magic,1,2,f);
-	close(fd);
-	if (s<2 || magic[0]!='#' || magic[1]!='!') return 0;
-	return 1;
+	FileHeader header;
+	return read_header(file,-1,&header)==0 && header.shebang;
 }
 
 int test_executable(PTest test,const char *file) {
@@ -88,7 +172,8 @@ int test_executable(PTest test,const char *file) {
 }
 
 int test_shell_executable(PTest test,const char *file) {
-	return test_shell(test,file) || test_executable(test,file);
+	FileHeader header;
+	return read_header(file,-1,&header)==0 && (header.shebang || header.executable);
 }
 
 int test_pattern(PTest test,const char *file) {
@@ -97,140 +182,334 @@ int test_pattern(PTest test,const char *file) {
 }
 
 int test_program(PTest test,const char *file) {
-	// Create the array of arguments of the program by replacing the exclamation mark with the name of the file
-	if (test->args!=0 && test->filearg!=0) *(test->filearg)=(char*)file;
+	// Create the array of arguments of the program by replacing the exclamation mark with a path to the file
+	const char **args=build_args(test->args,test->filearg,SPAWN_SCRIPT_PATH);
 	// If the program is a filter that requires standard input, add the name of the file in the arguments of the call to execute_program
 	const char *f=(test->filter)?file:0;
 	// Launch the program
-	int code=execute_program(test->path,(const char**)(test->args),0,f);
+	int code=execute_program(test->path,args,0,f,(test->filearg!=0)?file:0,0);
+	free(args);
 	return (code==0);
 }
 
+int test_server(PTest test,const char *file) {
+	if (test->servers==0) return 0;
+	return server_query(test->servers,file,persistent.test_timeout);
+}
+
 /********************************************/
 /*           EXECUTION FUNCTIONS            */
 /********************************************/
-int program_shell(PProgram program,const char *file,int fd) {
-	char *tmpfil=temp_copy(file);
-	if (tmpfil==0) return -errno;
-	const char *args[]={tmpfil,0};
-	int code=execute_program(tmpfil,args,fd,0);
-	unlink(tmpfil);
-	free(tmpfil);
-	return code;
+int program_shell(PProgram program,const char *file,Output *out) {
+	// The interpretor reads the script through a descriptor opened on the mirror folder, since the path of the file may be hidden by the virtual file system if it is mounted over the mirror folder
+	const char *args[]={SPAWN_SCRIPT_PATH,0};
+	return execute_program(file,args,out,0,file,program->timeout);
 }
 
-int program_external(PProgram program,const char *file,int fd) {
-	// Create the array of arguments of the program by replacing the exclamation mark with the name of a file with the same content
-	// The actual file is not used because it may not be accessible for external programs since the host folder can be mounted over with the new file system. To prevent that case, the script file is copied in the temporary folder and this new file name is given as the argument of the external program at the location of the exclamation mark. The temporary file is deleted after the end of the procedure.
-	if (program->args!=0 && program->filearg!=0) *(program->filearg)=temp_copy(file);
+int program_server(PProgram program,const char *file,Output *out) {
+	if (program->servers==0) return 1;
+	return server_run(program->servers,file,out,program->timeout);
+}
+
+int program_external(PProgram program,const char *file,Output *out) {
+	// Create the array of arguments of the program by replacing the exclamation mark with a path to the file
+	// The actual path is not used because it may not be accessible for external programs since the host folder can be mounted over with the new file system. To prevent that case, the file is opened relatively to the mirror folder and given to the program as an open descriptor, which path is given as the argument of the external program at the location of the exclamation mark.
+	int filearg=(program->args!=0 && program->filearg!=0);
+	const char **args=build_args(program->args,program->filearg,SPAWN_SCRIPT_PATH);
 	// If the program is a filter that requires standard input, add the name of the file in the arguments of the call to execute_program
-	const char *f=(program->filter && program->filearg==0)?file:0;
+	const char *f=(program->filter && !filearg)?file:0;
 	// Launch the program
-	int code=execute_program(program->path,(const char**)(program->args),fd,f);
-	// Release memory, restore structure in previous state and exit
-	if (program->args!=0 && program->filearg!=0) {
-		if (*(program->filearg)!=0) {
-			unlink(*(program->filearg));
-			free(*(program->filearg));
-		}
-		*(program->filearg)=0;
-	}
+	int code=execute_program(program->path,args,out,f,filearg?file:0,program->timeout);
+	free(args);
+	return code;
+}
+
+int execute_procedure(Procedure *proc,const char *file,Output *out) {
+	unsigned long long start=stats_clock();
+	int code=proc->program->func(proc->program,file,out);
+	stats_execution(code,start);
+	if (code==EXECUTION_TIMEOUT && proc->partial) code=1;	// The output is kept, but not cached
+	__atomic_fetch_add(&proc->executions,1,__ATOMIC_RELAXED);
 	return code;
 }
 
+/**
+ * \brief Parameters of a thread streaming the output of a program
+ */
+typedef struct Stream {
+	Procedure *proc;	//!< Procedure which program is executed
+	char *file;	//!< Path of the script relative to the mirror folder
+	Output *out;	//!< Reference to the output held by the thread
+	OutputKey key;	//!< Key of the output in the output cache
+	int cached;	//!< Tells if the output should be stored in the output cache
+	Flight *flight;	//!< Execution in flight ended when the program ends, null if there is none
+} Stream;
+
+/**
+ * \brief Execute a program and release the parameters of the stream
+ *
+ * This function is the body of the threads started by stream_program.
+ * \param arg Pointer to a Stream structure, released by the function
+ * \return Null pointer
+ */
+static void *stream_thread(void *arg) {
+	Stream *stream=(Stream*)arg;
+	int code=execute_procedure(stream->proc,stream->file,stream->out);
+	admission_leave(stream->proc);
+	output_finish(stream->out,code);
+	if (stream->cached && code==0) output_cache_store(&stream->key,stream->out);
+	if (stream->flight!=0) flight_end(stream->flight,0);	// Ended while the thread still holds the output, which the execution in flight does not hold
+	output_unref(stream->out);
+	free(stream->file);
+	free(stream);
+	return 0;
+}
+
+int stream_program(Procedure *proc,const char *file,Output *out,const OutputKey *key,Flight *flight) {
+	Stream *stream=(Stream*)malloc(sizeof(Stream));
+	stream->proc=proc;
+	stream->flight=flight;
+	stream->file=strdup(file);
+	stream->out=output_ref(out);
+	stream->cached=(key!=0);
+	if (key!=0) stream->key=*key;
+	out->stream=1;
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+	int code=pthread_create(&thread,&attr,stream_thread,stream);
+	pthread_attr_destroy(&attr);
+	if (code==0) return 0;
+	out->stream=0;
+	output_unref(out);
+	free(stream->file);
+	free(stream);
+	return -1;
+}
+
 /********************************************/
 /*             OTHER OPERATIONS             */
 /********************************************/
-Procedure* get_script(const Procedures *procs,const char *file) {
+/**
+ * \brief Run the test functions of the procedures on a file
+ *
+ * This function goes through all the procedures in the list given as argument and returns the first one which test function succeeds on the file. Consecutive pattern tests are run together by their combined matcher. It does not use the verdict cache. A test which fails to examine the file does not match it.
+ * \param procs List of procedures that will be tested against the file
+ * \param file Path of the actual file
+ * \param failed Pointer to a variable set to 1 if a test returned TEST_FAILED before the matching procedure was found, and left unchanged otherwise
+ * \return Pointer to a procedure which test function succeeds when applied to the file, null if no procedure is found
+ */
+Procedure* run_tests(const Procedures *procs,const char *file,int *failed) {
 	Procedure *res=0;
 	while (res==0 && procs!=0) {
-		if (procs->procedure->test!=0 && procs->procedure->test->func!=0 && procs->procedure->test->func(procs->procedure->test,file)!=0) res=procs->procedure;
+		if (procs->patterns!=0) {	// Consecutive pattern tests are run in one pass over the path
+			int k=match_patterns(procs->patterns,file);
+			size_t i,count=procs->patterns->count;
+			for (i=0;i<count && (k<0 || i<=(size_t)k);++i) __atomic_fetch_add(&procs->patterns->procs[i]->tests,1,__ATOMIC_RELAXED);	// The procedures before the match count as tested
+			if (k>=0) {
+				res=procs->patterns->procs[k];
+				__atomic_fetch_add(&res->matches,1,__ATOMIC_RELAXED);
+			}
+			for (i=0;i<count;++i) procs=procs->next;
+			continue;
+		}
+		Procedure *proc=procs->procedure;
+		if (proc->test!=0 && proc->test->func!=0) {
+			__atomic_fetch_add(&proc->tests,1,__ATOMIC_RELAXED);
+			int match=proc->test->func(proc->test,file);
+			if (match==TEST_FAILED) *failed=1;
+			else if (match!=0) {
+				res=proc;
+				__atomic_fetch_add(&proc->matches,1,__ATOMIC_RELAXED);
+			}
+		}
 		procs=procs->next;
 	}
 	return res;
 }
 
-void call_program(const char *file,const char **args) {
+Procedure* get_script(const Procedures *procs,const char *file) {
+	struct stat st;
+	int failed=0;
+	if (fstatat(persistent.mirror_fd,file,&st,0)!=0) return run_tests(procs,file,&failed);	// Without attributes, the verdict can not be cached
+	return get_script_stat(procs,file,&st,0);
+}
+
+Procedure* get_script_stat(const Procedures *procs,const char *file,const struct stat *st,int *failed) {
+	Procedure *res;
+	int f=0;
+	if (verdict_cache_lookup(procs,file,st,&res)) return res;
+	res=run_tests(procs,file,&f);
+	if (!f) verdict_cache_store(procs,file,st,res);	// The verdict is examined again next time if a test could not run
+	if (failed!=0) *failed=f;
+	return res;
+}
+
+int prepare_program(const char *file,const char **args,Launch *launch) {
+	launch->fd=-1;
+	launch->args=0;
+	launch->interpreter=0;
+	launch->argument=0;
 	// Check the nature of file
-	int fd=openat(persistent.mirror_fd,file,O_RDONLY);
-	FILE *f=fdopen(fd,"r");
-	if (f==0) return;
-	char *line=0;
-	size_t nn;
-	ssize_t n=getline(&line,&nn,f);
-	close(fd);
-	if (n>=2 && line[0]=='#' && line[1]=='!') {	// file is a shell script
-		// Read the path to the script interpretor
-		size_t i=2;
-		while (i<n && (line[i]==' ' || line[i]=='\t')) ++i;
-		if (i>=n || line[i]=='\n') return;
-		size_t j=i;
-		while (j<n && (line[j-1]=='\\' || (line[j]!=' ' && line[j]!='\t' && line[j]!='\n'))) ++j;
-		char path[j-i+1];
-		strncpy(path,line+i,j-i);
-		path[j-i]=0;
-		free(line);
+	int fd=openat(persistent.mirror_fd,file,O_RDONLY | O_CLOEXEC);
+	if (fd<0) return -1;
+	FileHeader header;
+	if (read_header(file,fd,&header)!=0) {close(fd);return -1;}
+	size_t i=0;
+	const char **ar=args;
+	while (*(ar++)!=0) ++i;
+	if (header.shebang) {	// file is a shell script
+		close(fd);
+		if (header.interpreter[0]==0) return -1;
+		launch->interpreter=strdup(header.interpreter);
+		if (header.argument[0]!=0) launch->argument=strdup(header.argument);
 		// Prepare array of arguments
-		i=0;
-		const char **ar=args;
-		while (*(ar++)!=0) ++i;
-		const char *newargs[i+2];
-		newargs[0]=path;
-		j=1;
-		while (j<i+2) {newargs[j]=args[j-1];++j;}
-		// Launch program
-		int fde=openat(persistent.mirror_fd,path,O_RDONLY);
-		fexecve(fde,(char* const*)newargs,persistent.envp);
+		size_t first=(launch->argument!=0)?2:1;
+		launch->args=(const char**)malloc((i+first+1)*sizeof(char*));
+		launch->args[0]=launch->interpreter;
+		if (launch->argument!=0) launch->args[1]=launch->argument;
+		memcpy(launch->args+first,args,(i+1)*sizeof(char*));
+		// Open the interpretor
+		launch->fd=openat(persistent.mirror_fd,launch->interpreter,O_RDONLY | O_CLOEXEC);
+		if (launch->fd<0) {release_program(launch);return -1;}
 	} else {
-		int fde=openat(persistent.mirror_fd,file,O_RDONLY);
-		fexecve(fde,(char *const*)args,persistent.envp);
+		launch->fd=fd;
+		launch->args=(const char**)malloc((i+1)*sizeof(char*));
+		memcpy(launch->args,args,(i+1)*sizeof(char*));
 	}
+	return 0;
 }
 
-int execute_program(const char *file,const char **args,int out,const char* path_in) {
-	pid_t child;	// ID of child process executing external program
-	int fds[2];	// Handles of the two ends of the pipe, only used if input has to be provided to the standard input of the external program
-	int in;
-	if (path_in!=0) pipe(fds);	// Prepare a pipe to feed standard input of the external program, fork and copy the file to the pipe
-	child=fork();
-	if (child!=0) {	// Parent process (caller)
-		if (path_in!=0) {	// If a path is provided, feed the content of the file to the pipe so that it is used as the standard input of the child process
-			close(fds[0]);	// Close input descriptor
-			in=openat(persistent.mirror_fd,path_in,O_RDONLY);
-			if (in<0) path_in=0; else {	// Copy file to standard input
-				char buffer[0x1000];
-				ssize_t num,numw,num2;
-				do {
-					num=read(in,buffer,0x1000);
-					numw=0;
-					while (numw<num) {
-						num2=write(fds[1],buffer+numw,num-numw);
-						if (num2<0) numw=num; else numw+=num2;
-					}
-				} while (num>0);
+void release_program(Launch *launch) {
+	if (launch->fd>=0) close(launch->fd);
+	free(launch->args);
+	free(launch->interpreter);
+	free(launch->argument);
+	launch->fd=-1;
+	launch->args=0;
+	launch->interpreter=0;
+	launch->argument=0;
+}
+
+/**
+ * \brief Feed the content of a file to a pipe
+ *
+ * This function is the body of the thread which copies a file to the standard input of an external program when the file can not be given directly as the standard input. The data is moved by splice, without being copied in the memory of the process, or by read and write if splice is not supported by the file. The thread closes both descriptors when the copy is over or the program stops reading.
+ * \param arg Pointer to an array of two descriptors: the file and the writing end of the pipe. The array is released by the function
+ * \return Always null
+ */
+void *feed_pipe(void *arg) {
+	int *fds=(int*)arg;
+	sigset_t mask;	// SIGPIPE is blocked in the thread, so that a program which stops reading only makes the copy fail
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGPIPE);
+	pthread_sigmask(SIG_BLOCK,&mask,0);
+	ssize_t num;
+	do num=splice(fds[0],0,fds[1],0,0x10000,SPLICE_F_MOVE | SPLICE_F_MORE); while (num>0 || (num<0 && errno==EINTR));
+	if (num<0 && errno==EINVAL) {	// splice is not supported by the file, copy it through a buffer
+		char buffer[0x4000];
+		ssize_t numw,num2;
+		do {
+			num=read(fds[0],buffer,sizeof(buffer));
+			numw=0;
+			while (numw<num) {
+				num2=write(fds[1],buffer+numw,num-numw);
+				if (num2<0) {num=0;break;} else numw+=num2;
 			}
-			fsync(fds[1]);
-			close(fds[1]);
+		} while (num>0);
+	}
+	close(fds[0]);
+	close(fds[1]);
+	free(fds);
+	return 0;
+}
+
+int execute_program(const char *file,const char **args,Output *out,const char* path_in,const char *path_script,unsigned long timeout) {
+	pid_t child;	// ID of child process executing external program
+	int fds[2]={-1,-1};	// Handles of the two ends of the pipe, only used if input has to be provided to the standard input of the external program and the file can not be given directly
+	int in=-1;	// Handle of the file provided on the standard input
+	int script=-1;	// Handle of the script given to the program
+	int pipe_out[2]={-1,-1};	// Handles of the two ends of the pipe carrying the standard output of the program to the output structure
+	// Everything is prepared before the creation of the new process, because only async-signal-safe functions can be called in the child of a multithreaded process
+	Launch launch;
+	if (prepare_program(file,args,&launch)!=0) {
+		fprintf(stderr,"Error calling external program : %s\n",file);
+		return 1;
+	}
+	if (path_in!=0) {	// Descriptors are closed on exec so that programs launched at the same time by other threads do not inherit them
+		in=openat(persistent.mirror_fd,path_in,O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if (in>=0 && (fstat(in,&st)!=0 || !S_ISREG(st.st_mode))) {	// A regular file is directly the standard input of the program, other files are copied through a pipe
+			if (pipe2(fds,O_CLOEXEC)!=0) {close(in);release_program(&launch);return 1;}
+		}
+	}
+	if (path_script!=0) {
+		script=openat(persistent.mirror_fd,path_script,O_RDONLY | O_CLOEXEC);
+		if (script<0) {
+			if (in>=0) close(in);
+			if (fds[0]>=0) {close(fds[0]);close(fds[1]);}
+			release_program(&launch);
+			return 1;
+		}
+	}
+	if (out!=0 && pipe2(pipe_out,O_CLOEXEC)!=0) {
+		if (in>=0) close(in);
+		if (fds[0]>=0) {close(fds[0]);close(fds[1]);}
+		if (script>=0) close(script);
+		release_program(&launch);
+		return 1;
+	}
+	SpawnRequest req;
+	req.exec_fd=launch.fd;
+	req.args=launch.args;
+	req.envp=persistent.envp;
+	req.in=(fds[0]>=0)?fds[0]:in;
+	req.out=pipe_out[1];
+	req.script=script;
+	req.group=(timeout!=0);
+	child=spawn_process(persistent.spawner,&req);
+	trace_event(TRACE_SPAWN,0,child,file);
+	Watch watch;
+	if (child>=0 && timeout!=0) watchdog_arm(&watch,child,timeout);	// The watchdog also stops a program which never closes its output
+	release_program(&launch);
+	if (script>=0) close(script);
+	if (fds[0]>=0) {
+		close(fds[0]);
+		if (child>=0) {	// Feed the pipe in another thread, so that the program can be waited for at the same time
+			int *feed=(int*)malloc(2*sizeof(int));
+			feed[0]=in;
+			feed[1]=fds[1];
+			pthread_t thread;
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+			if (pthread_create(&thread,&attr,feed_pipe,feed)==0) in=fds[1]=-1; else free(feed);
+			pthread_attr_destroy(&attr);
 		}
-		int code;
-		waitpid(child,&code,0);
-		if (WIFEXITED(code)) return WEXITSTATUS(code);
-	} else {	// Child process (external program)
-		if (out!=0) dup2(out,STDOUT_FILENO);	// Redirect output to out descriptor
-		else dup2(STDERR_FILENO,STDOUT_FILENO);	// Redirect standard output on standard error, to avoid mixing outputs from the external program and the parent process
-		if (path_in==0) {
-			close(STDIN_FILENO);	// We do not want the external program to use anything from the common standard input
-		} else {
-			close(fds[1]);	// Close output descriptor
-			dup2(fds[0],STDIN_FILENO);	// Redirect standard input to pipe output
+		if (fds[1]>=0) close(fds[1]);
+	}
+	if (in>=0) close(in);
+	if (out!=0) {	// Collect the output while the program runs, until it ends
+		close(pipe_out[1]);
+		if (child>=0) {
+			int exited=process_descriptor(child);	// Without it, the output is read until every process holding the pipe has closed it
+			if (output_fill(out,pipe_out[0],exited)<0) fprintf(stderr,"Error reading the output of external program : %s\n",file);
+			if (exited>=0) close(exited);
 		}
-		//execvp(file,(char *const *)args);
-		call_program(file,args);
-		fprintf(stderr,"Error calling external program : %s",file);
-		args++;
-		while (args!=0) fprintf(stderr," %s",*(args++));
-		fprintf(stderr,"\n");
-		abort();
+		close(pipe_out[0]);
 	}
-	return 1;
+	if (child<0) return 1;
+	int code,expired=0;
+	if (timeout!=0) {	// The watchdog forgets the process before it is reaped, so that it never signals an identifier reused by another process
+		siginfo_t info;
+		int waited;
+		while ((waited=waitid(P_PID,child,&info,WEXITED | WNOWAIT))<0 && errno==EINTR);
+		if (waited==0) expired=watchdog_disarm(&watch);
+		code=wait_process(child);
+		if (waited!=0) expired=watchdog_disarm(&watch);	// The children of the zygote are only signaled by the zygote, as long as it has not reaped them
+	} else code=wait_process(child);
+	if (expired) code=EXECUTION_TIMEOUT;
+	trace_event(TRACE_EXIT,0,code,file);
+	return code;
 }
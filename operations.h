@@ -21,9 +21,13 @@
 #ifndef  OPERATIONS_INC
 #define  OPERATIONS_INC
 
+#include <sys/stat.h>
 #include "procedures.h"
+#include "spawner.h"
+#include "output.h"
 
 #define	FILENAME_MAX_LENGTH 0x400	//!< Maximum length of a path name in the virtual filesystem
+#define	EXECUTION_TIMEOUT (-1)	//!< Exit code of a program stopped because it ran longer than its timeout
 
 /********************************************/
 /*         DATA TYPES AND FUNCTIONS         */
@@ -39,7 +43,28 @@ struct Persistent {
 	size_t mirror_len;	//!< Length of the mirror string
 	int mirror_fd;	//!< File descriptor of the mirror folder
 	Procedures *procs;	//!< List of procedures describing what to do with files
-} persistent;	//!< Variable holding all the persistent data needed by the application
+	size_t cache_memory;	//!< Maximum number of bytes of script outputs kept in memory by the output cache
+	size_t cache_disk;	//!< Maximum number of bytes of script outputs kept on the disk by the output cache
+	char *cache_dir;	//!< Folder of the disk tier of the output cache, null to use a temporary folder
+	Spawner spawner;	//!< Method used to create the processes of external programs
+	size_t spill_threshold;	//!< Size above which the output of a script is moved from memory to a file
+	char *spill_dir;	//!< Folder in which large outputs are stored, null to use /tmp
+	int stream;	//!< Tells if script files can be read while their program is running
+	int page_cache;	//!< Tells if the size of the outputs is given to the kernel, so that it can keep them in its page cache
+	int watch;	//!< Tells if the modifications of the mirror folder are watched
+	int readdir_plus;	//!< Tells if the files of a folder are classified while the folder is read
+	size_t max_executions;	//!< Maximum number of programs executed at the same time, 0 for no limit
+	size_t max_queue;	//!< Maximum number of executions waiting for their admission
+	size_t prefetch;	//!< Number of threads executing in advance the scripts found while folders are read, 0 if scripts are only executed when they are opened
+	size_t test_servers;	//!< Number of processes started for each test server
+	int test_timeout;	//!< Time in milliseconds a test server has to answer a request
+	size_t workers;	//!< Number of processes started for each worker program
+	unsigned long worker_requests;	//!< Number of requests after which a worker process is replaced, 0 if they are never replaced
+	int trace;	//!< Tells if the events of the file system are recorded from the start
+	size_t trace_events;	//!< Number of events recorded for each thread
+};
+
+extern struct Persistent persistent;	//!< Variable holding all the persistent data needed by the application
 
 /**
  * \brief Data saved about an opened file
@@ -56,9 +81,10 @@ typedef struct FileStruct {
 		T_FOLDER	//!< Directory
 	} type;	//!< Type of the file
 	int file_handle;	//!< Handle of the corresponding item on the mirror file system if the system is a file
+	Output *output;	//!< Output of the script if the file is a script
 	void* dir_handle; //!< Pointer to the directory flow if the file is actually a directory
 	//int dirfd;	//!< Handle of the directory if the file is a directory. This handle is kept to close the open directory when it is no longer used, but it should not be used by the application
-	char filename[FILENAME_MAX_LENGTH];	//!< Name of the file
+	off_t dir_position;	//!< Position of the directory flow, as returned by telldir, if the file is a directory
 } FileStruct;
 
 /**
@@ -81,7 +107,7 @@ void free_resources();
 /**
  * \brief Test if a file is a shell script
  *
- * This function is one possible implementation of a TestFunction function. This one is used when the script interpretor is the shell. It tests if a particular file is a script by looking at the two first bytes and checking if they are a shebang.
+ * This function is one possible implementation of a TestFunction function. This one is used when the script interpretor is the shell. It tests if a particular file is a script by looking at the two first bytes and checking if they are a shebang. The first bytes are read through the header cache.
  * \param test Pointer to the Test structure from which the function is called.
  * \param file Path of the file that has to be tested
  * \return 1 if the file is a shell script, 0 otherwise
@@ -148,30 +174,78 @@ int test_pattern(PTest test,const char *file);
  */
 int test_program(PTest test,const char *file);
 
+/**
+ * \brief Test function that asks a test server
+ *
+ * This test function sends the path of the file to one of the long-lived processes of the test, and reads its answer. The processes are started by the first requests.
+ * \param test Pointer to the Test structure from which the function is called. The structure holds the pool of processes of the test.
+ * \param file Path of the file which has to be tested
+ * \return 1 if the file may be regarded as a script, 0 otherwise, TEST_FAILED if no process answered in time
+ */
+int test_server(PTest test,const char *file);
+
 /********************************************/
 /*           EXECUTION FUNCTIONS            */
 /********************************************/
+/**
+ * \brief Ask a worker to execute a script
+ *
+ * This function is one possible implementation of a ProgramFunction function. It sends the path of the script to one of the long-lived processes of the program and reads the framed response into the output structure, without creating any process once the workers are running.
+ * \param program Pointer to the Program structure, which holds the pool of workers
+ * \param file Path of the script
+ * \param out Output receiving the output of the script
+ * \return Exit code of the script
+ */
+int program_server(PProgram program,const char *file,Output *out);
+
 /**
  * \brief Execute a script with the help of an interpretor
  *
- * This function of the ProgramFunction type executes a script as it would be done by a shell. It is assumed the file (script) starts with a shebang #!, then the path of the interpretor is written on the same first line. This interpretor is used to execute the script. The function spawns a new process that loads the interpretor. The standard output is redirected to the file which descriptor is given.
+ * This function of the ProgramFunction type executes a script as it would be done by a shell. It is assumed the file (script) starts with a shebang #!, then the path of the interpretor is written on the same first line. This interpretor is used to execute the script. The function spawns a new process that loads the interpretor, and gives it the original script through an open descriptor, without copying it. The standard output is captured in the output structure.
  * \param program Pointer to the Program structure from which the function is called. The structure holds data used to locate the executable and get its arguments.
  * \param file Path of the script file
- * \param fd Descriptor of the file on which the output of the program will be written. The file should already be opened and ready to accept input
+ * \param out Output in which the standard output of the program is captured
  * \return Error code of the external program after its execution
  */
-int program_shell(PProgram program,const char *file,int fd);
+int program_shell(PProgram program,const char *file,Output *out);
 
 /**
  * \brief Execute an external program and write its output on given file
  *
- * This function is a simple wrapper of the execute_program function and publishes it as a ProgramFunction type. It executes the external program on the specified file and redirects its output on the file which descriptor is given.
+ * This function is a simple wrapper of the execute_program function and publishes it as a ProgramFunction type. It executes the external program on the specified file and captures its output in the output structure.
  * \param program Pointer to the Program structure from which the function is called. The structure holds data used to locate the executable and get its arguments.
  * \param file Path of the file on which the program will be executed. The file will be the last argument of the line which invokes the external program
- * \param fd Descriptor of the file on which the output of the program will be written. The file should already be opened and ready to accept input
+ * \param out Output in which the standard output of the program is captured
  * \return Error code of the external program after its execution
  */
-int program_external(PProgram program,const char *file,int fd);
+int program_external(PProgram program,const char *file,Output *out);
+
+/**
+ * \brief Execute the program of a procedure on a script
+ *
+ * The function calls the program function of the procedure and counts the execution, its duration and its exit code in the statistics of the file system. A program stopped by its timeout gives an exit code of 1 if the procedure keeps partial outputs, and EXECUTION_TIMEOUT otherwise, a negative exit code making the reads of the output fail at its end.
+ * \param proc Procedure which program is executed
+ * \param file Path of the script relative to the mirror folder
+ * \param out Output in which the standard output of the program is captured
+ * \return Exit code of the program
+ */
+int execute_procedure(Procedure *proc,const char *file,Output *out);
+
+struct OutputKey;
+struct Flight;
+
+/**
+ * \brief Execute the program of a procedure on a script in a new thread
+ *
+ * The function starts a detached thread which executes the program of the procedure on the script, captures its output in the output structure and marks it as complete when the program ends. The execution should have been admitted by admission_enter, and the thread calls admission_leave when the program ends; if the thread can not be started, the admission is left to the caller. It returns as soon as the thread is started, so that the output can be read while the program is running. If a key is given, the output is stored in the output cache when the program ends with a null exit code. The thread holds its own reference on the output, and stops reading the program if it becomes the last holder.
+ * \param proc Procedure which program is executed
+ * \param file Path of the script relative to the mirror folder
+ * \param out Output in which the standard output of the program is captured
+ * \param key Key of the output in the output cache, null if the output should not be cached
+ * \param flight Execution in flight ended by the thread with flight_end when the program ends, null if there is none
+ * \return 0 if the thread was started, -1 otherwise
+ */
+int stream_program(Procedure *proc,const char *file,Output *out,const struct OutputKey *key,struct Flight *flight);
 
 /********************************************/
 /*             OTHER OPERATIONS             */
@@ -187,24 +261,59 @@ int program_external(PProgram program,const char *file,int fd);
 Procedure* get_script(const Procedures *procs,const char *file);
 
 /**
- * \brief Detect if a file is a shell script or a classic executable and executes it
+ * \brief Find the script associated with a file whose attributes are already known
+ *
+ * This function does the same job as get_script, but it takes the attributes of the file from the caller instead of reading them again. The attributes identify the version of the file in the classification verdict cache, so that the test functions are only called the first time a given version of the file is examined. The attributes must have been read following symbolic links.
+ * \param procs List of procedures that will be tested against the file
+ * \param file Path of the actual file
+ * \param st Attributes of the file, as returned by fstatat
+ * \param failed Pointer to a variable set to 1 if a test could not examine the file, in which case the verdict is not cached and should not be kept by the caller, and to 0 otherwise, or a null pointer
+ * \return Pointer to a procedure which test function succeeds when applied to the file, null if no procedure is found
+ */
+Procedure* get_script_stat(const Procedures *procs,const char *file,const struct stat *st,int *failed);
+
+/**
+ * \brief Program ready to be launched
  *
- * The function checks if the file in the first argument is a shell script or a classic executable file. It then executes it according to its nature. The executed program replaces the current process and nothing is done with input and output file descriptors which should be redirected before the call to the function if needed. Since the current process is replaced by a new one, the function should never return. The mere fact that it returns tells that an error occured.
+ * This structure holds everything needed to replace a process by an external program, so that nothing has to be read or allocated between the creation of the new process and the call to fexecve.
+ */
+typedef struct Launch {
+	int fd;	//!< Descriptor of the executable file, which is the interpretor if the program is a shell script, -1 if the structure is empty
+	const char **args;	//!< Array of arguments ending with a null pointer, starting with the path of the interpretor if the program is a shell script
+	char *interpreter;	//!< Path of the interpretor if the program is a shell script, null otherwise
+	char *argument;	//!< Optional argument of the interpretor given on the shebang line, null if there is none
+} Launch;
+
+/**
+ * \brief Detect if a file is a shell script or a classic executable and prepare its execution
+ *
+ * The function checks if the file in the first argument is a shell script or a classic executable file. If it is a shell script, the interpretor named after the shebang is opened and its path, followed by the optional argument written after it on the shebang line, is added at the beginning of the array of arguments. The header of the file is shared with the test functions through the header cache, so a file which has just been classified is not read again. Otherwise the file itself is opened. The descriptors are opened with the close-on-exec flag.
  * \param file Path to the program to be executed
- * \param args Array of arguments to be added after the name of the program. Whether the program is a shell script or a real executable, the array of arguments will not be changed and will be sent as such to the execvp call.
+ * \param args Array of arguments to be added after the name of the program. Whether the program is a shell script or a real executable, the array of arguments will not be changed and will be sent as such to the fexecve call.
+ * \param launch Structure filled by the function, which must be released with release_program
+ * \return 0 if the program can be launched, -1 otherwise
+ */
+int prepare_program(const char *file,const char **args,Launch *launch);
+
+/**
+ * \brief Release the resources of a Launch structure
+ *
+ * \param launch Structure filled by prepare_program
  */
-void call_program(const char *file,const char **args);
+void release_program(Launch *launch);
 
 /**
  * \brief Spawn a process that executes an external program
  *
- * This function creates a new process which will execute the external program located at file. The third argument is a file descriptor on which the output will be written. If the descriptor is null, no output will be written at all. The last argument is a path to a file which content should be provided on the standard input of the external program. If nothing has to be sent to the external program, the user should give a null value to this parameter.
+ * This function creates a new process which will execute the external program located at file. The program is prepared by prepare_program before the creation of the process, so the function can be called by several threads at the same time. The process is created by spawn_process with the method chosen in the persistent structure. The third argument is an output structure in which the standard output of the program is captured through a pipe. If it is null, the standard output of the program goes to the standard error. The last argument is a path to a file which content should be provided on the standard input of the external program. If nothing has to be sent to the external program, the user should give a null value to this parameter.
  * \param file Path to the executable file
  * \param args Array of arguments to be added after the name of the program. The array must end with a null pointer. By convention, the first element of the array should be the path of the program itself but this function does not take care of adding the path of the program (file) at the beginning of the array.
- * \param out Descriptor of the file on which the output will be redirected, 0 if no output is required
- * \param path_in Path of the file that should be provided to the standard output, 0 if no file has to be provided
- * \return Error code of the program after the end of its execution
+ * \param out Output in which the standard output of the program is captured, 0 if no output is required
+ * \param path_in Path of the file that should be provided to the standard input, 0 if no file has to be provided. A regular file is opened and given directly as the standard input of the program. Other files are copied to a pipe by a separate thread.
+ * \param path_script Path of a file, relative to the mirror folder, which is opened and given to the program as the descriptor SPAWN_SCRIPT_FD, so that the program can read it through SPAWN_SCRIPT_PATH even if the mirror folder is hidden by the virtual file system. 0 if no file has to be given
+ * \param timeout Time in milliseconds the program may run, 0 for no limit. The program then leads a new process group, which is sent SIGTERM when the time is over, and SIGKILL if it is still running WATCHDOG_GRACE milliseconds later
+ * \return Error code of the program after the end of its execution, EXECUTION_TIMEOUT if it was stopped by its timeout
  */
-int execute_program(const char *file,const char **args,int out,const char *path_in);
+int execute_program(const char *file,const char **args,Output *out,const char *path_in,const char *path_script,unsigned long timeout);
 
 #endif   /* ----- #ifndef OPERATIONS_INC  ----- */
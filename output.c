@@ -0,0 +1,241 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  output.c
+ *
+ *    Description:  Implementation of the buffers holding the output of scripts
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 14:25:10
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_GNU_SOURCE	//!< Needed for O_TMPFILE, mkostemp and splice
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "operations.h"
+#include "output.h"
+
+Output *output_new() {
+	Output *output=(Output*)malloc(sizeof(Output));
+	pthread_mutex_init(&output->lock,0);
+	pthread_cond_init(&output->grown,0);
+	output->data=0;
+	output->size=0;
+	output->capacity=0;
+	output->fd=-1;
+	output->done=0;
+	output->code=0;
+	output->refs=1;
+	output->stream=0;
+	return output;
+}
+
+Output *output_from_fd(int fd) {
+	struct stat st;
+	if (fstat(fd,&st)!=0) return 0;
+	Output *output=output_new();
+	output->fd=fd;
+	output->size=st.st_size;
+	output->done=1;
+	return output;
+}
+
+Output *output_from_buffer(char *data,size_t size) {
+	Output *output=output_new();
+	output->data=data;
+	output->size=size;
+	output->capacity=size;
+	output->done=1;
+	return output;
+}
+
+Output *output_ref(Output *output) {
+	__atomic_fetch_add(&output->refs,1,__ATOMIC_RELAXED);
+	return output;
+}
+
+void output_unref(Output *output) {
+	if (output==0 || __atomic_sub_fetch(&output->refs,1,__ATOMIC_ACQ_REL)>0) return;
+	if (output->fd>=0) close(output->fd);
+	free(output->data);
+	pthread_cond_destroy(&output->grown);
+	pthread_mutex_destroy(&output->lock);
+	free(output);
+}
+
+/**
+ * \brief Create the file in which an output is moved when it grows too large
+ *
+ * The file is created in the spill folder and is never visible in it: it is either an anonymous O_TMPFILE file, or a temporary file which is unlinked immediately.
+ * \return Descriptor of the file, -1 if it could not be created
+ */
+static int spill_file() {
+	const char *dir=(persistent.spill_dir!=0)?persistent.spill_dir:"/tmp";
+	int fd=open(dir,O_TMPFILE | O_RDWR | O_CLOEXEC,S_IRUSR | S_IWUSR);
+	if (fd>=0 || (errno!=EOPNOTSUPP && errno!=EISDIR)) return fd;
+	char name[strlen(dir)+12];
+	sprintf(name,"%s/sfs.XXXXXX",dir);
+	fd=mkostemp(name,O_CLOEXEC);
+	if (fd>=0) unlink(name);
+	return fd;
+}
+
+/**
+ * \brief Move the content of an output from memory to a file
+ *
+ * The function should only be called by the thread filling the output, without holding the lock. The file is created and written without the lock, since only that thread changes the buffer, and the lock is only taken to swap the buffer for the file, so that the readers are not blocked meanwhile.
+ * \param output Output
+ * \return 0 if everything went fine, -1 otherwise
+ */
+static int output_spill(Output *output) {
+	int fd=spill_file();
+	if (fd<0) return -1;
+	size_t size=output->size;
+	size_t done=0;
+	ssize_t num;
+	while (done<size) {
+		num=write(fd,output->data+done,size-done);
+		if (num<=0) {close(fd);return -1;}
+		done+=num;
+	}
+	pthread_mutex_lock(&output->lock);
+	char *data=output->data;
+	output->data=0;
+	output->capacity=0;
+	output->fd=fd;
+	pthread_mutex_unlock(&output->lock);
+	free(data);
+	return 0;
+}
+
+/**
+ * \brief Read data of a descriptor into an output
+ *
+ * This function is the common part of output_fill and output_fill_size.
+ * \param output Output
+ * \param fd Descriptor from which the data is read
+ * \param limit Pointer to the maximum number of bytes to read, decreased by the number of bytes read
+ * \param exited Descriptor which becomes readable when the program writing the data ends, -1 if there is none
+ * \return 0 at the end of the data or when the limit is reached, 1 if the output was abandoned by its readers, -1 if the data could not be read or stored
+ */
+static int output_fill_limit(Output *output,int fd,size_t *limit,int exited) {
+	ssize_t num;
+	for (;;) {
+		int spill=0;	// Tells if the output has grown beyond the spill threshold
+		if (*limit==0) return 0;
+		if (exited>=0) {	// Once the program has ended, only the bytes already in the pipe are read, since the processes it left in the background may never close it
+			struct pollfd fds[2]={{fd,POLLIN,0},{exited,POLLIN,0}};
+			if (poll(fds,2,-1)<0) {
+				if (errno==EINTR) continue;
+				return -1;
+			}
+			if (fds[1].revents!=0) {
+				int avail;
+				if (ioctl(fd,FIONREAD,&avail)!=0) return -1;
+				if ((size_t)avail<*limit) *limit=avail;
+				exited=-1;
+				continue;
+			}
+		}
+		pthread_mutex_lock(&output->lock);
+		if (output->fd<0) {	// The output is still in memory
+			if (output->capacity-output->size<0x4000) {
+				size_t capacity=(output->capacity==0)?0x10000:2*output->capacity;
+				char *data=(char*)realloc(output->data,capacity);
+				if (data==0) {pthread_mutex_unlock(&output->lock);return -1;}
+				output->data=data;
+				output->capacity=capacity;
+			}
+			pthread_mutex_unlock(&output->lock);
+			size_t room=output->capacity-output->size;
+			num=read(fd,output->data+output->size,(room<*limit)?room:*limit);	// Only this thread changes the buffer while the output is filled
+			pthread_mutex_lock(&output->lock);
+			if (num>0) {
+				output->size+=num;
+				size_t threshold=(persistent.spill_threshold!=0)?persistent.spill_threshold:OUTPUT_SPILL_THRESHOLD;
+				spill=(output->size>threshold);
+			}
+		} else {	// The output has been moved to a file, the data goes from the pipe to the file without being copied in memory
+			loff_t off=output->size;
+			pthread_mutex_unlock(&output->lock);
+			num=splice(fd,0,output->fd,&off,(*limit<0x10000)?*limit:0x10000,SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (num<0 && errno==EINVAL) {	// splice is not supported by the spill file
+				char buffer[0x4000];
+				num=read(fd,buffer,(*limit<sizeof(buffer))?*limit:sizeof(buffer));
+				if (num>0 && pwrite(output->fd,buffer,num,output->size)!=num) num=-1;
+			}
+			pthread_mutex_lock(&output->lock);
+			if (num>0) output->size+=num;
+		}
+		if (num>0) {
+			pthread_cond_broadcast(&output->grown);
+			*limit-=num;
+		}
+		pthread_mutex_unlock(&output->lock);
+		if (spill && output_spill(output)!=0) return -1;
+		if (output->stream && __atomic_load_n(&output->refs,__ATOMIC_ACQUIRE)==1) return 1;	// Nobody reads the output any more
+		if (num==0) return 0;
+		if (num<0 && errno!=EINTR) return -1;
+	}
+}
+
+int output_fill(Output *output,int fd,int exited) {
+	size_t limit=(size_t)-1;
+	return output_fill_limit(output,fd,&limit,exited);
+}
+
+int output_fill_size(Output *output,int fd,size_t size) {
+	int code=output_fill_limit(output,fd,&size,-1);
+	return (code==0 && size>0)?-1:code;	// The data ended before the expected size
+}
+
+void output_finish(Output *output,int code) {
+	pthread_mutex_lock(&output->lock);
+	output->code=code;
+	output->done=1;
+	pthread_cond_broadcast(&output->grown);
+	pthread_mutex_unlock(&output->lock);
+}
+
+int output_wait(Output *output) {
+	pthread_mutex_lock(&output->lock);
+	while (!output->done) pthread_cond_wait(&output->grown,&output->lock);
+	int code=output->code;
+	pthread_mutex_unlock(&output->lock);
+	return code;
+}
+
+ssize_t output_read(Output *output,char *buf,size_t size,off_t offset) {
+	ssize_t num=0;
+	pthread_mutex_lock(&output->lock);
+	while (!output->done && offset>=output->size) pthread_cond_wait(&output->grown,&output->lock);	// Wait for the program to write the requested bytes
+	if (offset<output->size) {
+		if (size>output->size-offset) size=output->size-offset;
+		if (output->fd<0) {	// Serve the bytes directly from memory
+			memcpy(buf,output->data+offset,size);
+			num=size;
+		} else {
+			num=pread(output->fd,buf,size,offset);
+			if (num<0) num=-errno;
+		}
+	} else if (output->code<0) num=-EIO;	// The program was stopped before the end of its output
+	pthread_mutex_unlock(&output->lock);
+	return num;
+}
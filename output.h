@@ -0,0 +1,140 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  output.h
+ *
+ *    Description:  Buffers holding the output of scripts
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 14:21:33
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  OUTPUT_INC
+#define  OUTPUT_INC
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#define	OUTPUT_SPILL_THRESHOLD 0x100000	//!< Default size above which an output is moved from memory to a file
+
+/**
+ * \brief Output of a script
+ *
+ * The output of a script is captured in a growable buffer in memory. When it grows beyond a threshold, its content is moved to an unlinked file in the spill folder, and the next bytes are written to that file. Outputs are shared between the opened files and the output cache, so they are reference-counted. An output can be read while it is being filled, the readers waiting for new bytes on the condition variable. An output is never modified once it is complete.
+ */
+typedef struct Output {
+	pthread_mutex_t lock;	//!< Lock protecting the content of the output
+	pthread_cond_t grown;	//!< Condition signaled each time bytes are added to the output or the output is complete
+	char *data;	//!< Content of the output while it is kept in memory, null once it has been moved to a file
+	size_t size;	//!< Number of bytes of the output
+	size_t capacity;	//!< Number of bytes allocated for the data buffer
+	int fd;	//!< Descriptor of the file holding the output once it has been moved out of memory, -1 before
+	int done;	//!< Tells if the output is complete
+	int code;	//!< Exit code of the program which produced the output, only valid when the output is complete, negative if the output was cut and its end should be reported as an error
+	int refs;	//!< Number of references to the output
+	int stream;	//!< Tells if the output is filled by a thread of its own, which stops reading the program when it holds the last reference
+} Output;
+
+/**
+ * \brief Create a new empty output
+ *
+ * The user is responsible for releasing the output with output_unref.
+ * \return Pointer to the newly-allocated output, with one reference
+ */
+Output *output_new();
+
+/**
+ * \brief Create a complete output from the content of a file
+ *
+ * The output takes ownership of the descriptor, which is read from its beginning and closed when the output is released.
+ * \param fd Descriptor of the file holding the output
+ * \return Pointer to the newly-allocated output, with one reference, or a null pointer if the size of the file can not be read
+ */
+Output *output_from_fd(int fd);
+
+/**
+ * \brief Create a complete output from a buffer in memory
+ *
+ * The output takes ownership of the buffer, which is released with free when the output is released.
+ * \param data Buffer allocated with malloc holding the output, or a null pointer for an empty output
+ * \param size Number of bytes of the output
+ * \return Pointer to the newly-allocated output, with one reference
+ */
+Output *output_from_buffer(char *data,size_t size);
+
+/**
+ * \brief Add a reference to an output
+ *
+ * \param output Output
+ * \return The same output
+ */
+Output *output_ref(Output *output);
+
+/**
+ * \brief Remove a reference to an output
+ *
+ * The output is released when its last reference is removed.
+ * \param output Output
+ */
+void output_unref(Output *output);
+
+/**
+ * \brief Read all the data of a descriptor into an output
+ *
+ * The function reads the descriptor until the end of the data, typically the reading end of a pipe connected to the standard output of a program. If a descriptor of the program is given, the function stops as soon as the program has ended and the bytes already in the pipe have been read, even if a process started in the background by the program still holds the pipe open. The data is moved to the spill file as soon as the output exceeds the spill threshold, and is then transferred to the file with splice. The readers waiting in output_read are woken up each time new bytes are available. If the output is streamed and nobody else holds a reference to it, the function stops reading, so that the program gets SIGPIPE on its next write.
+ * \param output Output
+ * \param fd Descriptor from which the data is read
+ * \param exited Descriptor which becomes readable when the program writing the data ends, as returned by process_descriptor, or -1 to read until the end of the data
+ * \return 0 if everything went fine, 1 if the output was abandoned by its readers, -1 if the data could not be read or stored
+ */
+int output_fill(Output *output,int fd,int exited);
+
+/**
+ * \brief Read a given number of bytes of a descriptor into an output
+ *
+ * The function behaves like output_fill, but stops after the given number of bytes, so that the descriptor can carry other data after them, typically the next responses of a worker.
+ * \param output Output
+ * \param fd Descriptor from which the data is read
+ * \param size Number of bytes to read
+ * \return 0 if everything went fine, 1 if the output was abandoned by its readers, -1 if the data could not be read or stored or ended before the given size
+ */
+int output_fill_size(Output *output,int fd,size_t size);
+
+/**
+ * \brief Mark an output as complete
+ *
+ * \param output Output
+ * \param code Exit code of the program which produced the output
+ */
+void output_finish(Output *output,int code);
+
+/**
+ * \brief Wait until an output is complete
+ *
+ * \param output Output
+ * \return Exit code of the program which produced the output
+ */
+int output_wait(Output *output);
+
+/**
+ * \brief Read bytes from an output
+ *
+ * If the output is not complete and has no byte at the offset yet, the function waits until new bytes arrive or the output is complete. It then returns the bytes available, which may be less than requested.
+ * \param output Output
+ * \param buf Buffer receiving the bytes
+ * \param size Maximum number of bytes to read
+ * \param offset Position of the first byte to read in the output
+ * \return Number of bytes read, 0 at the end of the output, or a negative error code, -EIO at the end of an output which was cut
+ */
+ssize_t output_read(Output *output,char *buf,size_t size,off_t offset);
+
+#endif   /* ----- #ifndef OUTPUT_INC  ----- */
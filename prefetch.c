@@ -0,0 +1,226 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  prefetch.c
+ *
+ *    Description:  Implementation of the execution in advance of scripts
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 23:11:38
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "procedures.h"
+#include "operations.h"
+#include "cache.h"
+#include "output.h"
+#include "admission.h"
+#include "flight.h"
+#include "prefetch.h"
+
+/**
+ * \brief Script waiting to be executed in advance
+ */
+typedef struct PrefetchJob {
+	Procedure *proc;	//!< Procedure matching the script
+	char *file;	//!< Path of the script relative to the mirror folder
+} PrefetchJob;
+
+/**
+ * \brief State of the execution in advance
+ *
+ * The queue is a ring of PREFETCH_QUEUE jobs, protected by the lock with the counters.
+ */
+static struct {
+	pthread_mutex_t lock;	//!< Lock protecting the queue and the counters
+	pthread_cond_t wake;	//!< Condition signaled when a job is queued, when no reader waits any longer and when the threads have to stop
+	pthread_t *threads;	//!< Threads executing the jobs
+	size_t count;	//!< Number of threads
+	PrefetchJob jobs[PREFETCH_QUEUE];	//!< Ring of the waiting jobs
+	size_t first;	//!< Index of the oldest waiting job
+	size_t waiting;	//!< Number of waiting jobs
+	unsigned long foreground;	//!< Number of scripts being executed for readers
+	int stop;	//!< Tells if the threads have to stop
+	int running;	//!< Tells if the threads were started
+	PrefetchStats stats;	//!< Counters of the executions in advance
+} prefetch;
+
+/**
+ * \brief Remove a job from the queue
+ *
+ * The jobs after it are moved one place back. The lock should be held by the caller.
+ * \param position Position of the job in the queue, 0 being the oldest one
+ */
+static void remove_job(size_t position) {
+	free(prefetch.jobs[(prefetch.first+position)%PREFETCH_QUEUE].file);
+	size_t i;
+	for (i=position;i+1<prefetch.waiting;++i) prefetch.jobs[(prefetch.first+i)%PREFETCH_QUEUE]=prefetch.jobs[(prefetch.first+i+1)%PREFETCH_QUEUE];
+	--prefetch.waiting;
+}
+
+/**
+ * \brief Find a job in the queue
+ *
+ * The lock should be held by the caller.
+ * \param file Path of the script
+ * \return Position of the job in the queue, or the number of waiting jobs if the script is not in the queue
+ */
+static size_t find_job(const char *file) {
+	size_t i;
+	for (i=0;i<prefetch.waiting && strcmp(prefetch.jobs[(prefetch.first+i)%PREFETCH_QUEUE].file,file)!=0;++i);
+	return i;
+}
+
+/**
+ * \brief Execute a script and store its output in the output cache
+ *
+ * Nothing is executed if the output is already in the cache, if the script is already being executed for a reader, or if the admission control does not let the script run at once. The execution is registered as an execution in flight, so that the readers opening the script meanwhile share its output instead of executing it again. Only the outputs of the executions which end with a null exit code are stored.
+ * \param job Job
+ */
+static void run_job(const PrefetchJob *job) {
+	OutputKey key;
+	struct stat st;
+	if (!output_cache_key(job->proc,job->file,&key) || fstatat(persistent.mirror_fd,job->file,&st,0)!=0) return;
+	Output *output=output_cache_fetch(&key);
+	if (output!=0) {
+		output_unref(output);
+		__atomic_fetch_add(&prefetch.stats.skipped,1,__ATOMIC_RELAXED);
+		return;
+	}
+	if (admission_enter(job->proc,0)!=0) {	// The scripts executed in advance never wait for their turn, and are admitted before they are registered so that a reader joining them never gets a rejection
+		pthread_mutex_lock(&prefetch.lock);
+		++prefetch.stats.dropped;
+		pthread_mutex_unlock(&prefetch.lock);
+		return;
+	}
+	Flight *flight=flight_enter(&st,job->proc,&output);
+	if (flight==0) {	// A reader is already executing the script
+		admission_leave(job->proc);
+		if (output!=0) output_unref(output);
+		__atomic_fetch_add(&prefetch.stats.skipped,1,__ATOMIC_RELAXED);
+		return;
+	}
+	output=output_new();
+	flight_start(flight,output);
+	int code=execute_procedure(job->proc,job->file,output);
+	admission_leave(job->proc);
+	output_finish(output,code);
+	if (code==0) output_cache_store(&key,output);
+	flight_end(flight,0);
+	output_unref(output);
+	__atomic_fetch_add(&prefetch.stats.executed,1,__ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Execute the waiting jobs, started in a new thread
+ *
+ * The thread lowers its priority, so that the programs it starts run after the others, then takes the oldest job whenever no reader waits for a script.
+ * \param arg Not used
+ * \return Null pointer
+ */
+static void *prefetch_thread(void *arg) {
+	setpriority(PRIO_PROCESS,(id_t)syscall(SYS_gettid),PREFETCH_NICE);	// On Linux, the nice value belongs to the thread and is inherited by the processes it creates
+	pthread_mutex_lock(&prefetch.lock);
+	for (;;) {
+		while (!prefetch.stop && (prefetch.waiting==0 || prefetch.foreground>0)) pthread_cond_wait(&prefetch.wake,&prefetch.lock);
+		if (prefetch.stop) break;
+		PrefetchJob job=prefetch.jobs[prefetch.first];
+		prefetch.first=(prefetch.first+1)%PREFETCH_QUEUE;
+		--prefetch.waiting;
+		pthread_mutex_unlock(&prefetch.lock);
+		run_job(&job);
+		free(job.file);
+		pthread_mutex_lock(&prefetch.lock);
+	}
+	pthread_mutex_unlock(&prefetch.lock);
+	return 0;
+}
+
+int init_prefetch(size_t threads) {
+	memset(&prefetch,0,sizeof(prefetch));
+	if (threads==0 || !output_cache_enabled()) return -1;
+	pthread_mutex_init(&prefetch.lock,0);
+	pthread_cond_init(&prefetch.wake,0);
+	prefetch.threads=(pthread_t*)malloc(threads*sizeof(pthread_t));
+	if (prefetch.threads==0) return -1;
+	prefetch.running=1;
+	for (prefetch.count=0;prefetch.count<threads;++prefetch.count) if (pthread_create(prefetch.threads+prefetch.count,0,prefetch_thread,0)!=0) break;
+	if (prefetch.count==0) {free_prefetch();return -1;}
+	return 0;
+}
+
+void free_prefetch() {
+	if (!prefetch.running) return;
+	pthread_mutex_lock(&prefetch.lock);
+	prefetch.stop=1;
+	while (prefetch.waiting>0) remove_job(0);
+	pthread_cond_broadcast(&prefetch.wake);
+	pthread_mutex_unlock(&prefetch.lock);
+	size_t i;
+	for (i=0;i<prefetch.count;++i) pthread_join(prefetch.threads[i],0);
+	free(prefetch.threads);
+	pthread_cond_destroy(&prefetch.wake);
+	pthread_mutex_destroy(&prefetch.lock);
+	prefetch.running=0;
+}
+
+void prefetch_script(Procedure *proc,const char *file) {
+	if (!prefetch.running) return;
+	pthread_mutex_lock(&prefetch.lock);
+	if (!prefetch.stop && find_job(file)==prefetch.waiting) {
+		if (prefetch.waiting==PREFETCH_QUEUE) ++prefetch.stats.dropped;
+		else {
+			PrefetchJob *job=prefetch.jobs+(prefetch.first+prefetch.waiting)%PREFETCH_QUEUE;
+			job->proc=proc;
+			job->file=strdup(file);
+			++prefetch.waiting;
+			++prefetch.stats.queued;
+			pthread_cond_signal(&prefetch.wake);
+		}
+	}
+	pthread_mutex_unlock(&prefetch.lock);
+}
+
+void prefetch_hold(const char *file) {
+	if (!prefetch.running) return;
+	pthread_mutex_lock(&prefetch.lock);
+	++prefetch.foreground;
+	size_t position=find_job(file);
+	if (position<prefetch.waiting) {
+		remove_job(position);
+		++prefetch.stats.cancelled;
+	}
+	pthread_mutex_unlock(&prefetch.lock);
+}
+
+void prefetch_release() {
+	if (!prefetch.running) return;
+	pthread_mutex_lock(&prefetch.lock);
+	if (--prefetch.foreground==0 && prefetch.waiting>0) pthread_cond_broadcast(&prefetch.wake);
+	pthread_mutex_unlock(&prefetch.lock);
+}
+
+void prefetch_stats(PrefetchStats *stats) {
+	if (!prefetch.running) {memset(stats,0,sizeof(PrefetchStats));return;}
+	pthread_mutex_lock(&prefetch.lock);
+	*stats=prefetch.stats;
+	pthread_mutex_unlock(&prefetch.lock);
+	stats->skipped=__atomic_load_n(&prefetch.stats.skipped,__ATOMIC_RELAXED);
+	stats->executed=__atomic_load_n(&prefetch.stats.executed,__ATOMIC_RELAXED);
+}
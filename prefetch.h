@@ -0,0 +1,88 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  prefetch.h
+ *
+ *    Description:  Execution in advance of the scripts found while folders are listed
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 23:05:12
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  PREFETCH_INC
+#define  PREFETCH_INC
+
+#include <sys/types.h>
+#include "procedures.h"
+
+#define	PREFETCH_QUEUE 0x100	//!< Maximum number of scripts waiting to be executed in advance, the next ones being dropped
+#define	PREFETCH_NICE 19	//!< Nice value of the threads executing scripts in advance, inherited by the programs they start
+
+/**
+ * \brief Counters of the executions in advance
+ */
+typedef struct PrefetchStats {
+	unsigned long queued;	//!< Number of scripts added to the queue
+	unsigned long dropped;	//!< Number of scripts not added because the queue was full, or not executed because the admission control did not let them run at once
+	unsigned long cancelled;	//!< Number of scripts removed from the queue because they were opened before their turn
+	unsigned long skipped;	//!< Number of scripts which output was already in the output cache, or which were being executed for a reader, when their turn came
+	unsigned long executed;	//!< Number of scripts executed in advance
+} PrefetchStats;
+
+/**
+ * \brief Start the threads executing scripts in advance
+ *
+ * The outputs of the scripts executed in advance are stored in the output cache, where the next opening of the scripts finds them, so this function does nothing if the output cache is disabled. The threads run with a nice value of PREFETCH_NICE, and they do not start a new script while a script is being executed for a reader. This function should be called after the program has become a daemon, since the threads do not survive a fork.
+ * \param threads Number of threads, which is the maximum number of scripts executed in advance at the same time
+ * \return 0 if the threads were started, -1 otherwise
+ */
+int init_prefetch(size_t threads);
+
+/**
+ * \brief Stop the threads executing scripts in advance
+ *
+ * The function drops the scripts still waiting, waits for the end of the scripts being executed and releases the resources. It does nothing if the threads were not started.
+ */
+void free_prefetch();
+
+/**
+ * \brief Ask for a script to be executed in advance
+ *
+ * The script is added to the queue, unless it is already there or the queue is full. This function is thread-safe and never waits for an execution.
+ * \param proc Procedure matching the script
+ * \param file Path of the script relative to the mirror folder, which is copied
+ */
+void prefetch_script(Procedure *proc,const char *file);
+
+/**
+ * \brief Tell that a script is about to be executed for a reader
+ *
+ * The script is removed from the queue if it is waiting there, since the reader executes it anyway, and no other script is started in advance until prefetch_release is called. This function is thread-safe.
+ * \param file Path of the script relative to the mirror folder
+ */
+void prefetch_hold(const char *file);
+
+/**
+ * \brief Tell that the execution of a script for a reader has started or ended
+ *
+ * Each call matches a previous call to prefetch_hold. The threads start executing scripts in advance again when no reader waits any longer. This function is thread-safe.
+ */
+void prefetch_release();
+
+/**
+ * \brief Read the counters of the executions in advance
+ *
+ * \param stats Structure receiving the counters
+ */
+void prefetch_stats(PrefetchStats *stats);
+
+#endif   /* ----- #ifndef PREFETCH_INC  ----- */
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include "procedures.h"
 #include "operations.h"
+#include "server.h"
 
 /********************************************/
 /*                UTILITIES                 */
@@ -132,6 +133,7 @@ void free_program(Program *program) {
 		while (*a) free(*(a++));
 		free(program->args);
 	}
+	server_pool_free(program->servers);
 	free(program);
 }
 
@@ -142,8 +144,19 @@ Program *get_program_from_string(const char *str) {
 	prog->args=0;
 	prog->filearg=0;
 	prog->filter=0;
+	prog->servers=0;
+	prog->timeout=0;
+	prog->func=0;
 	if (*str==0 || strncasecmp(str,"AUTO",4)==0) {	// Program is either a shell script or an executable that can be executed by itself
 		prog->func=&program_shell;
+	} else if (*str=='@') {	// The program is a worker started once, which reads the paths of the scripts on its standard input
+		tokenize_command(str+1,&(prog->path),&(prog->args),&(prog->filearg));
+		if (prog->path!=0) {
+			struct stat fileinfo;
+			if (!(stat(prog->path,&fileinfo)==0 && S_ISREG(fileinfo.st_mode) && access(prog->path,X_OK)==0)) {
+				fprintf(stderr,"%s can not be found or executed\n",prog->path);
+			} else prog->func=&program_server;
+		}
 	} else {	// The program is located by a path name
 		tokenize_command(str,&(prog->path),&(prog->args),&(prog->filearg));
 		if (prog->path!=0) {
@@ -176,6 +189,8 @@ void free_test(Test *test) {
 	}
 	if (test->compiled) regfree(test->compiled);
 	free(test->compiled);
+	free(test->pattern);
+	server_pool_free(test->servers);
 	free(test);
 }
 
@@ -186,6 +201,8 @@ Test *get_test_from_string(const char *str) {
 	test->args=0;
 	test->filearg=0;
 	test->compiled=0;
+	test->pattern=0;
+	test->servers=0;
 	test->filter=0;
 	test->func=0;
 	if (*str==0 || strncasecmp(str,"ALWAYS",6)==0) {	// Consider all files are executable
@@ -200,6 +217,15 @@ Test *get_test_from_string(const char *str) {
 		} else {
 			test->func=test_pattern;
 			test->compiled=reg;
+			test->pattern=strdup(str+1);
+		}
+	} else if (*str=='@') {	// The program is a server started once, which reads the paths of the files on its standard input
+		tokenize_command(str+1,&(test->path),&(test->args),&(test->filearg));
+		if (test->path!=0) {
+			struct stat fileinfo;
+			if (!(stat(test->path,&fileinfo)==0 && S_ISREG(fileinfo.st_mode) && access(test->path,X_OK)==0)) {
+				fprintf(stderr,"%s can not be found or executed\n",test->path);
+			} else test->func=&test_server;
 		}
 	} else {	// The program is located by a path name
 		tokenize_command(str,&(test->path),&(test->args),&(test->filearg));
@@ -230,9 +256,46 @@ void free_procedure(Procedure *procedure) {
 	free(procedure);
 }
 
+/**
+ * \brief Read an option of a procedure
+ *
+ * The options are written at the end of the description of the procedure, each one after a semicolon. The options are <tt>limit=number</tt>, the maximum number of executions of the program at the same time, <tt>timeout=duration</tt>, the time the program may run, given in seconds or with a \c ms, \c s or \c m suffix, and <tt>ontimeout=partial</tt> or <tt>ontimeout=error</tt>, what the reader of a program stopped by its timeout gets.
+ * \param proc Procedure receiving the value of the option
+ * \param str String holding the option, without the semicolon
+ * \return 1 if the string is a valid option, 0 otherwise
+ */
+static int read_procedure_option(Procedure *proc,const char *str) {
+	char *end;
+	if (strncmp(str,"limit=",6)==0) {
+		unsigned long value=strtoul(str+6,&end,10);
+		if (end==str+6 || *end!=0) return 0;
+		proc->limit=(size_t)value;
+		return 1;
+	}
+	if (strncmp(str,"timeout=",8)==0) {
+		double value=strtod(str+8,&end);
+		if (end==str+8 || value<0) return 0;
+		if (strcmp(end,"ms")==0) ;
+		else if (*end==0 || strcmp(end,"s")==0) value*=1000;
+		else if (strcmp(end,"m")==0) value*=60000;
+		else return 0;
+		proc->timeout=(unsigned long)(value+0.5);
+		if (proc->timeout==0 && value>0) proc->timeout=1;
+		return 1;
+	}
+	if (strcmp(str,"ontimeout=partial")==0) {proc->partial=1;return 1;}
+	if (strcmp(str,"ontimeout=error")==0) {proc->partial=0;return 1;}
+	return 0;
+}
+
 Procedure* get_procedure_from_string(const char* str) {
 	if (str==0 || *str==0) return 0;
-	Procedure *proc=(Procedure*)malloc(sizeof(Procedure));
+	Procedure *proc=(Procedure*)calloc(1,sizeof(Procedure));
+	// Remove the options at the end of the string, starting from the last one
+	char *copy=strdup(str);
+	char *option;
+	while ((option=strrchr(copy,';'))!=0 && read_procedure_option(proc,option+1)) *option=0;
+	str=copy;
 	const char *p=str;
 	// Find the limit between the program and the test
 	while (*p!=0 && *p!=';') ++p;
@@ -241,6 +304,7 @@ Procedure* get_procedure_from_string(const char* str) {
 	strncpy(q,str,p-str);
 	q[p-str]=0;
 	proc->program=get_program_from_string(q);
+	if (proc->program!=0) proc->program->timeout=proc->timeout;	// The program stops its process itself
 	// Read test
 	if (proc->program!=0) {
 		if (*p==0) {
@@ -254,6 +318,8 @@ Procedure* get_procedure_from_string(const char* str) {
 				proc->test->filearg=0;
 				proc->test->filter=0;
 				proc->test->compiled=0;
+				proc->test->pattern=0;
+				proc->test->servers=0;
 			} else proc->test=0;
 			free(q);
 		}
@@ -272,6 +338,7 @@ Procedure* get_procedure_from_string(const char* str) {
 		free(proc);
 		proc=0;
 	}
+	free(copy);
 	// Return the Procedure object
 	return proc;
 }
@@ -285,8 +352,87 @@ void free_procedures(Procedures *procedures) {
 	Procedures *q;
 	while (p) {
 		q=p->next;
+		if (p->patterns!=0) {
+			regfree(&p->patterns->combined);
+			free(p->patterns->procs);
+			free(p->patterns->groups);
+			free(p->patterns);
+		}
 		free_procedure(p->procedure);
 		free(p);
 		p=q;
 	}
 }
+
+/**
+ * \brief Tell if the test of a procedure can be part of a combined matcher
+ *
+ * \param proc Procedure
+ * \return 1 if the test is a regular expression without back-references, 0 otherwise
+ */
+static int combinable(const Procedure *proc) {
+	if (proc->test==0 || proc->test->func!=test_pattern || proc->test->pattern==0) return 0;
+	const char *p;
+	for (p=proc->test->pattern;*p!=0;++p) if (*p=='\\') {
+		if (p[1]>='1' && p[1]<='9') return 0;
+		if (p[1]!=0) ++p;
+	}
+	return 1;
+}
+
+/**
+ * \brief Build the combined matcher of a run of pattern tests
+ *
+ * \param first First element of the run
+ * \param count Number of procedures in the run
+ * \return Pointer to the newly-allocated set, null if the combined expression can not be compiled
+ */
+static PatternSet *build_pattern_set(Procedures *first,size_t count) {
+	PatternSet *set=(PatternSet*)malloc(sizeof(PatternSet));
+	set->count=count;
+	set->procs=(Procedure**)malloc(count*sizeof(Procedure*));
+	set->groups=(size_t*)malloc(count*sizeof(size_t));
+	size_t length=1;
+	size_t i,group=1;
+	Procedures *p=first;
+	for (i=0;i<count;++i,p=p->next) {
+		set->procs[i]=p->procedure;
+		set->groups[i]=group;
+		group+=p->procedure->test->compiled->re_nsub+1;
+		length+=strlen(p->procedure->test->pattern)+6;
+	}
+	char *source=(char*)malloc(length);	// Alternation of the expressions, written \(e1\)\|\(e2\)... in the basic syntax used by the tests
+	char *q=source;
+	for (i=0;i<count;++i) q+=sprintf(q,(i==0)?"\\(%s\\)":"\\|\\(%s\\)",set->procs[i]->test->pattern);
+	int code=regcomp(&set->combined,source,0);
+	free(source);
+	if (code!=0 || set->combined.re_nsub+1!=group) {	// Keep the separate tests if the expressions do not combine as expected
+		if (code==0) regfree(&set->combined);
+		free(set->procs);
+		free(set->groups);
+		free(set);
+		return 0;
+	}
+	return set;
+}
+
+void compile_patterns(Procedures *procedures) {
+	Procedures *p=procedures;
+	while (p!=0) {
+		size_t count=0;
+		Procedures *q=p;
+		while (q!=0 && combinable(q->procedure)) {++count;q=q->next;}
+		if (count>=2) p->patterns=build_pattern_set(p,count);
+		p=(count==0)?p->next:q;
+	}
+}
+
+int match_patterns(const PatternSet *set,const char *file) {
+	regmatch_t match[set->combined.re_nsub+1];
+	if (regexec(&set->combined,file,set->combined.re_nsub+1,match,0)!=0) return -1;
+	size_t k=0;
+	while (k<set->count-1 && match[set->groups[k]].rm_so<0) ++k;	// Group which took part in the match
+	size_t i;
+	for (i=0;i<k;++i) if (regexec(set->procs[i]->test->compiled,file,0,0,0)==0) return i;	// An expression with a higher priority may match elsewhere in the path
+	return k;
+}
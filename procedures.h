@@ -31,20 +31,24 @@
 /********************************************/
 typedef struct Program *PProgram;	//!< Forward definition of pointer to Program type
 typedef struct Test *PTest;	//!< Forward definition of pointer to Test type
+struct Output;	//!< Forward definition of the Output type
+struct ServerPool;	//!< Forward definition of the ServerPool type
+
+#define	TEST_FAILED (-1)	//!< Value returned by a test function which could not examine the file, the file is then not a script but the verdict is not kept
 
 /**
  * \brief Type of a test function
  *
- * The test function should be called with a path as its parameter and returns 1 if the file at path location is a script, and 0 otherwise.
+ * The test function should be called with a path as its parameter and returns 1 if the file at path location is a script, 0 otherwise, and TEST_FAILED if the file could not be examined, for example because a test server did not answer.
  */
 typedef int (*TestFunction)(PTest,const char*);
 
 /**
  * \brief Type of a script function
  *
- * The script function is called with a parameter giving the path of a script. It executes the script, writes its output on the file with fd descriptor, and returns the error code of the program.
+ * The script function is called with a parameter giving the path of a script. It executes the script, captures its output in the Output structure, and returns the error code of the program.
  */
-typedef int (*ProgramFunction)(PProgram,const char*,int fd);
+typedef int (*ProgramFunction)(PProgram,const char*,struct Output *out);
 
 /********************************************/
 /*                 PROGRAM                  */
@@ -59,6 +63,8 @@ typedef struct Program {
 	char **args;	//!< Array of arguments to send to the program. This variable is null if no external program is defined. If an exclamation mark has been found in the array of arguments, it is replaced by a null element. The filearg variable points to the position of this null element. The last element of the array must be a null pointer. The first element of the array is the name of the executable itself (to comply with the standard way to call a program).
 	char **filearg;	//!< If there is an exclamation mark in args, the variable points to the element holding this exclamation mark
 	int filter;	//!< Tells if the program is actually a filter. In that case, if the filearg variable is null, the program expects to get content on its standard input
+	struct ServerPool *servers;	//!< If the program is actually a worker, holds the pool of its processes once it is created, otherwise null
+	unsigned long timeout;	//!< Time in milliseconds the program may run before its process group is stopped, 0 for no limit, copied from the procedure
 	ProgramFunction func;	//!< Pointer to the program function
 } Program;
 
@@ -92,6 +98,8 @@ typedef struct Test {
 	char **filearg;	//!< If there is an exclamation mark in args, the variable points to the element holding this exclamation mark
 	int filter;	//!< Tells if the test function is actually a filter. In that case, if the filearg variable is null, the function expects to get content on its standard input
 	regex_t *compiled;	//!< If the Test function is actually a match against a regular expression, holds the compiled value of the regular expression, otherwise null
+	char *pattern;	//!< If the Test function is actually a match against a regular expression, holds its source, otherwise null
+	struct ServerPool *servers;	//!< If the Test function is actually a test server, holds the pool of its processes once it is created, otherwise null
 	TestFunction func;	//!< Pointer to the test function
 } Test;
 
@@ -122,6 +130,13 @@ Test *get_test_from_string(const char *str);
 typedef struct Procedure {
 	Program *program;	//!< Pointer to the Program structure
 	Test *test;	//!< Pointer to the Test structure
+	unsigned long tests;	//!< Number of times the test of the procedure was run, updated atomically
+	unsigned long matches;	//!< Number of files found to be scripts by the test of the procedure, updated atomically
+	unsigned long executions;	//!< Number of executions of the program of the procedure, updated atomically
+	size_t limit;	//!< Maximum number of executions of the program at the same time, 0 for no limit
+	size_t running;	//!< Number of executions of the program running now, protected by the lock of the admission control
+	unsigned long timeout;	//!< Time in milliseconds the program may run, 0 for no limit
+	int partial;	//!< Tells if the output written by a program stopped by its timeout is given to the reader, instead of an error
 } Procedure;
 
 /**
@@ -134,7 +149,7 @@ void free_procedure(Procedure *procedure);
 /**
  * \brief Reads a procedure from a string
  *
- * This function is used to process the command-line \c -p arguments. One such argument is converted to a Procedure structure. The newly-allocated structure must be released by the user when it is not needed any longer.
+ * This function is used to process the command-line \c -p arguments. One such argument is converted to a Procedure structure. The string may end with options written as <tt>;name=value</tt>, which are removed before the program and the test are read. The newly-allocated structure must be released by the user when it is not needed any longer.
  * \param str String from which the procedure must be read
  * \return Pointer to a newly-created Procedure structure
  */
@@ -143,6 +158,18 @@ Procedure* get_procedure_from_string(const char* str);
 /********************************************/
 /*                PROCEDURES                */
 /********************************************/
+/**
+ * \brief Combined matcher of consecutive pattern tests
+ *
+ * The regular expressions of consecutive procedures which tests are patterns are joined in one alternation, each of them in a group of its own, so that a single pass over a path tells if one of them matches and which one.
+ */
+typedef struct PatternSet {
+	regex_t combined;	//!< Compiled alternation of the regular expressions
+	size_t count;	//!< Number of procedures in the set
+	Procedure **procs;	//!< Procedures of the set, in their order of priority
+	size_t *groups;	//!< Index of the group of each regular expression in the combined one
+} PatternSet;
+
 /**
  * \brief Chained list of Procedure objects
  *
@@ -151,6 +178,7 @@ Procedure* get_procedure_from_string(const char* str);
 typedef struct Procedures {
 	Procedure *procedure;	//!< Current Procedure element
 	struct Procedures *next;	//!< Next element in the list
+	PatternSet *patterns;	//!< Combined matcher of the set of pattern tests starting at this element, null if no set starts here
 } Procedures;
 
 /**
@@ -162,4 +190,22 @@ typedef struct Procedures {
  */
 void free_procedures(Procedures *procedures);
 
+/**
+ * \brief Combine the pattern tests of a list of procedures
+ *
+ * Each run of at least two consecutive procedures which tests are regular expressions gets a PatternSet, attached to its first element. Regular expressions with back-references are left out, since their groups would be renumbered in the combined expression. This function should be called once the list is complete.
+ * \param procedures List of procedures
+ */
+void compile_patterns(Procedures *procedures);
+
+/**
+ * \brief Find the first procedure of a set which pattern matches a path
+ *
+ * The combined expression is run once on the path. If it matches, the group which took part in the match tells one of the matching procedures, and only the procedures before it are checked again one by one.
+ * \param set Set of pattern tests
+ * \param file Path of the file
+ * \return Index of the first matching procedure in the set, -1 if none matches
+ */
+int match_patterns(const PatternSet *set,const char *file);
+
 #endif   /* ----- #ifndef PROCEDURES_INC  ----- */
@@ -20,10 +20,12 @@
  */
 
 #define	FUSE_USE_VERSION 26			//!< FUSE version on which the file system is based
+#define	_GNU_SOURCE	//!< Needed for O_PATH and AT_EMPTY_PATH
 
 #include <stdlib.h>
 #include <stddef.h>
-#include <fuse.h>
+#include <stdint.h>
+#include <fuse_lowlevel.h>
 #include <fuse_opt.h>
 #include <limits.h>
 #include <stdio.h>
@@ -34,16 +36,41 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/resource.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include "operations.h"
 #include "procedures.h"
+#include "cache.h"
+#include "spawner.h"
+#include "watcher.h"
+#include "inode.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+#include "prefetch.h"
+#include "admission.h"
+#include "flight.h"
+#include "watchdog.h"
 
 #define SFS_OPT_KEY(t,u,p) { t ,offsetof(struct options, p ), 1 } , { u ,offsetof(struct options, p ), 1 }	//!< Generate a command-line argument with short name t, long name u. p is an integer variable name and the corresponding variable will be set to 1 if it is found in the arguments
 #define SFS_OPT_KEY2(t,u,p,v) { t ,offsetof(struct options, p ), v } , { u ,offsetof(struct options, p ), v }	//!< Generate a command-line argument with short name t, long name u. p is an integer or string variable name and the corresponding variable will be set to the value of the argument
 
+#define	NODE_PATH_LENGTH 32	//!< Size of the buffer holding the path of the descriptor of an inode in /proc/self/fd
+#define	VIRTUAL_FOLDER ".scriptfs"	//!< Name of the hidden folder of the root of the file system holding the virtual files
+
 uid_t uid;	//!< Current user ID
 gid_t gid;	//!< Current group ID
+static struct fuse_chan *channel=0;	//!< Channel of the mounted file system, used to send invalidations to the kernel
+
+/**
+ * \brief Options of the file system given with -o
+ */
+struct options {
+	double attr_timeout;	//!< Time during which the kernel keeps the attributes of a file
+	double entry_timeout;	//!< Time during which the kernel keeps the name of a file
+	double negative_timeout;	//!< Time during which the kernel remembers that a file does not exist
+} options={1.0,1.0,0.0};
 
 /**
  * \brief Display a brief help about the syntax and exit the program
@@ -55,29 +82,103 @@ void print_usage(int code) {
 	printf("Syntax: scriptfs [arguments] mirror_folder mount_point\n");
 	printf("Arguments:\n");
 	printf("	-p program[;test]\n\t\tAdd a procedure which tells what to do with files\n");
+	printf("	--cache-memory=size\n\t\tKeep up to size bytes of script outputs in memory and reuse them while the script does not change\n");
+	printf("	--cache-disk=size\n\t\tKeep up to size bytes of script outputs on the disk when they are evicted from memory\n");
+	printf("	--cache-dir=folder\n\t\tFolder in which the outputs are kept on the disk\n");
+	printf("	--spawn=posix_spawn|vfork|fork|zygote\n\t\tMethod used to create the processes of external programs\n");
+	printf("	--spill-threshold=size\n\t\tSize above which the output of a script is moved from memory to a file (default 1M)\n");
+	printf("	--spill-dir=folder\n\t\tFolder of the files holding large outputs (default /tmp)\n");
+	printf("	--stream\n\t\tGive the output of scripts to readers while their program is running\n");
+	printf("	--page-cache\n\t\tReport the size of the outputs and let the kernel cache them, needs the output cache, disables --stream\n");
+	printf("	--watch\n\t\tWatch the mirror folder and forget what is known about the files which change\n");
+	printf("	--readdir-plus\n\t\tClassify the files of a folder while it is listed\n");
+	printf("	--max-executions=number\n\t\tMaximum number of scripts executed at the same time (default 0, no limit)\n");
+	printf("	--max-queue=number\n\t\tMaximum number of scripts waiting to be executed, the next opens failing with EAGAIN (default 64)\n");
+	printf("	--prefetch=threads\n\t\tExecute in advance the scripts of a folder which is listed, with that many threads, needs the output cache\n");
+	printf("	--trace\n\t\tRecord the events of the file system from the start, SIGUSR1 switches the recording on and off\n");
+	printf("	--trace-events=number\n\t\tNumber of events recorded for each thread (default 16384)\n");
+	printf("	--test-servers=number\n\t\tNumber of processes started for each @ test (default 1)\n");
+	printf("	--test-timeout=milliseconds\n\t\tTime a @ test process has to answer before it is restarted (default 5000)\n");
+	printf("	--workers=number\n\t\tNumber of processes started for each @ program (default 1)\n");
+	printf("	--worker-requests=number\n\t\tNumber of scripts after which a @ program process is replaced (default 0, never)\n");
 	printf("	mirror_folder\n\t\tActual folder on the disk that will be the base folder of the mounted structure\n");
 	printf("	mount_point\n\t\tFolder that will be used as the mount point\n");
 	exit(code);
 }
 
 /**
- * \brief Transform an absolute path in the virtual file system in a path relative to the mirror file system
+ * \brief Read a size from a string
  *
- * This function converts an absolute path name in the virtual mounted file system in a relative pathname in the mirror underlying file system. If the pathname is "/", it replaces it with ".". Otherwise it removes the initial slash. The function returns a new string and leaves the user program the responsibility to release it.
- * \param path Absolute path in the virtual file system
- * \return Relative path in the mirror file system
+ * The function converts a string holding a number of bytes, optionally followed by one of the suffixes k, M or G (powers of 1024), into a number.
+ * \param str String holding the size
+ * \param size Pointer to the variable which will hold the size
+ * \return 1 if the string is a valid size, 0 otherwise
  */
-char *relative_path(const char *path) {
-	if (path==0 || path[0]==0) return 0;
-	char *res;	
-	if (path[0]=='/' && path[1]==0) {
-		res=(char*)malloc(2*sizeof(char));
-		res[0]='.';res[1]=0;
-		return res;
+int parse_size(const char *str,size_t *size) {
+	char *end;
+	unsigned long long value=strtoull(str,&end,10);
+	if (end==str) return 0;
+	switch (*end) {
+		case 'k': case 'K': value<<=10;++end;break;
+		case 'm': case 'M': value<<=20;++end;break;
+		case 'g': case 'G': value<<=30;++end;break;
 	}
-	res=(char*)malloc(strlen(path));
-	strcpy(res,path+1);
-	return res;
+	if (*end!=0) return 0;
+	*size=(size_t)value;
+	return 1;
+}
+
+/**
+ * \brief Process a long command-line option specific to ScriptFS
+ *
+ * The function checks if the argument is one of the long options of ScriptFS (written as --name or --name=value) and stores its value in the persistent structure. Other arguments are left for FUSE.
+ * \param arg Command-line argument
+ * \return 1 if the argument was recognized and processed, 0 if it is not an option of ScriptFS
+ */
+int parse_option(const char *arg) {
+	if (strncmp(arg,"--cache-memory=",15)==0) {
+		if (!parse_size(arg+15,&persistent.cache_memory)) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--cache-disk=",13)==0) {
+		if (!parse_size(arg+13,&persistent.cache_disk)) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--cache-dir=",12)==0) {
+		free(persistent.cache_dir);
+		persistent.cache_dir=strdup(arg+12);
+	} else if (strncmp(arg,"--spawn=",8)==0) {
+		if (!parse_spawner(arg+8,&persistent.spawner)) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--spill-threshold=",18)==0) {
+		if (!parse_size(arg+18,&persistent.spill_threshold)) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--spill-dir=",12)==0) {
+		free(persistent.spill_dir);
+		persistent.spill_dir=strdup(arg+12);
+	} else if (strcmp(arg,"--stream")==0) {
+		persistent.stream=1;
+	} else if (strcmp(arg,"--page-cache")==0) {
+		persistent.page_cache=1;
+	} else if (strcmp(arg,"--watch")==0) {
+		persistent.watch=1;
+	} else if (strcmp(arg,"--trace")==0) {
+		persistent.trace=1;
+	} else if (strncmp(arg,"--trace-events=",15)==0) {
+		if (!parse_size(arg+15,&persistent.trace_events) || persistent.trace_events==0) print_usage(EX_USAGE);
+	} else if (strcmp(arg,"--readdir-plus")==0) {
+		persistent.readdir_plus=1;
+	} else if (strncmp(arg,"--max-executions=",17)==0) {
+		if (!parse_size(arg+17,&persistent.max_executions)) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--max-queue=",12)==0) {
+		if (!parse_size(arg+12,&persistent.max_queue)) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--prefetch=",11)==0) {
+		if (!parse_size(arg+11,&persistent.prefetch)) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--test-servers=",15)==0) {
+		if (!parse_size(arg+15,&persistent.test_servers) || persistent.test_servers==0) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--workers=",10)==0) {
+		if (!parse_size(arg+10,&persistent.workers) || persistent.workers==0) print_usage(EX_USAGE);
+	} else if (strncmp(arg,"--worker-requests=",18)==0) {
+		persistent.worker_requests=strtoul(arg+18,0,10);
+	} else if (strncmp(arg,"--test-timeout=",15)==0) {
+		persistent.test_timeout=atoi(arg+15);
+		if (persistent.test_timeout<=0) print_usage(EX_USAGE);
+	} else return 0;
+	return 1;
 }
 
 /**
@@ -111,620 +212,1000 @@ void tokenize(char *s,char ***tokens) {
 	(*tokens)[num]=0;
 }
 
+/**
+ * \brief Produce the output of a script
+ *
+ * The output is taken from the output cache if the same script has already been executed. Otherwise, if the same version of the script is being executed by the same procedure for another opening, its output is shared. Otherwise the program of the procedure is executed on the script once the admission control lets it run, and the other openings of the script can join the execution meanwhile. In streaming mode, the function returns as soon as the program is started, unless the complete output is required, and the thread of the program ends the admission and the execution in flight.
+ * \param proc Procedure matching the script
+ * \param relative Path of the script relative to the mirror folder
+ * \param st Attributes of the script, which identify its version
+ * \param complete Tells if the function should wait for the end of the program even in streaming mode
+ * \param hit Pointer to a variable set to 1 if the output was found in the output cache and to 0 otherwise, or a null pointer
+ * \return Reference to the output, which the caller should release with output_unref, or a null pointer with errno set if the program could not be started, for example EAGAIN if the execution was rejected because too many executions are waiting, or EIO if the complete output was required and the program was stopped by its timeout
+ */
+Output *script_output(Procedure *proc,const char *relative,const struct stat *st,int complete,int *hit) {
+	OutputKey key;
+	int cached=output_cache_enabled() && output_cache_key(proc,relative,&key);
+	Output *output=(cached)?output_cache_fetch(&key):0;	// If the output of the same script is already known, it is not executed again
+	if (hit!=0) *hit=(output!=0);
+	if (output!=0) return output;
+	Flight *flight=flight_enter(st,proc,&output);
+	if (flight==0) {	// Another opening executes the same script, or its program could not be started
+		if (output!=0 && (complete || !persistent.stream) && output_wait(output)<0) {
+			output_unref(output);
+			output=0;
+			errno=EIO;
+		}
+		return output;
+	}
+	prefetch_hold(relative);	// The scripts executed in advance wait while a reader waits
+	int code=admission_enter(proc,1);
+	if (code!=0) {
+		prefetch_release();
+		flight_end(flight,-code);
+		errno=-code;
+		return 0;
+	}
+	output=output_new();
+	flight_start(flight,output);
+	if (complete || !persistent.stream || stream_program(proc,relative,output,cached?&key:0,flight)!=0) {	// In streaming mode, the file is opened as soon as the program is started
+		code=execute_procedure(proc,relative,output);
+		admission_leave(proc);
+		output_finish(output,code);
+		if (cached && code==0) output_cache_store(&key,output);
+		flight_end(flight,0);
+		if (code<0) {	// The program was stopped by its timeout, and its partial output is not given to the reader
+			output_unref(output);
+			output=0;
+			errno=EIO;
+		}
+	}
+	prefetch_release();
+	return output;
+}
+
+/**
+ * \brief Get the inode designated by a FUSE inode number
+ *
+ * The FUSE inode number of a file is the address of its inode in the inode table, except for the mirror folder which has the root number.
+ * \param ino FUSE inode number
+ * \return Pointer to the inode
+ */
+Inode *node(fuse_ino_t ino) {
+	return (ino==FUSE_ROOT_ID)?inode_root():(Inode*)(uintptr_t)ino;
+}
+
+/**
+ * \brief Get the FUSE inode number of an inode
+ *
+ * \param inode Inode
+ * \return FUSE inode number
+ */
+fuse_ino_t node_id(Inode *inode) {
+	return (inode==inode_root())?FUSE_ROOT_ID:(fuse_ino_t)(uintptr_t)inode;
+}
+
+/**
+ * \brief Write the path under which the O_PATH descriptor of an inode can be opened again
+ *
+ * \param inode Inode
+ * \param path Buffer of at least NODE_PATH_LENGTH characters receiving the path
+ */
+void node_path(Inode *inode,char *path) {
+	snprintf(path,NODE_PATH_LENGTH,"/proc/self/fd/%d",inode->fd);
+}
+
+/**
+ * \brief Find the procedure matching a regular file
+ *
+ * The verdict attached to the inode is used as long as the file does not change. Otherwise, the path of the file is rebuilt and get_script_stat finds the procedure, which is then attached to the inode.
+ * \param inode Inode of the file
+ * \param st Current attributes of the file
+ * \param output_size Pointer to a variable which will hold the size of the output of the script if it is known, -1 otherwise, or a null pointer
+ * \return Pointer to the procedure matching the file, null if the file is not a script
+ */
+Procedure *node_script(Inode *inode,const struct stat *st,off_t *output_size) {
+	Procedure *proc;
+	if (inode_verdict(inode,st,&proc,output_size)) return proc;
+	unsigned long epoch=inode_epoch();	// Read before the path, so that a rename happening meanwhile invalidates the verdict
+	char *relative=inode_path(inode,0);
+	int failed;
+	proc=get_script_stat(persistent.procs,relative,st,&failed);
+	trace_event(TRACE_SCRIPT,0,proc!=0,relative);
+	free(relative);
+	if (!failed) inode_set_verdict(inode,st,proc,epoch);	// A test which could not run is tried again next time
+	if (output_size!=0) *output_size=-1;
+	return proc;
+}
+
+/**
+ * \brief Adjust the attributes of a file before they are given to the kernel
+ *
+ * If the file is a script, write access is removed for everyone (for now we don't handle writing on scripts). In page cache mode, the size of a script is the size of its output if it is found in the output cache, the script is never executed only to know its size.
+ * \param inode Inode of the file
+ * \param st Attributes of the mirror file, modified by the function
+ */
+void node_attr(Inode *inode,struct stat *st) {
+	if (!S_ISREG(st->st_mode)) return;
+	if (persistent.page_cache) {	// The size of the output is needed by the kernel to read it through its page cache
+		off_t size;
+		Procedure *proc=node_script(inode,st,&size);
+		if (proc==0) return;
+		if (size<0) {	// Look for the output in the output cache
+			char *relative=inode_path(inode,0);
+			OutputKey key;
+			Output *output=output_cache_key(proc,relative,&key)?output_cache_fetch(&key):0;
+			free(relative);
+			if (output!=0) {
+				size=output->size;
+				inode_set_output_size(inode,st,size);
+				output_unref(output);
+			}
+		}
+		st->st_mode&= (~(S_IWUSR | S_IWGRP | S_IWOTH));
+		if (size>=0) {	// Otherwise the size of the script is reported, and the output will be read without the page cache
+			st->st_size=size;
+			st->st_blocks=(size+511)/512;
+		}
+	} else if ((st->st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))!=0 && node_script(inode,st,0)!=0) st->st_mode&= (~(S_IWUSR | S_IWGRP | S_IWOTH));
+}
+
+/**
+ * \brief Forget what is known about a file of the mirror folder which has changed
+ *
+ * This function is called by the watcher of the mirror folder. The verdict of the file is removed from the verdict cache, and the kernel is told to forget the name of the file in its folder and the attributes and content of its inode, if they are known. A new path epoch starts when a folder may have been renamed. The entries of the output cache are addressed by the content of the scripts and do not need to be removed.
+ * \param file Path of the file relative to the mirror folder, or a null pointer if any file may have changed
+ */
+void mirror_changed(const char *file) {
+	if (file==0) {
+		verdict_cache_clear();
+		inode_new_epoch();
+		return;
+	}
+	verdict_cache_forget(file);
+	struct stat st;
+	Inode *inode;
+	if (strcmp(file,".")!=0) {	// Invalidate the name of the file in its folder
+		const char *name=strrchr(file,'/');
+		if (name==0) inode=inode_root(); else {
+			char folder[name-file+1];
+			memcpy(folder,file,name-file);
+			folder[name-file]=0;
+			inode=(fstatat(persistent.mirror_fd,folder,&st,AT_SYMLINK_NOFOLLOW)==0)?inode_find(st.st_dev,st.st_ino):0;
+		}
+		name=(name==0)?file:name+1;
+		if (inode!=0 && channel!=0) fuse_lowlevel_notify_inval_entry(channel,node_id(inode),name,strlen(name));
+	}
+	if (fstatat(persistent.mirror_fd,file,&st,AT_SYMLINK_NOFOLLOW)==0) {
+		if (S_ISDIR(st.st_mode)) inode_new_epoch();
+		inode=inode_find(st.st_dev,st.st_ino);
+		if (inode!=0 && channel!=0) fuse_lowlevel_notify_inval_inode(channel,node_id(inode),0,0);
+	} else inode_new_epoch();	// The file has been deleted or moved, it may have been a folder
+}
+
+/**
+ * \brief Answer a request with the entry of a file
+ *
+ * The file is looked up in its folder, which counts a new lookup of its inode, and its attributes are adjusted for the kernel.
+ * \param req FUSE request
+ * \param parent Inode of the folder
+ * \param name Name of the file in the folder
+ */
+void reply_entry(fuse_req_t req,Inode *parent,const char *name) {
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	Inode *inode=inode_lookup(parent,name,&e.attr);
+	if (inode==0) {
+		if (errno==ENOENT && options.negative_timeout>0) {	// A null inode number makes the kernel remember that the file does not exist
+			e.entry_timeout=options.negative_timeout;
+			fuse_reply_entry(req,&e);
+		} else fuse_reply_err(req,errno);
+		return;
+	}
+	node_attr(inode,&e.attr);
+	e.ino=node_id(inode);
+	e.attr_timeout=options.attr_timeout;
+	e.entry_timeout=options.entry_timeout;
+	if (fuse_reply_entry(req,&e)!=0) inode_forget(inode,1);	// The kernel did not get the entry
+}
+
+/********************************************/
+/*              VIRTUAL FILES               */
+/********************************************/
+/**
+ * \brief File synthesized by the file system itself
+ *
+ * The virtual files are found in a hidden folder of the root of the file system, which is not listed with the other files of the root. Their content is produced each time they are opened.
+ */
+typedef struct VirtualFile {
+	const char *name;	//!< Name of the file in the virtual folder
+	Output *(*content)();	//!< Function producing a new complete output holding the content of the file
+} VirtualFile;
+
+static const VirtualFile virtual_files[]={	//!< Files of the virtual folder
+	{"stats",stats_report},
+	{"trace",trace_report},
+	{0,0}
+};
+static const char virtual_folder=0;	//!< Variable which address is the FUSE inode number of the virtual folder
+
+/**
+ * \brief Get the FUSE inode number of the virtual folder
+ *
+ * The inode numbers of the virtual folder and files are addresses of static variables, so that they are never the address of an inode of the table.
+ * \return FUSE inode number
+ */
+fuse_ino_t virtual_folder_id() {
+	return (fuse_ino_t)(uintptr_t)&virtual_folder;
+}
+
+/**
+ * \brief Get the virtual file designated by a FUSE inode number
+ *
+ * \param ino FUSE inode number
+ * \return Pointer to the virtual file, or a null pointer if the inode number is not the one of a virtual file
+ */
+const VirtualFile *virtual_file(fuse_ino_t ino) {
+	const VirtualFile *file;
+	for (file=virtual_files;file->name!=0;++file) if (ino==(fuse_ino_t)(uintptr_t)file) return file;
+	return 0;
+}
+
+/**
+ * \brief Tell if a FUSE inode number designates the virtual folder or one of its files
+ *
+ * \param ino FUSE inode number
+ * \return 1 if the inode is virtual, 0 otherwise
+ */
+int is_virtual(fuse_ino_t ino) {
+	return ino==virtual_folder_id() || virtual_file(ino)!=0;
+}
+
+/**
+ * \brief Get the attributes of the virtual folder or of a virtual file
+ *
+ * The files are read-only and have a null size, since their content is read with direct I/O.
+ * \param ino FUSE inode number of the virtual folder or file
+ * \param st Structure filled with the attributes
+ */
+void virtual_attr(fuse_ino_t ino,struct stat *st) {
+	memset(st,0,sizeof(*st));
+	st->st_ino=ino;
+	st->st_uid=uid;
+	st->st_gid=gid;
+	if (ino==virtual_folder_id()) {
+		st->st_mode=S_IFDIR | S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+		st->st_nlink=2;
+	} else {
+		st->st_mode=S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+		st->st_nlink=1;
+	}
+	clock_gettime(CLOCK_REALTIME,&st->st_mtim);
+	st->st_atim=st->st_ctim=st->st_mtim;
+}
+
+/**
+ * \brief Answer a lookup with the entry of the virtual folder or of a virtual file
+ *
+ * \param req FUSE request
+ * \param ino FUSE inode number of the virtual folder or file
+ */
+void reply_virtual_entry(fuse_req_t req,fuse_ino_t ino) {
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	virtual_attr(ino,&e.attr);
+	e.ino=ino;
+	e.attr_timeout=options.attr_timeout;
+	e.entry_timeout=options.entry_timeout;
+	fuse_reply_entry(req,&e);
+}
+
+/**
+ * \brief Open a virtual file
+ *
+ * The content of the file is produced at each opening, and read like the output of a script.
+ * \param req FUSE request
+ * \param file Virtual file
+ * \param fi File information structure, filled by the function with the handle of the content
+ */
+void virtual_open(fuse_req_t req,const VirtualFile *file,struct fuse_file_info *fi) {
+	if ((fi->flags & O_WRONLY)!=0 || (fi->flags & O_RDWR)!=0) {fuse_reply_err(req,EACCES);return;}
+	FileStruct *fs=(FileStruct*)malloc(sizeof(FileStruct));
+	fs->type=T_SCRIPT;
+	fs->file_handle=-1;
+	fs->output=file->content();
+	fs->dir_handle=0;
+	fs->dir_position=0;
+	fi->fh=(long)fs;
+	fi->direct_io=1;
+	if (fuse_reply_open(req,fi)!=0) {
+		output_unref(fs->output);
+		free(fs);
+	}
+}
+
+/**
+ * \brief List the content of the virtual folder
+ *
+ * The offset of each entry is its position in the folder, starting with the . and .. entries.
+ * \param req FUSE request
+ * \param size Maximum number of bytes of entries to return
+ * \param offset Offset of the next directory entry, 0 to start from the beginning
+ */
+void virtual_readdir(fuse_req_t req,size_t size,off_t offset) {
+	char *buf=(char*)malloc(size);
+	if (buf==0) {fuse_reply_err(req,ENOMEM);return;}
+	size_t used=0,length;
+	struct stat st;
+	off_t i;
+	for (i=offset;;++i) {
+		const char *name;
+		memset(&st,0,sizeof(st));
+		if (i==0) {name=".";st.st_ino=virtual_folder_id();st.st_mode=S_IFDIR;}
+		else if (i==1) {name="..";st.st_ino=FUSE_ROOT_ID;st.st_mode=S_IFDIR;}
+		else if (i-2<(off_t)(sizeof(virtual_files)/sizeof(VirtualFile)-1)) {name=virtual_files[i-2].name;st.st_ino=(fuse_ino_t)(uintptr_t)(virtual_files+i-2);st.st_mode=S_IFREG;}
+		else break;
+		length=fuse_add_direntry(req,buf+used,size-used,name,&st,i+1);
+		if (length>size-used) break;
+		used+=length;
+	}
+	fuse_reply_buf(req,buf,used);
+	free(buf);
+}
+
 /**
  * \brief Initialize the filesystem
  *
- * This function does all the technical stuff which has to be done before the start of the program. In particular, it allocates storage for the structures in memory and defines some of the callback functions used when a script is executed. The fuse_conn_info structure tells which capabilities FUSE provides and which one are needed and activated by the client. The function returns a pointer which will be available in all file operations later.
+ * This function does all the technical stuff which has to be done before the start of the program. The fuse_conn_info structure tells which capabilities FUSE provides and which one are needed and activated by the client.
+ * \param userdata User data given to fuse_lowlevel_new, not used
  * \param conn Capabilities requested by the application
- * \return Pointer to a persistent structure, available in future file operations
  */
-void *sfs_init(struct fuse_conn_info *conn) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_init\n");
-#endif
+void sfs_init(void *userdata,struct fuse_conn_info *conn) {
 	// Setup connection
 	conn->async_read=0;
 	conn->want=0;
-	return 0;
+	// Start the watcher now, since its thread would not survive the fork done when the program becomes a daemon
+	if (persistent.watch && init_watcher(persistent.mirror_fd,mirror_changed)!=0) fprintf(stderr,"Can't watch mirror folder: %s\n",persistent.mirror);
+	if (persistent.prefetch>0 && init_prefetch(persistent.prefetch)!=0) {
+		fprintf(stderr,"Can't execute scripts in advance without the output cache\n");
+		persistent.prefetch=0;
+	}
 }
 
 /**
  * \brief Unmount the filesystem
  *
  * This function is called when the filesystem is unmounted. It releases all allocated memory.
- * \param private_data Private data initialized and returned by function sfs_init
+ * \param userdata User data given to fuse_lowlevel_new, not used
  */
-void sfs_destroy(void *private_data) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_destroy\n");
-#endif
+void sfs_destroy(void *userdata) {
+	free_prefetch();
+	free_watcher();
+	free_watchdog();
 }
 
 /**
- * \brief Get the attributes of a file on the virtual filesystem
+ * \brief Find a file in a folder of the virtual file system
  *
- * This function loads the attributes of a chosen file and stores it in the stbuf variable. It is used if no file handle is provided through a fuse_file_info structure.
- * \param path Virtual path of the file on the remote file system
- * \param stbuf Structure in which the attributes will be stored
- * \return Error code, 0 if everything went fine
+ * This function resolves one component of a path. The name is looked up in the folder with the O_PATH descriptor of its inode, so the path of the folder is never resolved again.
+ * \param req FUSE request
+ * \param parent FUSE inode number of the folder
+ * \param name Name of the file in the folder
  */
-int sfs_getattr(const char *path,struct stat *stbuf) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_getattr(%s)\n",path);
-#endif
-	char *relative=relative_path(path);
-	int code=fstatat(persistent.mirror_fd,relative,stbuf,AT_SYMLINK_NOFOLLOW);
-	if (code==0 && S_ISREG(stbuf->st_mode) && (stbuf->st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))!=0 && get_script(persistent.procs,relative)!=0) stbuf->st_mode&= (~(S_IWUSR | S_IWGRP | S_IWOTH));   // If the file is a script, remove write access to everyone (for now we don't handle writing on scripts)
-	free(relative);
-	return (code==0)?0:-errno;
+void sfs_lookup(fuse_req_t req,fuse_ino_t parent,const char *name) {
+	if (parent==FUSE_ROOT_ID && strcmp(name,VIRTUAL_FOLDER)==0) {reply_virtual_entry(req,virtual_folder_id());return;}
+	if (parent==virtual_folder_id()) {	// Find the virtual file
+		const VirtualFile *file;
+		for (file=virtual_files;file->name!=0 && strcmp(file->name,name)!=0;++file);
+		if (file->name!=0) reply_virtual_entry(req,(fuse_ino_t)(uintptr_t)file); else fuse_reply_err(req,ENOENT);
+		return;
+	}
+	if (is_virtual(parent)) {fuse_reply_err(req,ENOTDIR);return;}
+	reply_entry(req,node(parent),name);
+}
+
+/**
+ * \brief Forget lookups of an inode
+ *
+ * The kernel calls this function when it removes an inode from its cache. The inode is released when all its lookups are forgotten.
+ * \param req FUSE request
+ * \param ino FUSE inode number
+ * \param nlookup Number of lookups to forget
+ */
+void sfs_forget(fuse_req_t req,fuse_ino_t ino,unsigned long nlookup) {
+	if (!is_virtual(ino)) inode_forget(node(ino),nlookup);
+	fuse_reply_none(req);
+}
+
+/**
+ * \brief Forget lookups of several inodes
+ *
+ * \param req FUSE request
+ * \param count Number of inodes
+ * \param forgets Array of inode numbers and numbers of lookups to forget
+ */
+void sfs_forget_multi(fuse_req_t req,size_t count,struct fuse_forget_data *forgets) {
+	size_t i;
+	for (i=0;i<count;++i) if (!is_virtual(forgets[i].ino)) inode_forget(node(forgets[i].ino),forgets[i].nlookup);
+	fuse_reply_none(req);
 }
 
 /**
  * \brief Get the attributes of a file on the virtual filesystem
  *
- * This function loads the attributes of a chosen file and stores it in the stbuf variable. It is used if a file handle is provided through a fuse_file_info structure.
- * \param path Virtual path of the file on the remote file system, not used because the file handle is available
- * \param stbuf Structure in which the attributes will be stored
- * \param fi FUSE file information structure, holding the handle to the mirror file
- * \return Error code, 0 if everything went fine
+ * This function loads the attributes of a chosen file from the O_PATH descriptor of its inode. If the file is a script, write access is removed. In page cache mode, the size of a script is the size of its output if it is found in the output cache, the script is never executed only to know its size.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file
+ * \param fi Not used
  */
-int sfs_fgetattr(const char *path,struct stat *stbuf,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_fgetattr(%p)\n",(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
-	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	int code=fstatat(persistent.mirror_fd,fs->filename,stbuf,0);
-	if (code==0 && S_ISREG(stbuf->st_mode) && (stbuf->st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))!=0 && fs->type==T_SCRIPT) stbuf->st_mode&= (~(S_IWUSR | S_IWGRP | S_IWOTH));	// If the file is a script, remove write access to everyone (for now we don't handle writing on scripts)
-	return (code==0)?0:-errno;
+void sfs_getattr(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi) {
+	struct stat st;
+	if (is_virtual(ino)) {
+		virtual_attr(ino,&st);
+		fuse_reply_attr(req,&st,options.attr_timeout);
+		return;
+	}
+	Inode *inode=node(ino);
+	if (fstatat(inode->fd,"",&st,AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW)!=0) {fuse_reply_err(req,errno);return;}
+	node_attr(inode,&st);
+	fuse_reply_attr(req,&st,options.attr_timeout);
+}
+
+/**
+ * \brief Change the attributes of a file on the virtual file system
+ *
+ * This function changes the permissions, the size and the access and modification times of a file. Write access can not be given to a script, and scripts can neither be truncated nor have their times changed, because for the moment writing on scripts is disabled. Changing the owner of a file is not supported.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file
+ * \param attr New attributes of the file
+ * \param to_set Binary OR of the FUSE_SET_ATTR_* values telling which attributes are changed
+ * \param fi FUSE file information structure, holding the handle to the mirror file if the file is open, null otherwise
+ */
+void sfs_setattr(fuse_req_t req,fuse_ino_t ino,struct stat *attr,int to_set,struct fuse_file_info *fi) {
+	if (is_virtual(ino)) {fuse_reply_err(req,EPERM);return;}	// The virtual files can not be changed
+	Inode *inode=node(ino);
+	FileStruct *fs=(fi!=0 && fi->fh!=0)?(FileStruct*)(long)(fi->fh):0;
+	char path[NODE_PATH_LENGTH];
+	node_path(inode,path);
+	struct stat st;
+	if (fstatat(inode->fd,"",&st,AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW)!=0) {fuse_reply_err(req,errno);return;}
+	int script=(fs!=0)?(fs->type==T_SCRIPT):(S_ISREG(st.st_mode) && node_script(inode,&st,0)!=0);
+	if ((to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))!=0) {fuse_reply_err(req,ENOSYS);return;}
+	if ((to_set & FUSE_SET_ATTR_MODE)!=0) {
+		mode_t mode=attr->st_mode;
+		if (script) mode&= (~(S_IWUSR | S_IWGRP | S_IWOTH));	// If the file is a script, remove write access to the requested permissions
+		if (fchmodat(AT_FDCWD,path,mode,0)!=0) {fuse_reply_err(req,errno);return;}
+	}
+	if ((to_set & FUSE_SET_ATTR_SIZE)!=0) {
+		if (script) {fuse_reply_err(req,EACCES);return;}	// Writing on a script is forbidden
+		int code=(fs!=0 && fs->type==T_FILE)?ftruncate(fs->file_handle,attr->st_size):truncate(path,attr->st_size);
+		if (code!=0) {fuse_reply_err(req,errno);return;}
+	}
+	if ((to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))!=0) {
+		if (script) {fuse_reply_err(req,EACCES);return;}	// Writing on a script is forbidden
+		struct timespec ts[2];
+		ts[0].tv_sec=ts[1].tv_sec=0;
+		ts[0].tv_nsec=ts[1].tv_nsec=UTIME_OMIT;
+		if ((to_set & FUSE_SET_ATTR_ATIME_NOW)!=0) ts[0].tv_nsec=UTIME_NOW; else if ((to_set & FUSE_SET_ATTR_ATIME)!=0) ts[0]=attr->st_atim;
+		if ((to_set & FUSE_SET_ATTR_MTIME_NOW)!=0) ts[1].tv_nsec=UTIME_NOW; else if ((to_set & FUSE_SET_ATTR_MTIME)!=0) ts[1]=attr->st_mtim;
+		if (utimensat(AT_FDCWD,path,ts,0)!=0) {fuse_reply_err(req,errno);return;}
+	}
+	sfs_getattr(req,ino,fi);
 }
 
 /**
  * \brief Check if a file can be accessed to with the given rights
  *
- * This function checks if the file at the path address (virtual path) can be accessed to. It returns 0 if the file exists and the user is authorized to access to it, and another value otherwise.
- * \param path Virtual path of the file
+ * This function checks if the file can be accessed to. Write access is refused on scripts, because for the moment we don't handle writing on scripts.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file
  * \param mask Required permissions mask (binary OR of values like R_OK, W_OK, X_OK)
- * \return 0 if the file can be opened, another value otherwise
- */
-int sfs_access(const char *path,int mask) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_access(%s,%o)\n",path,mask);
-#endif
-	char *relative=relative_path(path);
-	int code=faccessat(persistent.mirror_fd,relative,mask,0);
-	if (code==0 && (mask & W_OK)!=0) {	// If write-acess is requested, check if the file is a regular file and not a script, because for the moment we don't handle writing on scripts
-		struct stat stbuf;
-		int code2=fstatat(persistent.mirror_fd,relative,&stbuf,0);
-		if (code2!=0) {free(relative);return -code2;}	// Normally, that should not happen
-		if (S_ISREG(stbuf.st_mode) && get_script(persistent.procs,relative)!=0) {free(relative);return -1;}
+ */
+void sfs_access(fuse_req_t req,fuse_ino_t ino,int mask) {
+	if (is_virtual(ino)) {fuse_reply_err(req,((mask & W_OK)!=0 || ((mask & X_OK)!=0 && ino!=virtual_folder_id()))?EACCES:0);return;}
+	Inode *inode=node(ino);
+	char path[NODE_PATH_LENGTH];
+	node_path(inode,path);
+	if (faccessat(AT_FDCWD,path,mask,0)!=0) {fuse_reply_err(req,errno);return;}
+	if ((mask & W_OK)!=0) {	// If write-acess is requested, check if the file is a regular file and not a script
+		struct stat st;
+		if (fstatat(inode->fd,"",&st,AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW)!=0) {fuse_reply_err(req,errno);return;}
+		if (S_ISREG(st.st_mode) && node_script(inode,&st,0)!=0) {fuse_reply_err(req,EACCES);return;}
 	}
-	free(relative);
-	return (code==0)?0:-errno;
+	fuse_reply_err(req,0);
 }
 
 /**
  * \brief Return the target of a symbolic link
  *
- * This function reads the symbolic link which path is given as parameter and stores the target path in the buf string. The size of the buffer must be saved in the size variable (including the null character at the end of the string, and contrary to the system's readlink function). If the link target is too long, the function should truncate it. The function returns 0 if everything went fine and an error code otherwise.
  * As the file system is programmed, the mounted folder can hold symbolic links to any other file, being or not on the filesystem. Using relative links in symbolic links targets can ensure the symbolic link is still on the virtual file system and the target is read using the ScriptFS operations.
- * \param path Virtual path of the file
- * \param buf Buffer that will hold the target of the symbolic link. It should be allocated before the call to the function
- * \param size Size of buffer. If the target path (including the null character) is longer than this size, then it will be truncated (and unusable)
- * \return 0 if everything went fine, another value otherwise
- */
-int sfs_readlink(const char *path,char *buf,size_t size) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_readlink(%s,%p,%zi)\n",path,(void*)buf,size);
-#endif
-	char *relative=relative_path(path);
-	ssize_t length=readlinkat(persistent.mirror_fd,relative,buf,size-1);
-	free(relative);
-	if (length<0) return -errno;
+ * \param req FUSE request
+ * \param ino FUSE inode number of the symbolic link
+ */
+void sfs_readlink(fuse_req_t req,fuse_ino_t ino) {
+	if (is_virtual(ino)) {fuse_reply_err(req,EINVAL);return;}
+	char buf[PATH_MAX+1];
+	ssize_t length=readlinkat(node(ino)->fd,"",buf,PATH_MAX);
+	if (length<0) {fuse_reply_err(req,errno);return;}
 	buf[length]=0;
-	return 0;
+	fuse_reply_readlink(req,buf);
 }
 
 /**
  * \brief Open a directory for reading
  *
  * The function opens the directory to read its content. It actually looks if the opening is permitted, and stores a handle of the directory in the fi struct.
- * \param path Virtual path of the directory
+ * \param req FUSE request
+ * \param ino FUSE inode number of the directory
  * \param fi FUSE information on the directory, which contains the file handle, filled in by the function
- * \return 0 if everything went fine, another value otherwise
- */
-int sfs_opendir(const char *path,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_opendir(%s,%p)\n",path,(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	char *relative=relative_path(path);
-	int fd=openat(persistent.mirror_fd,relative,O_RDONLY);
-	if (fd<0) {free(relative);return -errno;}
-	DIR* handle=fdopendir(fd);
-	if (handle==0) {free(relative);return -errno;}
+ */
+void sfs_opendir(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi) {
+	DIR* handle=0;	// The virtual folder has no directory flow
+	if (virtual_file(ino)!=0) {fuse_reply_err(req,ENOTDIR);return;}
+	if (ino!=virtual_folder_id()) {
+		int fd=openat(node(ino)->fd,".",O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd<0) {fuse_reply_err(req,errno);return;}
+		handle=fdopendir(fd);
+		if (handle==0) {close(fd);fuse_reply_err(req,errno);return;}
+	}
 	FileStruct *fs=(FileStruct*)malloc(sizeof(FileStruct));
 	fs->type=T_FOLDER;
+	fs->file_handle=-1;
+	fs->output=0;
 	fs->dir_handle=(void*)handle;
-	strncpy(fs->filename,relative,FILENAME_MAX_LENGTH-1);
-	fs->filename[FILENAME_MAX_LENGTH-1]=0;
+	fs->dir_position=0;
 	fi->fh=(long)(fs);
-	free(relative);
-	return 0;
+	if (fuse_reply_open(req,fi)!=0) {
+		if (handle!=0) closedir(handle);
+		free(fs);
+	}
 }
 
 /**
  * \brief Read the content of a directory
  *
- * This function returns all directory entries to the caller. It is one of the main functions of the filesystem.
- * \param path Virtual path of the directory
- * \param buf Name of a file in the directory
- * \param filler Filler function provided by the FUSE system
- * \param offset Offset of the next directory entry, in the case files are provided one by one
+ * This function returns the directory entries to the caller, as many as fit in the requested size. The offset of each entry is the position of the directory flow after it, as returned by telldir, so that the next call resumes at the first entry which did not fit. If the readdir_plus option is set, the files are classified while the directory is read. With FUSE 2.9, an entry only gives the kernel the inode number and the type of the file, so the classification does not change what the kernel sees of the entries: it only pre-fills the verdict cache, where the lookups and getattr requests of the listed files, which <tt>ls -l</tt> sends just after, find the verdicts. The files are also classified if the prefetch option is set, and the scripts found are queued to be executed in advance.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the directory
+ * \param size Maximum number of bytes of entries to return
+ * \param offset Offset of the next directory entry, as given with the last entry returned, or 0 to start from the beginning
  * \param fi File information structure
- * \return 0 if there are no more files or if the filler function returned a non-null value, another value otherwise
  */
-int sfs_readdir(const char *path,void *buf,fuse_fill_dir_t filler,off_t offset,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_readdir(%s,%p)\n",path,(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
+void sfs_readdir(fuse_req_t req,fuse_ino_t ino,size_t size,off_t offset,struct fuse_file_info *fi) {
+	if (fi==0 || fi->fh==0) {fuse_reply_err(req,EBADF);return;}
 	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type!=T_FOLDER) return -ENOTDIR;
+	if (fs->type!=T_FOLDER) {fuse_reply_err(req,ENOTDIR);return;}
 	DIR *handle=(DIR*)(fs->dir_handle);
+	if (handle==0) {virtual_readdir(req,size,offset);return;}
+	if (offset!=fs->dir_position) {	// The kernel does not continue where the last call stopped
+		if (offset==0) rewinddir(handle); else seekdir(handle,offset);
+	}
+	char *buf=(char*)malloc(size);
+	if (buf==0) {fuse_reply_err(req,ENOMEM);return;}
+	size_t used=0;
+	off_t position=offset;
 	struct dirent* entry;
-	do {
+	struct stat st;
+	for (;;) {
 		errno=0;
 		entry=readdir(handle);
-		if (entry==0) return -errno;
-		filler(buf,entry->d_name,0,0);
-	} while (entry!=0);
-	return 0;
+		if (entry==0) break;
+		memset(&st,0,sizeof(st));
+		st.st_ino=entry->d_ino;
+		st.st_mode=DTTOIF(entry->d_type);
+		if ((persistent.readdir_plus || persistent.prefetch>0) && strcmp(entry->d_name,".")!=0 && strcmp(entry->d_name,"..")!=0 && fstatat(dirfd(handle),entry->d_name,&st,AT_SYMLINK_NOFOLLOW)==0 && S_ISREG(st.st_mode)) {
+			char *relative=inode_path(node(ino),entry->d_name);
+			Procedure *proc=get_script_stat(persistent.procs,relative,&st,0);	// Only fills the verdict cache, fuse_add_direntry does not give the permissions to the kernel
+			if (proc!=0 && persistent.prefetch>0) prefetch_script(proc,relative);
+			free(relative);
+		}
+		off_t next=telldir(handle);
+		size_t length=fuse_add_direntry(req,buf+used,size-used,entry->d_name,&st,next);
+		if (length>size-used) {	// The entry does not fit, it will be the first one of the next call
+			seekdir(handle,position);
+			break;
+		}
+		used+=length;
+		position=next;
+	}
+	fs->dir_position=position;
+	if (entry==0 && errno!=0 && used==0) fuse_reply_err(req,errno); else fuse_reply_buf(req,buf,used);
+	free(buf);
 }
 
 /**
  * \brief Release a directory structure
  *
- * This function is called when the user does not need to read a directory any longer. It is the equivalent of the release function for directories. The function releases the directory handle and frees all memory allocated to store the directoy element. 
- * \param path Directory which will be released, this variable is not used
+ * This function is called when the user does not need to read a directory any longer. It is the equivalent of the release function for directories. The function releases the directory handle and frees all memory allocated to store the directoy element.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the directory
  * \param fi FUSE information on the directory
- * \return Error code, or 0 if everything went fine
  */
-int sfs_releasedir(const char *path,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_releasedir(%s,%p)\n",path,(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
+void sfs_releasedir(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi) {
+	if (fi==0 || fi->fh==0) {fuse_reply_err(req,EBADF);return;}
 	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type!=T_FOLDER) return -ENOTDIR;
+	if (fs->type!=T_FOLDER) {fuse_reply_err(req,ENOTDIR);return;}
 	DIR *handle=(DIR*)(fs->dir_handle);
 	free(fs);
-	int code=closedir(handle);
-	return (code==0)?0:-errno;
+	int code=(handle!=0)?closedir(handle):0;
+	fuse_reply_err(req,(code==0)?0:errno);
 }
 
 /**
  * \brief Make a new directory
  *
  * This function creates a new empty directory in the virtual file system.
- * \param path Virtual path of the new directory
+ * \param req FUSE request
+ * \param parent FUSE inode number of the parent directory
+ * \param name Name of the new directory
  * \param mode Directory permissions
- * \return Error code, or 0 if everything went fine
- */
-int sfs_mkdir(const char *path,mode_t mode) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_mkdir(%s,%X)\n",path,mode);
-#endif
-	char *relative=relative_path(path);
-	int code=mkdirat(persistent.mirror_fd,relative,mode);
-	free(relative);
-	return (code==0)?0:-errno;
+ */
+void sfs_mkdir(fuse_req_t req,fuse_ino_t parent,const char *name,mode_t mode) {
+	if (is_virtual(parent)) {fuse_reply_err(req,EPERM);return;}
+	if (mkdirat(node(parent)->fd,name,mode)!=0) {fuse_reply_err(req,errno);return;}
+	reply_entry(req,node(parent),name);
 }
 
 /**
  * \brief Remove a directory
  *
  * This function remove a directory in the virtual file system. This is basically the same as removing the directory in the mirror file system.
- * \param path Virtual path of the directory
- * \return Error code, 0 if everything went fine
+ * \param req FUSE request
+ * \param parent FUSE inode number of the parent directory
+ * \param name Name of the directory
  */
-int sfs_rmdir(const char *path) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_rmdir(%s)\n",path);
-#endif
-	char *relative=relative_path(path);
-	int code=unlinkat(persistent.mirror_fd,relative,AT_REMOVEDIR);
-	free(relative);
-	return (code==0)?0:-errno;
+void sfs_rmdir(fuse_req_t req,fuse_ino_t parent,const char *name) {
+	if (is_virtual(parent)) {fuse_reply_err(req,EPERM);return;}
+	int code=unlinkat(node(parent)->fd,name,AT_REMOVEDIR);
+	fuse_reply_err(req,(code==0)?0:errno);
 }
 
 /**
  * \brief Make a symbolic link in the virtual file system
  *
  * This function creates a new symbolic link which targets to another file.
- * \param to Path to the target of the symbolic link
- * \param from Name of the symbolic link
- * \return Error code, 0 if everything went fine
+ * \param req FUSE request
+ * \param link Target of the symbolic link
+ * \param parent FUSE inode number of the directory of the symbolic link
+ * \param name Name of the symbolic link
  */
-int sfs_symlink(const char* to,const char *from) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_symlink(%s,%s)\n",to,from);
-#endif
-	char *relative=relative_path(to);
-	int code=symlinkat(from,persistent.mirror_fd,relative);
-	free(relative);
-	return (code==0)?0:-errno;
+void sfs_symlink(fuse_req_t req,const char *link,fuse_ino_t parent,const char *name) {
+	if (is_virtual(parent)) {fuse_reply_err(req,EPERM);return;}
+	if (symlinkat(link,node(parent)->fd,name)!=0) {fuse_reply_err(req,errno);return;}
+	reply_entry(req,node(parent),name);
 }
 
 /**
  * \brief Remove a file from the virtual file system
  *
  * This function unlinks (removes) a file from the virtual file system. This is the same as removing the file from the mirror file system.
- * \param path Path of the file in the virtual file system
- * \return Error code, or 0 if everything went fine
- */
-int sfs_unlink(const char *path) {
-#ifdef  TRACE
-	fprintf(stderr,"sfs_unlink(%s)\n",path);
-#endif
-	char *relative=relative_path(path);
-	int code=unlinkat(persistent.mirror_fd,relative,0);
-	free(relative);
-	return (code==0)?0:-errno;
+ * \param req FUSE request
+ * \param parent FUSE inode number of the parent directory
+ * \param name Name of the file
+ */
+void sfs_unlink(fuse_req_t req,fuse_ino_t parent,const char *name) {
+	if (is_virtual(parent)) {fuse_reply_err(req,EPERM);return;}
+	int code=unlinkat(node(parent)->fd,name,0);
+	fuse_reply_err(req,(code==0)?0:errno);
 }
 
 /**
  * \brief Create a new hard link on the virtual file system
  *
  * This function creates a hard link on the virtual file system. This is the same as creating the hard link on the mirror file system. Hard links are interesting because they can "extend" the file system by referring to files out of it. Those target files, if they are scripts, can be executed by the file system.
- * \param to Path to the target of the hard link
- * \param from Name of the hard link
- * \return Error code, or 0 if everything went fine
+ * \param req FUSE request
+ * \param ino FUSE inode number of the target of the hard link
+ * \param newparent FUSE inode number of the directory of the hard link
+ * \param newname Name of the hard link
  */
-int sfs_link(const char* from,const char *to) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_symlink(%s,%s)\n",from,to);
-#endif
-	char *relative_from=relative_path(from);
-	char *relative_to=relative_path(to);
-	int code=linkat(persistent.mirror_fd,relative_from,persistent.mirror_fd,relative_to,0);
-	free(relative_from);
-	free(relative_to);
-	return (code==0)?0:-errno;
+void sfs_link(fuse_req_t req,fuse_ino_t ino,fuse_ino_t newparent,const char *newname) {
+	if (is_virtual(ino) || is_virtual(newparent)) {fuse_reply_err(req,EPERM);return;}
+	char path[NODE_PATH_LENGTH];
+	node_path(node(ino),path);
+	if (linkat(AT_FDCWD,path,node(newparent)->fd,newname,AT_SYMLINK_FOLLOW)!=0) {fuse_reply_err(req,errno);return;}
+	reply_entry(req,node(newparent),newname);
 }
 
 /**
  * \brief Rename a file or a directory in the virtual file system
  *
- * This function changes the name of a file or a directory in the virtual file system. This is the same as changing the name in the mirror file system.
- * \param from Path of the source file in the virtual file system
- * \param to Path of the destination in the virtual file system
- * \return Error code, or 0 if everything went fine
- */
-int sfs_rename(const char *from,const char *to) {
-#ifdef  TRACE
-	fprintf(stderr,"sfs_rename(%s,%s)\n",from,to);
-#endif
-	char *relative_from=relative_path(from);
-	char *relative_to=relative_path(to);
-	int code=renameat(persistent.mirror_fd,relative_from,persistent.mirror_fd,relative_to);
-	free(relative_from);
-	free(relative_to);
-	return (code==0)?0:-errno;
-}
-
-/**
- * \brief Change permissions of a file in the virtual file system
- *
- * This function changes the permissions (read, write, execute) of a file in the virtual file system.
- * \param path Virtual path of the file
- * \param mode New permissions of the file, which will replace the old ones
- * \return Error code, or 0 if everything went fine
- */
-int sfs_chmod(const char *path,mode_t mode) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_chmod(%s,%X)\n",path,mode);
-#endif
-	char *relative=relative_path(path);
-	struct stat stbuf;
-	int code=fstatat(persistent.mirror_fd,relative,&stbuf,0);
-	if (code==0 && S_ISREG(stbuf.st_mode) && (mode & (S_IWUSR | S_IWGRP | S_IWOTH))!=0 && get_script(persistent.procs,relative)!=0) mode&= (~(S_IWUSR | S_IWGRP | S_IWOTH));	// If the file is a script, remove write access to the requested permissions
-	code=fchmodat(persistent.mirror_fd,relative,mode,0);
-	free(relative);
-	return (code==0)?0:-errno;
-}
-
-/**
- * \brief Truncate a file in a virtual file system so that it has the desired size
- *
- * This function truncates a file in the virtual file system to the desired size given as a parameter. It also checks if the file is not a script to determine if it can be truncated, because for the moment writing on scripts is disabled.
- * \param path Virtual path of the file
- * \param size Final size of the file
- * \return Error code, or 0 if everything went fine
- */
-int sfs_truncate(const char *path,off_t size) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_truncate(%s,%li)\n",path,(long)size);
-#endif
-	char *relative=relative_path(path);
-	struct stat stbuf;
-	int code=fstatat(persistent.mirror_fd,relative,&stbuf,0);
-	if (code==0 && S_ISREG(stbuf.st_mode) && get_script(persistent.procs,relative)!=0) {free(relative);return -EACCES;}	// Writing on a script is forbidden
-	int fd=openat(persistent.mirror_fd,relative,O_WRONLY);
-	free(relative);
-	if (fd<0) return -errno;
-	code=ftruncate(fd,size);
-	close(fd);
-	return (code==0)?0:-errno;
-}
-
-/**
- * \brief Truncate a file in a virtual file system so that it has the desired size
- *
- * This function truncates a file in the virtual file system to the desired size given as a parameter. It is the same as the above one except that it makes use of the file handle from the fi structure instead of the path name.
- * \param path Virtual path of the file, unused because the file handle is available
- * \param size Final size of the file
- * \param fi FUSE file information structure, holding the handle to the mirror file
- * \return Error code, or 0 if everything went fine
+ * This function changes the name of a file or a directory in the virtual file system. This is the same as changing the name in the mirror file system. The inode of the file takes its new name.
+ * \param req FUSE request
+ * \param parent FUSE inode number of the source directory
+ * \param name Name of the file in the source directory
+ * \param newparent FUSE inode number of the destination directory
+ * \param newname Name of the file in the destination directory
  */
-int sfs_ftruncate(const char *path,off_t size,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_ftruncate(%li,%p)\n",(long)size,(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
-	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type==T_FOLDER) return -EISDIR;
-	if (fs->type==T_SCRIPT) return -EACCES;	// Writing on a script is forbidden
-	int code=ftruncate(fs->file_handle,size);
-	return (code==0)?0:-errno;
+void sfs_rename(fuse_req_t req,fuse_ino_t parent,const char *name,fuse_ino_t newparent,const char *newname) {
+	if (is_virtual(parent) || is_virtual(newparent)) {fuse_reply_err(req,EPERM);return;}
+	if (renameat(node(parent)->fd,name,node(newparent)->fd,newname)!=0) {fuse_reply_err(req,errno);return;}
+	inode_moved(node(newparent),newname);
+	fuse_reply_err(req,0);
 }
 
-/**
- * \brief Update the last access and last modification times of a file on the virtual file system
- *
- * This function updates the last access time from the first element of the array in parameter, and the last modification time from the second element of the same array. It only transfers the order to the mirror file system.
- * \param path Virtual path of the file
- * \param ts Array of two elements holding the two time structures of the last access and last modification time which the file will have after the execution
- * \return Error code, or 0 if everything went fine
- */
-int sfs_utimens(const char *path,const struct timespec ts[2]) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_utimens(%s)\n",path);
-#endif
-	char *relative=relative_path(path);
-	struct stat stbuf;
-	int code=fstatat(persistent.mirror_fd,relative,&stbuf,0);
-	if (code==0 && S_ISREG(stbuf.st_mode) && get_script(persistent.procs,relative)!=0) {free(relative);return -EACCES;}	// Writing on a script is forbidden
-	code=utimensat(persistent.mirror_fd,relative,ts,0);
-	free(relative);
-	return (code==0)?0:-errno;
-}
- 
 /**
  * \brief Retrieve statistics about the file system
  *
  * This function retrieves statistics about the whole virtual file system. Since it is hosted on a mirror file system, the statistics should be the same as the latter.
- * \param path Virtual path of any file on the virtual file system, ignored
- * \param stbuf Record holding the statistics about the virtual file system after the execution of the function
- * \return Error code, or 0 if everything went fine
+ * \param req FUSE request
+ * \param ino FUSE inode number of any file on the virtual file system, ignored
  */
-int sfs_statfs(const char *path,struct statvfs *stbuf) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_statfs(%s)\n",path);
-#endif
-	int code=statvfs("/",stbuf);
-	return (code==0)?0:-errno;
+void sfs_statfs(fuse_req_t req,fuse_ino_t ino) {
+	struct statvfs stbuf;
+	if (fstatvfs(persistent.mirror_fd,&stbuf)!=0) {fuse_reply_err(req,errno);return;}
+	fuse_reply_statfs(req,&stbuf);
 }
 
 /**
  * \brief Open a file in the virtual file system
  *
- * This function opens a file in the virtual file system. If the file is not a script file, this is the same as opening it on the mirror file system and saving its handle in the file info structure fi. If the file is a script file, the function executes the script, saves its content on a temporary file, and opens the latter for reading. The temporary file is unlinked immediatly so that the user does not have to worry about erasing it when it is closed. The function also checks if the open mode (in the fi->flags variable) are allowed for this file.
- * \param path Virtual path of the file
+ * This function opens a file in the virtual file system. If the file is not a script file, this is the same as opening it on the mirror file system and saving its handle in the file info structure fi. If the file is a script file, the function executes the script and captures its output in an Output structure, kept in memory unless it grows beyond the spill threshold. In streaming mode, the function returns as soon as the program is started and the reads wait for its output. In page cache mode, an output found in the output cache is read by the kernel through its page cache, which is kept from the previous opening if the size of that output was already reported. An output produced by a new execution is read without the page cache, since its size may differ from the one given by getattr. The function also checks if the open mode (in the fi->flags variable) are allowed for this file.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file
  * \param fi File information structure, filled by the function with the handle of the mirror file
- * \return Error code, or 0 if everything went fine
- */
-int sfs_open(const char *path,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_open(%s)\n",path);
-#endif
-	int handle=0;
-	int typ=0;
-	char *relative=relative_path(path);
-	Procedure *proc=get_script(persistent.procs,relative);
+ */
+void sfs_open(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi) {
+	if (ino==virtual_folder_id()) {fuse_reply_err(req,EISDIR);return;}
+	if (virtual_file(ino)!=0) {virtual_open(req,virtual_file(ino),fi);return;}
+	Inode *inode=node(ino);
+	int handle=-1;
+	Output *output=0;
+	struct stat st;
+	if (fstatat(inode->fd,"",&st,AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW)!=0) {fuse_reply_err(req,errno);return;}
+	off_t size;
+	Procedure *proc=S_ISREG(st.st_mode)?node_script(inode,&st,&size):0;
 	if (proc!=0) {	// If the file is a script, the interpretor is executed to produce the result of the script
-		if ((fi->flags & O_WRONLY)!=0 || (fi->flags & O_RDWR)!=0) {free(relative);return -EACCES;} 	// If the caller requests to open the file in one of the write modes, immediatly abort the opening
-		char temp_filename[]="/tmp/sfs.XXXXXX";
-		handle=mkstemp(temp_filename);
-		if (handle<=0) {free(relative);return -errno;}
-		unlink(temp_filename);
-		proc->program->func(proc->program,relative,handle);
-		typ=1;
-		fi->direct_io=1;	// Force use of FUSE read on this file and do not take into account size given by the stat function
+		if ((fi->flags & O_WRONLY)!=0 || (fi->flags & O_RDWR)!=0) {fuse_reply_err(req,EACCES);return;} 	// If the caller requests to open the file in one of the write modes, immediatly abort the opening
+		char *relative=inode_path(inode,0);
+		if (persistent.page_cache) {	// The kernel reads the output through its page cache, using the size given by getattr
+			int hit;
+			output=script_output(proc,relative,&st,1,&hit);
+			if (output==0) {fuse_reply_err(req,errno);free(relative);return;}
+			if (hit) {
+				inode_set_output_size(inode,&st,output->size);
+				fi->direct_io=0;
+				fi->keep_cache=(size>=0 && size==output->size);	// The pages of the previous opening are only valid if they hold the same cached output
+			} else fi->direct_io=1;	// The size reported by getattr is not the one of this output, and the pages of the previous opening are dropped, since a script executed again may write different bytes of the same length
+		} else {
+			output=script_output(proc,relative,&st,0,0);
+			if (output==0) {fuse_reply_err(req,errno);free(relative);return;}
+			fi->direct_io=1;	// Force use of FUSE read on this file and do not take into account size given by the stat function
+		}
+		free(relative);
 	} else {
-		handle=openat(persistent.mirror_fd,relative,fi->flags);
-		if (handle<=0) {free(relative);return -errno;}
-		typ=2;
+		char path[NODE_PATH_LENGTH];
+		node_path(inode,path);
+		handle=open(path,(fi->flags & ~O_NOFOLLOW) | O_CLOEXEC);
+		if (handle<0) {fuse_reply_err(req,errno);return;}
 		fi->direct_io=0;	// Authorize direct translation of FUSE IO calls to system calls
 	}
 	FileStruct *fs=(FileStruct*)malloc(sizeof(FileStruct));
-	fs->type=(typ==1)?T_SCRIPT:T_FILE;
+	fs->type=(proc!=0)?T_SCRIPT:T_FILE;
 	fs->file_handle=handle;
-	strncpy(fs->filename,relative,FILENAME_MAX_LENGTH-1);
-	fs->filename[FILENAME_MAX_LENGTH-1]=0;
+	fs->output=output;
+	fs->dir_handle=0;
+	fs->dir_position=0;
 	fi->fh=(long)fs;
-	free(relative);
-	return 0;
+	if (fuse_reply_open(req,fi)!=0) {	// The kernel did not get the file handle
+		if (output!=0) output_unref(output);
+		if (handle>=0) close(handle);
+		free(fs);
+	}
 }
 
 /**
  * \brief Read content from a file on the virtual file system
  *
- * This function reads the chosen number of bytes from the file which handle is stored in the fi structure. The file must already be opened (otherwise there is no handle in fi). The reading starts at the position offset in the file. The function returns the actual number of bytes read or 0 if the offset was at or beyond the end of the file. 
- * \param path Virtual path of the file, not used because the file handle is stored in fi
- * \param buf Buffer in which the content read will be stored, must be allocated before the call to the function
+ * This function reads the chosen number of bytes from the file which handle is stored in the fi structure. The file must already be opened (otherwise there is no handle in fi). The reading starts at the position offset in the file. The function returns the bytes read, possibly none if the offset was at or beyond the end of the file.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file, not used because the file handle is stored in fi
  * \param size Number of bytes the caller wants to read
  * \param offset Starting position of the reading
  * \param fi FUSE file information structure, holding the handle to the mirror file
- * \return Actual number of bytes read, or a negative error code if something wrong occurred
  */
-int sfs_read(const char *path,char *buf,size_t size,off_t offset,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_read(%zi,%li,%p)\n",size,(long)offset,(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
+void sfs_read(fuse_req_t req,fuse_ino_t ino,size_t size,off_t offset,struct fuse_file_info *fi) {
+	if (fi==0 || fi->fh==0) {fuse_reply_err(req,EBADF);return;}
 	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type==T_FOLDER) return -EISDIR;
-	off_t res=lseek(fs->file_handle,offset,SEEK_SET);
-	if (res<0) return -errno;
-	ssize_t num=read(fs->file_handle,buf,size);
-	if (num>=0) return num; else return -errno;
+	if (fs->type==T_FOLDER) {fuse_reply_err(req,EISDIR);return;}
+	char *buf=(char*)malloc(size);
+	if (buf==0) {fuse_reply_err(req,ENOMEM);return;}
+	ssize_t num;
+	if (fs->type==T_SCRIPT) num=output_read(fs->output,buf,size,offset);
+	else {
+		num=pread(fs->file_handle,buf,size,offset);
+		if (num<0) num=-errno;
+	}
+	if (num>=0) {
+		stats_served(fs->type==T_SCRIPT,num);
+		fuse_reply_buf(req,buf,num);
+	} else fuse_reply_err(req,-num);
+	free(buf);
 }
 
 /**
  * \brief Write content in a file of the virtual file system
  *
- * This function writes a chosen number of bytes from the buffer in parameter to the file which handle is stores in the fi structure. The file must already be opened (otherwise there is no handle in fi). The output starts at the position offset into the file. The function returns the actual number of bytes written or a negative error code.
- * \param path Virtual path of the file, not used because the file handle is stored in fi
+ * This function writes a chosen number of bytes from the buffer in parameter to the file which handle is stores in the fi structure. The file must already be opened (otherwise there is no handle in fi). The output starts at the position offset into the file. The function answers with the actual number of bytes written or an error code.
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file, not used because the file handle is stored in fi
  * \param buf Buffer to write in the file
  * \param size Number of bytes the caller wants to write
  * \param offset Starting position of the output
  * \param fi FUSE file information structure, holding the handle to the mirror file
- * \return Actual number of bytes written, or a negative error code if something wrong occurred
  */
-int sfs_write(const char *path,const char *buf,size_t size,off_t offset,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_write(%*.*s,%zi,%li,%p)\n",size,size,buf,size,(long)offset,(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
+void sfs_write(fuse_req_t req,fuse_ino_t ino,const char *buf,size_t size,off_t offset,struct fuse_file_info *fi) {
+	if (fi==0 || fi->fh==0) {fuse_reply_err(req,EBADF);return;}
 	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type==T_FOLDER) return -EISDIR;
-	off_t res=lseek(fs->file_handle,offset,SEEK_SET);
-	if (res<0) return -errno;
-	ssize_t num=write(fs->file_handle,buf,size);
-	if (num>=0) return num; else return -errno;
+	if (fs->type==T_FOLDER) {fuse_reply_err(req,EISDIR);return;}
+	if (fs->type==T_SCRIPT) {fuse_reply_err(req,EACCES);return;}	// Writing on a script is forbidden
+	ssize_t num=pwrite(fs->file_handle,buf,size,offset);
+	if (num>=0) fuse_reply_write(req,num); else fuse_reply_err(req,errno);
 }
 
 /**
  * \brief Close a file on the virtual file system
  *
- * The function closes an opened file on the virtual file system. It erases the temporary files generated in case the virtual file was a script, releases all the structures allocated (and especially the one holding the handle) and synchronizes the content of the file with that of the mirror file.
- * \param path Virtual path of the file, not used because the file handle is stored in fi
+ * The function closes an opened file on the virtual file system. It releases the output of a script and all the structures allocated (and especially the one holding the handle).
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file, not used because the file handle is stored in fi
  * \param fi FUSE file information structure, holding the handle to the mirror file
- * \return Error code, or 0 if everything went fine, but not used by FUSE
  */
-int sfs_release(const char *path,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_release(%p)\n",(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
+void sfs_release(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi) {
+	if (fi==0 || fi->fh==0) {fuse_reply_err(req,EBADF);return;}
 	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type==T_FOLDER) return -EISDIR;
-	int code=close(fs->file_handle);
+	if (fs->type==T_FOLDER) {fuse_reply_err(req,EISDIR);return;}
+	int code=0;
+	if (fs->type==T_SCRIPT) output_unref(fs->output); else code=close(fs->file_handle);
 	free(fs);
-	return (code==0)?0:-errno;
+	fuse_reply_err(req,(code==0)?0:errno);
 }
 
 /**
  * \brief Flush any information about the file to the disk
  *
  * This function makes sure any information written on the file (on the virtual file system) is stored on the disk. It only calls the fsync method from the mirror file system.
- * \param path Virtual path of the file, not used because the file handle is stored in fi
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file, not used because the file handle is stored in fi
  * \param isdatasync Strange parameter, if not null indicates that only user data should be synchronized and not meta data
  * \param fi FUSE file information structure, holding the handle to the mirror file
- * \return Error code, or 0 if everything went fine, but not used by FUSE
  */
-int sfs_fsync(const char *path,int isdatasync,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_fsync(%p)\n",(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
+void sfs_fsync(fuse_req_t req,fuse_ino_t ino,int isdatasync,struct fuse_file_info *fi) {
+	if (fi==0 || fi->fh==0) {fuse_reply_err(req,EBADF);return;}
 	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type==T_FOLDER) return -EISDIR;
+	if (fs->type==T_FOLDER) {fuse_reply_err(req,EISDIR);return;}
+	if (fs->type==T_SCRIPT) {fuse_reply_err(req,0);return;}
 	int code=fsync(fs->file_handle);
-	return (code==0)?0:-errno;
+	fuse_reply_err(req,(code==0)?0:errno);
 }
 
 /**
  * \brief Flush modifications to a file in the virtual file system.
  *
  * The function is called before each close of a function on the virtual file system. It gives a chance to report delayed errors according to the documentation. This one also says that there can be zero, one, or several flush call for each open.
- * \param path Virtual path of the file, not used because the file handle is stored in fi
+ * \param req FUSE request
+ * \param ino FUSE inode number of the file, not used because the file handle is stored in fi
  * \param fi FUSE file information structure, holding the handle to the mirror file
- * \return Error code, or 0 if everything went fine, but not used by FUSE
  */
-int sfs_flush(const char *path,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_flush(%p)\n",(fi==0)?0:(void*)(long)(fi->fh));
-#endif
-	if (fi==0 || fi->fh==0) return -EBADF;
+void sfs_flush(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi) {
+	if (fi==0 || fi->fh==0) {fuse_reply_err(req,EBADF);return;}
 	FileStruct *fs=(FileStruct*)(long)(fi->fh);
-	if (fs->type==T_FOLDER) return -EISDIR;
-	if (fs->type==T_SCRIPT) return 0;
+	if (fs->type==T_FOLDER) {fuse_reply_err(req,EISDIR);return;}
+	if (fs->type==T_SCRIPT) {fuse_reply_err(req,0);return;}
 	int code=fsync(fs->file_handle);
-	return (code==0)?0:-errno;
+	fuse_reply_err(req,(code==0)?0:errno);
 }
 
 /**
  * \brief Create a new file on the virtual file system
  *
  * This function creates a file and opens it. It only transfers the order to the mirror system that creates the file.
- * \param path Virtual path of the new file
+ * \param req FUSE request
+ * \param parent FUSE inode number of the directory of the new file
+ * \param name Name of the new file
  * \param mode Permissions of the file (read, write, execute)
  * \param fi FUSE file information structure, that will hold the handle to the mirror file
- * \return Error code, or 0 if everything went fine, but not used by FUSE
- */
-int sfs_create(const char *path,mode_t mode,struct fuse_file_info *fi) {
-#ifdef TRACE
-	fprintf(stderr,"sfs_create(%s,%X)\n",path,mode);
-#endif
-	int handle=0;
-	char *relative=relative_path(path);
-	handle=openat(persistent.mirror_fd,relative,O_CREAT | O_WRONLY | O_TRUNC,mode);
-	if (handle<=0) {free(relative);return -errno;}
+ */
+void sfs_create(fuse_req_t req,fuse_ino_t parent,const char *name,mode_t mode,struct fuse_file_info *fi) {
+	if (is_virtual(parent)) {fuse_reply_err(req,EPERM);return;}
+	int handle=openat(node(parent)->fd,name,(fi->flags & ~O_NOFOLLOW) | O_CREAT | O_CLOEXEC,mode);
+	if (handle<0) {fuse_reply_err(req,errno);return;}
+	struct fuse_entry_param e;
+	memset(&e,0,sizeof(e));
+	Inode *inode=inode_lookup(node(parent),name,&e.attr);
+	if (inode==0) {close(handle);fuse_reply_err(req,errno);return;}
+	e.ino=node_id(inode);
+	e.attr_timeout=options.attr_timeout;
+	e.entry_timeout=options.entry_timeout;
 	FileStruct *fs=(FileStruct*)malloc(sizeof(FileStruct));
 	fs->type=T_FILE;
 	fs->file_handle=handle;
-	strncpy(fs->filename,relative,FILENAME_MAX_LENGTH-1);
-	fs->filename[FILENAME_MAX_LENGTH-1]=0;
+	fs->output=0;
+	fs->dir_handle=0;
+	fs->dir_position=0;
 	fi->fh=(long)fs;
-	free(relative);
-	return 0;
+	if (fuse_reply_create(req,&e,fi)!=0) {	// The kernel did not get the file
+		close(handle);
+		free(fs);
+		inode_forget(inode,1);
+	}
 }
 
 /**
- * \brief List of callback functions
+ * \brief Define an operation which counts and traces the calls to another one
  *
- * This constant holds the references of the callback functions used when an operation is made on a file on the FUSE filesystem.
+ * The new operation is named after the counted one with a _counted suffix. It measures the time spent in the operation, which includes the reply to the kernel, and adds it to the statistics of the file system. It also records the start and the end of the operation, with the inode number and the name given to it, if tracing is on.
  */
-struct fuse_operations sfs_oper = {
+#define	COUNTED_OPERATION(op,func,params,args,ino,name) static void func##_counted params {unsigned long long start=stats_clock();trace_event(TRACE_BEGIN,op,(long long)(ino),name);func args;stats_operation(op,start);trace_event(TRACE_END,op,(long long)(ino),0);}
+
+COUNTED_OPERATION(OP_LOOKUP,sfs_lookup,(fuse_req_t req,fuse_ino_t parent,const char *name),(req,parent,name),parent,name)
+COUNTED_OPERATION(OP_FORGET,sfs_forget,(fuse_req_t req,fuse_ino_t ino,unsigned long nlookup),(req,ino,nlookup),ino,0)
+COUNTED_OPERATION(OP_FORGET,sfs_forget_multi,(fuse_req_t req,size_t count,struct fuse_forget_data *forgets),(req,count,forgets),count,0)
+COUNTED_OPERATION(OP_GETATTR,sfs_getattr,(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi),(req,ino,fi),ino,0)
+COUNTED_OPERATION(OP_SETATTR,sfs_setattr,(fuse_req_t req,fuse_ino_t ino,struct stat *attr,int to_set,struct fuse_file_info *fi),(req,ino,attr,to_set,fi),ino,0)
+COUNTED_OPERATION(OP_ACCESS,sfs_access,(fuse_req_t req,fuse_ino_t ino,int mask),(req,ino,mask),ino,0)
+COUNTED_OPERATION(OP_READLINK,sfs_readlink,(fuse_req_t req,fuse_ino_t ino),(req,ino),ino,0)
+COUNTED_OPERATION(OP_SYMLINK,sfs_symlink,(fuse_req_t req,const char *link,fuse_ino_t parent,const char *name),(req,link,parent,name),parent,name)
+COUNTED_OPERATION(OP_LINK,sfs_link,(fuse_req_t req,fuse_ino_t ino,fuse_ino_t newparent,const char *newname),(req,ino,newparent,newname),ino,newname)
+COUNTED_OPERATION(OP_OPENDIR,sfs_opendir,(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi),(req,ino,fi),ino,0)
+COUNTED_OPERATION(OP_RELEASEDIR,sfs_releasedir,(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi),(req,ino,fi),ino,0)
+COUNTED_OPERATION(OP_READDIR,sfs_readdir,(fuse_req_t req,fuse_ino_t ino,size_t size,off_t offset,struct fuse_file_info *fi),(req,ino,size,offset,fi),ino,0)
+COUNTED_OPERATION(OP_MKDIR,sfs_mkdir,(fuse_req_t req,fuse_ino_t parent,const char *name,mode_t mode),(req,parent,name,mode),parent,name)
+COUNTED_OPERATION(OP_UNLINK,sfs_unlink,(fuse_req_t req,fuse_ino_t parent,const char *name),(req,parent,name),parent,name)
+COUNTED_OPERATION(OP_RMDIR,sfs_rmdir,(fuse_req_t req,fuse_ino_t parent,const char *name),(req,parent,name),parent,name)
+COUNTED_OPERATION(OP_RENAME,sfs_rename,(fuse_req_t req,fuse_ino_t parent,const char *name,fuse_ino_t newparent,const char *newname),(req,parent,name,newparent,newname),parent,name)
+COUNTED_OPERATION(OP_STATFS,sfs_statfs,(fuse_req_t req,fuse_ino_t ino),(req,ino),ino,0)
+COUNTED_OPERATION(OP_OPEN,sfs_open,(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi),(req,ino,fi),ino,0)
+COUNTED_OPERATION(OP_READ,sfs_read,(fuse_req_t req,fuse_ino_t ino,size_t size,off_t offset,struct fuse_file_info *fi),(req,ino,size,offset,fi),ino,0)
+COUNTED_OPERATION(OP_WRITE,sfs_write,(fuse_req_t req,fuse_ino_t ino,const char *buf,size_t size,off_t offset,struct fuse_file_info *fi),(req,ino,buf,size,offset,fi),ino,0)
+COUNTED_OPERATION(OP_RELEASE,sfs_release,(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi),(req,ino,fi),ino,0)
+COUNTED_OPERATION(OP_FSYNC,sfs_fsync,(fuse_req_t req,fuse_ino_t ino,int isdatasync,struct fuse_file_info *fi),(req,ino,isdatasync,fi),ino,0)
+COUNTED_OPERATION(OP_CREATE,sfs_create,(fuse_req_t req,fuse_ino_t parent,const char *name,mode_t mode,struct fuse_file_info *fi),(req,parent,name,mode,fi),parent,name)
+COUNTED_OPERATION(OP_FLUSH,sfs_flush,(fuse_req_t req,fuse_ino_t ino,struct fuse_file_info *fi),(req,ino,fi),ino,0)
+
+/**
+ * \brief List of FUSE operations
+ *
+ * The operations are implemented with the low-level interface of FUSE, which designates files by inode numbers instead of paths. Each operation is counted in the statistics of the file system.
+ */
+struct fuse_lowlevel_ops sfs_oper = {
 	.init=sfs_init,
 	.destroy=sfs_destroy,
-	.getattr=sfs_getattr,
-	.fgetattr=sfs_fgetattr,
-	.access=sfs_access,
-	.readlink=sfs_readlink,
-	.symlink=sfs_symlink,
-	.link=sfs_link,
-	.opendir=sfs_opendir,
-	.releasedir=sfs_releasedir,
-	.readdir=sfs_readdir,
-	.mkdir=sfs_mkdir,
-	.unlink=sfs_unlink,
-	.rmdir=sfs_rmdir,
-	.rename=sfs_rename,
-	.chmod=sfs_chmod,
-	.truncate=sfs_truncate,
-	.ftruncate=sfs_ftruncate,
-	.utimens=sfs_utimens,
-	.statfs=sfs_statfs,
-	.open=sfs_open,
-	.read=sfs_read,
-	.write=sfs_write,
-	.release=sfs_release,
-	.fsync=sfs_fsync,
-	.create=sfs_create,
-	.flush=sfs_flush,
-	.flag_nullpath_ok=0	// Indicates that some functions can receive a null path as argument because they get the location of their operand from the file handle
+	.lookup=sfs_lookup_counted,
+	.forget=sfs_forget_counted,
+	.forget_multi=sfs_forget_multi_counted,
+	.getattr=sfs_getattr_counted,
+	.setattr=sfs_setattr_counted,
+	.access=sfs_access_counted,
+	.readlink=sfs_readlink_counted,
+	.symlink=sfs_symlink_counted,
+	.link=sfs_link_counted,
+	.opendir=sfs_opendir_counted,
+	.releasedir=sfs_releasedir_counted,
+	.readdir=sfs_readdir_counted,
+	.mkdir=sfs_mkdir_counted,
+	.unlink=sfs_unlink_counted,
+	.rmdir=sfs_rmdir_counted,
+	.rename=sfs_rename_counted,
+	.statfs=sfs_statfs_counted,
+	.open=sfs_open_counted,
+	.read=sfs_read_counted,
+	.write=sfs_write_counted,
+	.release=sfs_release_counted,
+	.fsync=sfs_fsync_counted,
+	.create=sfs_create_counted,
+	.flush=sfs_flush_counted
+};
+
+/**
+ * \brief Options of FUSE handled by ScriptFS
+ *
+ * The high-level interface of FUSE used to handle these options. They are now read by ScriptFS from the -o arguments and removed before the other arguments are given to FUSE.
+ */
+static struct fuse_opt sfs_opts[] = {
+	{"attr_timeout=%lf",offsetof(struct options,attr_timeout),0},
+	{"entry_timeout=%lf",offsetof(struct options,entry_timeout),0},
+	{"negative_timeout=%lf",offsetof(struct options,negative_timeout),0},
+	FUSE_OPT_END
 };
 
 /**
@@ -758,12 +1239,17 @@ int main(int argc,char **argv,char **envp) {
 				Procedures *procs=(Procedures*)malloc(sizeof(Procedures));
 				procs->procedure=proc;
 				procs->next=0;
+				procs->patterns=0;
 				if (last==0) persistent.procs=procs; else last->next=procs;
 				last=procs;
 			}
 			for (j=i;j<argc-2;++j) argv[j]=argv[j+2];
 			argc-=2;
 			--i;
+		} else if (argv[i][1]=='-' && parse_option(argv[i])) {	// Parse long options of ScriptFS
+			for (j=i;j<argc-1;++j) argv[j]=argv[j+1];
+			argc--;
+			--i;
 		}
 	}
 	if ((argc-i)!=2) print_usage(EX_USAGE);
@@ -773,32 +1259,82 @@ int main(int argc,char **argv,char **envp) {
 	argc--;
 	// Open mirror directory
 	persistent.mirror_fd=open(persistent.mirror,O_RDONLY);
-	if (persistent.mirror_fd<0) {
+	if (persistent.mirror_fd<0 || init_inodes(persistent.mirror_fd)!=0) {
 		fprintf(stderr,"Can't open mirror folder: %s\n",persistent.mirror);
 		free_resources();
 		return EX_NOPERM;
 	}
+	// Each inode known by the kernel holds a descriptor, so allow as many descriptors as possible
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE,&limit)==0 && limit.rlim_cur<limit.rlim_max) {
+		limit.rlim_cur=limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE,&limit);
+	}
 	// Check if no valid procedure was set. In that case, automatically provide a standard procedure
 	if (persistent.procs==0) {
 		persistent.procs=(Procedures*)malloc(sizeof(Procedures));
-		persistent.procs->procedure=(Procedure*)malloc(sizeof(Procedure));
-		persistent.procs->procedure->program=(Program*)malloc(sizeof(Program));
-		persistent.procs->procedure->program->path=0;
-		persistent.procs->procedure->program->args=0;
-		persistent.procs->procedure->program->filearg=0;
+		persistent.procs->procedure=(Procedure*)calloc(1,sizeof(Procedure));
+		persistent.procs->procedure->program=(Program*)calloc(1,sizeof(Program));	// No path, arguments or server pool
 		persistent.procs->procedure->program->func=&program_shell;
-		persistent.procs->procedure->test=(Test*)malloc(sizeof(Test));
+		persistent.procs->procedure->test=(Test*)calloc(1,sizeof(Test));	// No path, arguments, pattern or server pool
 		persistent.procs->procedure->test->func=&test_shell_executable;
-		persistent.procs->procedure->test->path=0;
-		persistent.procs->procedure->test->args=0;
-		persistent.procs->procedure->test->filearg=0;
-		persistent.procs->procedure->test->filter=0;
-		persistent.procs->procedure->test->compiled=0;
 		persistent.procs->next=0;
+		persistent.procs->patterns=0;
+	}
+	compile_patterns(persistent.procs);
+	// Prepare the pools of the test servers and workers, which processes are started by the first requests
+	for (last=persistent.procs;last!=0;last=last->next) {
+		Test *test=last->procedure->test;
+		if (test!=0 && test->func==&test_server) test->servers=server_pool_new(test->path,test->args,test->filearg,persistent.test_servers,0);
+		Program *program=last->procedure->program;
+		if (program->func==&program_server) program->servers=server_pool_new(program->path,program->args,program->filearg,persistent.workers,persistent.worker_requests);
+	}
+	// Prepare the output cache
+	if (init_output_cache(persistent.cache_memory,persistent.cache_disk,persistent.cache_dir)!=0) {
+		fprintf(stderr,"Can't create output cache folder: %s\n",(persistent.cache_dir==0)?"/tmp":persistent.cache_dir);
+		free_resources();
+		return EX_CANTCREAT;
+	}
+	if (persistent.page_cache && !output_cache_enabled()) {	// The size of the outputs is only known from the output cache
+		fprintf(stderr,"Can't report the size of outputs without the output cache\n");
+		persistent.page_cache=0;
+	}
+	init_admission(persistent.max_executions,persistent.max_queue);
+	// Prepare the recording of events, which can be switched on later with a signal
+	if (init_trace(persistent.trace_events,persistent.trace)!=0) fprintf(stderr,"Can't install the handler of the trace signal\n");
+	// Start the zygote while the program is still small and has only one thread
+	if (persistent.spawner==SPAWN_ZYGOTE && start_zygote()!=0) {
+		fprintf(stderr,"Can't start zygote, using posix_spawn\n");
+		persistent.spawner=SPAWN_POSIX;
+	}
+	// Mount the file system and daemonize the program
+	struct fuse_args args=FUSE_ARGS_INIT(argc,argv);
+	char *mountpoint=0;
+	int multithreaded,foreground;
+	int code=1;
+	if (fuse_opt_parse(&args,&options,sfs_opts,0)==0 && fuse_parse_cmdline(&args,&mountpoint,&multithreaded,&foreground)==0) {
+		channel=fuse_mount(mountpoint,&args);
+		if (channel!=0) {
+			struct fuse_session *session=fuse_lowlevel_new(&args,&sfs_oper,sizeof(sfs_oper),0);
+			if (session!=0) {
+				if (fuse_set_signal_handlers(session)==0) {
+					fuse_session_add_chan(session,channel);
+					if (fuse_daemonize(foreground)==0) code=(multithreaded)?fuse_session_loop_mt(session):fuse_session_loop(session);
+					fuse_remove_signal_handlers(session);
+					fuse_session_remove_chan(channel);
+				}
+				fuse_session_destroy(session);
+			}
+			fuse_unmount(mountpoint,channel);
+			channel=0;
+		}
 	}
-	// Daemonize the program
-	int code=fuse_main(argc,argv,&sfs_oper,0);
-	free_resources();
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+	free_inodes();
+	free_resources();	// The test servers and workers are stopped before the zygote which waits for them
+	stop_zygote();
+	free_trace();
 	close(persistent.mirror_fd);
-	return code;
+	return (code==0)?0:1;
 }
@@ -0,0 +1,259 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  server.c
+ *
+ *    Description:  Implementation of the long-lived test and program processes
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 18:58:40
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_GNU_SOURCE	//!< Needed for pipe2
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include "operations.h"
+#include "spawner.h"
+#include "output.h"
+#include "server.h"
+#include "trace.h"
+#include "watchdog.h"
+
+ServerPool *server_pool_new(const char *path,char **args,char **filearg,size_t count,unsigned long max_requests) {
+	ServerPool *pool=(ServerPool*)malloc(sizeof(ServerPool));
+	pool->path=path;
+	size_t i,num=0;
+	while (args[num]!=0 || args+num==filearg) ++num;
+	pool->args=(const char**)malloc((num+1)*sizeof(char*));
+	for (i=0;i<num;++i) pool->args[i]=(args+i==filearg)?SPAWN_SCRIPT_PATH:args[i];
+	pool->args[num]=0;
+	pool->count=(count==0)?1:count;
+	pool->servers=(Server*)malloc(pool->count*sizeof(Server));
+	for (i=0;i<pool->count;++i) {
+		pthread_mutex_init(&pool->servers[i].lock,0);
+		pool->servers[i].pid=-1;
+		pool->servers[i].in=-1;
+		pool->servers[i].out=-1;
+		pool->servers[i].requests=0;
+	}
+	pool->max_requests=max_requests;
+	pool->next=0;
+	return pool;
+}
+
+/**
+ * \brief Start a process of a pool
+ *
+ * The lock of the server must be held by the caller.
+ * \param pool Pool of the server
+ * \param server Server
+ * \return 0 if the process was started, -1 otherwise
+ */
+static int server_start(ServerPool *pool,Server *server) {
+	Launch launch;
+	if (prepare_program(pool->path,pool->args,&launch)!=0) return -1;
+	int in[2],out[2];
+	if (pipe2(in,O_CLOEXEC)!=0) {release_program(&launch);return -1;}
+	if (pipe2(out,O_CLOEXEC)!=0) {close(in[0]);close(in[1]);release_program(&launch);return -1;}
+	SpawnRequest req;
+	req.exec_fd=launch.fd;
+	req.args=launch.args;
+	req.envp=persistent.envp;
+	req.in=in[0];
+	req.out=out[1];
+	req.script=fcntl(persistent.mirror_fd,F_DUPFD_CLOEXEC,0);	// The mirror folder is given to the server as its script descriptor
+	req.group=1;	// The processes created by the server are stopped with it
+	pid_t pid=spawn_process(persistent.spawner,&req);
+	trace_event(TRACE_SPAWN,0,pid,pool->path);
+	release_program(&launch);
+	if (req.script>=0) close(req.script);
+	close(in[0]);
+	close(out[1]);
+	if (pid<0) {close(in[1]);close(out[0]);return -1;}
+	server->pid=pid;
+	server->in=in[1];
+	server->out=out[0];
+	server->requests=0;
+	return 0;
+}
+
+/**
+ * \brief Stop a process of a pool
+ *
+ * The lock of the server must be held by the caller.
+ * \param server Server
+ */
+static void server_stop(Server *server) {
+	if (server->pid<0) return;
+	close(server->in);
+	close(server->out);
+	kill(-server->pid,SIGKILL);
+	wait_process(server->pid);
+	server->pid=-1;
+	server->in=server->out=-1;
+}
+
+void server_pool_free(ServerPool *pool) {
+	if (pool==0) return;
+	size_t i;
+	for (i=0;i<pool->count;++i) {
+		server_stop(pool->servers+i);
+		pthread_mutex_destroy(&pool->servers[i].lock);
+	}
+	free(pool->servers);
+	free(pool->args);
+	free(pool);
+}
+
+/**
+ * \brief Find a process of a pool for a new request
+ *
+ * The function takes an idle process of the pool, or waits for the next one in turn if they are all busy, and starts it if it is not running.
+ * \param pool Pool of processes
+ * \return Pointer to the locked process, which the caller should give back with server_release, or a null pointer if the process could not be started
+ */
+static Server *server_acquire(ServerPool *pool) {
+	size_t first=__atomic_fetch_add(&pool->next,1,__ATOMIC_RELAXED)%pool->count;
+	size_t i;
+	Server *server=0;
+	for (i=0;i<pool->count && server==0;++i) {	// Look for an idle process
+		Server *s=pool->servers+(first+i)%pool->count;
+		if (pthread_mutex_trylock(&s->lock)==0) server=s;
+	}
+	if (server==0) {	// Wait for the process in turn
+		server=pool->servers+first;
+		pthread_mutex_lock(&server->lock);
+	}
+	if (server->pid<0 && server_start(pool,server)!=0) {
+		pthread_mutex_unlock(&server->lock);
+		return 0;
+	}
+	return server;
+}
+
+/**
+ * \brief Give back a process after a request
+ *
+ * \param pool Pool of the process
+ * \param server Process, locked by server_acquire
+ * \param ok Tells if the process answered the request properly, otherwise it is stopped and will be started again by the next request
+ */
+static void server_release(ServerPool *pool,Server *server,int ok) {
+	++server->requests;
+	if (!ok || (pool->max_requests!=0 && server->requests>=pool->max_requests)) server_stop(server);
+	pthread_mutex_unlock(&server->lock);
+}
+
+/**
+ * \brief Send the path of a file to a process
+ *
+ * \param server Process
+ * \param file Path of the file relative to the mirror folder
+ * \return 0 if the request was sent, -1 otherwise
+ */
+static int server_send(Server *server,const char *file) {
+	char request[strlen(SPAWN_SCRIPT_PATH)+strlen(file)+3];
+	size_t size=sprintf(request,"%s/%s\n",SPAWN_SCRIPT_PATH,file);
+	size_t done=0;
+	ssize_t num;
+	while (done<size) {	// SIGPIPE is ignored by FUSE, so a crashed process only makes the write fail
+		num=write(server->in,request+done,size-done);
+		if (num<0 && errno==EINTR) continue;
+		if (num<=0) return -1;
+		done+=num;
+	}
+	return 0;
+}
+
+/**
+ * \brief Read the answer of a test server
+ *
+ * \param server Server
+ * \param timeout Time in milliseconds the process has to answer
+ * \return 1 if the answer is positive, 0 if it is negative, -1 if the process did not answer
+ */
+static int server_answer(Server *server,int timeout) {
+	ssize_t num;
+	size_t done=0;
+	struct timespec start,now;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	char answer[SERVER_LINE_LENGTH];
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		int left=timeout-(int)((now.tv_sec-start.tv_sec)*1000+(now.tv_nsec-start.tv_nsec)/1000000);
+		if (left<=0) return -1;
+		struct pollfd fd={server->out,POLLIN,0};
+		int code=poll(&fd,1,left);
+		if (code<0 && errno==EINTR) continue;
+		if (code<=0) return -1;
+		num=read(server->out,answer+done,sizeof(answer)-done);
+		if (num<0 && errno==EINTR) continue;
+		if (num<=0) return -1;	// The server has crashed
+		if (memchr(answer+done,'\n',num)!=0) break;
+		done+=num;
+		if (done==sizeof(answer)) return -1;	// The answer is too long, the server does not follow the protocol
+	}
+	return (answer[0]=='y' || answer[0]=='Y' || answer[0]=='1');
+}
+
+int server_query(ServerPool *pool,const char *file,int timeout) {
+	if (strchr(file,'\n')!=0) return 0;	// The path can not be written on one line
+	Server *server=server_acquire(pool);
+	if (server==0) return TEST_FAILED;
+	int res=(server_send(server,file)==0)?server_answer(server,timeout):-1;
+	server_release(pool,server,res>=0);
+	return (res<0)?TEST_FAILED:res;	// A crash or a timeout says nothing about the file
+}
+
+int server_run(ServerPool *pool,const char *file,Output *out,unsigned long timeout) {
+	if (strchr(file,'\n')!=0) return 1;	// The path can not be written on one line
+	Server *server=server_acquire(pool);
+	if (server==0) return 1;
+	Watch watch;
+	if (timeout!=0) watchdog_arm(&watch,server->pid,timeout);
+	int ok=(server_send(server,file)==0);
+	char header[SERVER_LINE_LENGTH];
+	size_t done=0;
+	ssize_t num;
+	while (ok) {	// The header is read byte by byte, so that no byte of the output is consumed
+		num=read(server->out,header+done,1);
+		if (num<0 && errno==EINTR) continue;
+		if (num<=0 || done==sizeof(header)-1) ok=0;
+		else if (header[done]=='\n') break;
+		else ++done;
+	}
+	int code=1;
+	if (ok) {
+		header[done]=0;
+		char *end;
+		long c=strtol(header,&end,10);
+		unsigned long long size=(*end==' ')?strtoull(end+1,&end,10):0;
+		if (*end!=0 || end==header) ok=0;
+		else {
+			ok=(output_fill_size(out,server->out,size)==0);
+			if (ok) code=(int)c;
+		}
+	}
+	if (timeout!=0 && watchdog_disarm(&watch)) {	// Disarmed before the worker is reaped by server_release
+		ok=0;
+		code=EXECUTION_TIMEOUT;
+	}
+	server_release(pool,server,ok);
+	return code;
+}
@@ -0,0 +1,102 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  server.h
+ *
+ *    Description:  Long-lived test and program processes answering requests on their standard input
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 18:52:06
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  SERVER_INC
+#define  SERVER_INC
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#define	SERVER_TIMEOUT 5000	//!< Default time in milliseconds a test server has to answer a request
+#define	SERVER_LINE_LENGTH 0x100	//!< Maximum length of an answer of a test server or of the header of a response of a worker
+
+struct Output;	//!< Forward definition of the Output type
+
+/**
+ * \brief Process of a test server or of a worker
+ *
+ * The process reads one path per line on its standard input and writes one answer per line on its standard output. The answer of a worker is a header line followed by the output of the script. The process is only used by one request at a time.
+ */
+typedef struct Server {
+	pthread_mutex_t lock;	//!< Lock held during a request
+	pid_t pid;	//!< Identifier of the process, -1 if it is not running
+	int in;	//!< Writing end of the pipe connected to the standard input of the process
+	int out;	//!< Reading end of the pipe connected to the standard output of the process
+	unsigned long requests;	//!< Number of requests answered by the process
+} Server;
+
+/**
+ * \brief Pool of processes of a test server or of a worker program
+ *
+ * The processes are started when they receive their first request, and started again after they crash, do not answer in time or have answered the maximum number of requests.
+ */
+typedef struct ServerPool {
+	const char *path;	//!< Path of the program
+	const char **args;	//!< Arguments of the program, the exclamation mark being replaced by the path of the mirror folder in the process
+	size_t count;	//!< Number of processes
+	Server *servers;	//!< Processes of the pool
+	unsigned long max_requests;	//!< Number of requests after which a process is replaced, 0 if processes are never replaced
+	unsigned int next;	//!< Counter used to spread the requests over the processes
+} ServerPool;
+
+/**
+ * \brief Create a pool of test servers or workers
+ *
+ * No process is started by this function. The user is responsible for releasing the pool with server_pool_free.
+ * \param path Path of the program
+ * \param args Arguments of the program, as read by tokenize_command, the first one being the name of the program
+ * \param filearg Position of the exclamation mark in the arguments, null if there is no exclamation mark
+ * \param count Number of processes
+ * \param max_requests Number of requests after which a process is replaced, 0 if processes are never replaced
+ * \return Pointer to the newly-allocated pool
+ */
+ServerPool *server_pool_new(const char *path,char **args,char **filearg,size_t count,unsigned long max_requests);
+
+/**
+ * \brief Stop the processes of a pool and release it
+ *
+ * \param pool Pool of test servers
+ */
+void server_pool_free(ServerPool *pool);
+
+/**
+ * \brief Ask a test server if a file is a script
+ *
+ * The path of the file is sent to an idle process of the pool, or to the next one in turn if they are all busy. The process receives the path as /proc/self/fd/3/file, the mirror folder being given to it as descriptor 3, so that it can open the file even when the file system is mounted over the mirror folder. The file is a script if the answer starts with 'y' or '1'. A process which crashes or does not answer before the timeout is killed, the file is not a script and a new process is started by the next request. This function is thread-safe.
+ * \param pool Pool of test servers
+ * \param file Path of the file relative to the mirror folder
+ * \param timeout Time in milliseconds the process has to answer
+ * \return 1 if the file is a script, 0 otherwise, TEST_FAILED if no process could answer in time
+ */
+int server_query(ServerPool *pool,const char *file,int timeout);
+
+/**
+ * \brief Ask a worker to execute a script
+ *
+ * The path of the script is sent to a process of the pool as in server_query. The worker answers with a header line holding the exit code of the script and the size of its output, separated by a space, followed by exactly that number of bytes of output, which are read into the output structure. A worker which crashes or sends a malformed response is killed and started again by the next request, as is a worker which response is abandoned by the readers of a streamed output. This function is thread-safe.
+ * \param pool Pool of workers
+ * \param file Path of the script relative to the mirror folder
+ * \param out Output receiving the output of the script
+ * \param timeout Time in milliseconds the worker has to send its whole response, 0 for no limit. A worker which exceeds it is stopped by the watchdog like an external program, and started again by the next request
+ * \return Exit code of the script, 1 if the worker did not answer, EXECUTION_TIMEOUT if it was stopped by the timeout
+ */
+int server_run(ServerPool *pool,const char *file,struct Output *out,unsigned long timeout);
+
+#endif   /* ----- #ifndef SERVER_INC  ----- */
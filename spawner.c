@@ -0,0 +1,470 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  spawner.c
+ *
+ *    Description:  Implementation of the creation of processes
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 11:04:51
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_GNU_SOURCE	//!< Needed for fexecve, vfork and MSG_CMSG_CLOEXEC
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include "spawner.h"
+
+#define	ZYGOTE_MAX_FDS 4	//!< Maximum number of descriptors passed with a request to the zygote
+
+/**
+ * \brief Header of a request sent to the zygote
+ *
+ * The header is followed by the arguments and then the environment variables of the program, each one ending with a null character. The descriptors are passed with the message, the executable being the first one.
+ */
+typedef struct ZygoteRequest {
+	uint32_t argc;	//!< Number of arguments
+	uint32_t envc;	//!< Number of environment variables
+	int32_t in;	//!< Index of the standard input in the passed descriptors, -1 if there is none
+	int32_t out;	//!< Index of the standard output in the passed descriptors, -1 if there is none
+	int32_t script;	//!< Index of the script in the passed descriptors, -1 if there is none
+	int32_t group;	//!< Tells if the program should lead a new process group
+	int32_t pid;	//!< Process to signal instead of creating a new one, 0 for a creation
+	int32_t sig;	//!< Signal sent to the process if pid is not null
+} ZygoteRequest;
+
+/**
+ * \brief Exit status of a process created by the zygote
+ */
+typedef struct ZygoteExit {
+	pid_t pid;	//!< Identifier of the process
+	int status;	//!< Status of the process, as returned by waitpid
+} ZygoteExit;
+
+/**
+ * \brief State of the connection to the zygote
+ */
+static struct {
+	pid_t pid;	//!< Identifier of the zygote, -1 if it is not running
+	int requests;	//!< Socket on which the requests are sent and their answers received
+	int exits;	//!< Socket on which the exit statuses of the processes are received
+	int dead;	//!< Tells if the zygote has stopped sending exit statuses
+	pthread_mutex_t lock;	//!< Lock serializing the requests
+	pthread_mutex_t wait_lock;	//!< Lock protecting the received exit statuses
+	pthread_cond_t exited;	//!< Condition signaled each time an exit status is received
+	int reading;	//!< Tells if a thread is reading the exit statuses socket
+	ZygoteExit *done;	//!< Exit statuses received but not waited for yet
+	size_t count;	//!< Number of elements of the done array
+	size_t capacity;	//!< Number of elements allocated for the done array
+} zygote={-1,-1,-1,0,PTHREAD_MUTEX_INITIALIZER,PTHREAD_MUTEX_INITIALIZER,PTHREAD_COND_INITIALIZER,0,0,0,0};
+
+int parse_spawner(const char *str,Spawner *spawner) {
+	if (strcasecmp(str,"posix_spawn")==0) *spawner=SPAWN_POSIX;
+	else if (strcasecmp(str,"vfork")==0) *spawner=SPAWN_VFORK;
+	else if (strcasecmp(str,"fork")==0) *spawner=SPAWN_FORK;
+	else if (strcasecmp(str,"zygote")==0) *spawner=SPAWN_ZYGOTE;
+	else return 0;
+	return 1;
+}
+
+/**
+ * \brief Prepare the new process and load the program
+ *
+ * This function is executed in the child process after fork or vfork. It only calls async-signal-safe functions and never returns. The signal handlers of the caller are reset to their default behaviour before the signals are unblocked, because with vfork they would run in the memory of the caller. SIGPIPE, ignored by FUSE, is also restored.
+ * \param req Description of the process
+ */
+static void spawn_child(const SpawnRequest *req) {
+	if (req->out>=0) dup2(req->out,STDOUT_FILENO);	// Redirect output to out descriptor
+	else dup2(STDERR_FILENO,STDOUT_FILENO);	// Redirect standard output on standard error, to avoid mixing outputs from the external program and the parent process
+	if (req->in>=0) dup2(req->in,STDIN_FILENO);	// Redirect standard input
+	else close(STDIN_FILENO);	// We do not want the external program to use anything from the common standard input
+	if (req->script==SPAWN_SCRIPT_FD) fcntl(SPAWN_SCRIPT_FD,F_SETFD,0);	// Keep the script open in the program
+	else if (req->script>=0) dup2(req->script,SPAWN_SCRIPT_FD);
+	if (req->group) setpgid(0,0);
+	int sig;
+	struct sigaction sa;
+	for (sig=1;sig<NSIG;++sig) {
+		if (sig==SIGKILL || sig==SIGSTOP || sigaction(sig,0,&sa)!=0) continue;
+		if (sa.sa_handler==SIG_DFL || (sa.sa_handler==SIG_IGN && sig!=SIGPIPE)) continue;
+		sa.sa_handler=SIG_DFL;
+		sa.sa_flags=0;
+		sigemptyset(&sa.sa_mask);
+		sigaction(sig,&sa,0);
+	}
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK,&mask,0);
+	fexecve(req->exec_fd,(char* const*)req->args,req->envp);
+	static const char message[]="Error calling external program : ";
+	write(STDERR_FILENO,message,sizeof(message)-1);
+	if (req->args[0]!=0) write(STDERR_FILENO,req->args[0],strlen(req->args[0]));
+	write(STDERR_FILENO,"\n",1);
+	_exit(127);
+}
+
+/**
+ * \brief Create a process with posix_spawn
+ *
+ * The executable is designated by its descriptor through the /proc/self/fd folder, since posix_spawn needs a path. The descriptor is still open when the program is loaded, even if it has the close-on-exec flag.
+ * \param req Description of the process
+ * \return Identifier of the new process, -1 if it could not be created
+ */
+static pid_t spawn_posix(const SpawnRequest *req) {
+	char path[32];
+	snprintf(path,sizeof(path),"/proc/self/fd/%d",req->exec_fd);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (req->out>=0) posix_spawn_file_actions_adddup2(&actions,req->out,STDOUT_FILENO);
+	else posix_spawn_file_actions_adddup2(&actions,STDERR_FILENO,STDOUT_FILENO);
+	if (req->in>=0) posix_spawn_file_actions_adddup2(&actions,req->in,STDIN_FILENO);
+	else posix_spawn_file_actions_addclose(&actions,STDIN_FILENO);
+	if (req->script>=0) posix_spawn_file_actions_adddup2(&actions,req->script,SPAWN_SCRIPT_FD);	// When both descriptors are equal, the close-on-exec flag is cleared
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t mask;
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr,&mask);
+	sigaddset(&mask,SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr,&mask);
+	if (req->group) posix_spawnattr_setpgroup(&attr,0);
+	posix_spawnattr_setflags(&attr,POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | (req->group?POSIX_SPAWN_SETPGROUP:0));
+	pid_t pid;
+	int code=posix_spawn(&pid,path,&actions,&attr,(char* const*)req->args,req->envp);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (code!=0) {errno=code;return -1;}
+	return pid;
+}
+
+/**
+ * \brief Send a signal to the process group led by a process, or to the process alone if its group does not exist yet
+ *
+ * \param pid Identifier of the process
+ * \param sig Signal
+ * \return 0 if the signal was sent, -1 otherwise
+ */
+static int signal_group(pid_t pid,int sig) {
+	if (kill(-pid,sig)==0) return 0;
+	return (errno==ESRCH)?kill(pid,sig):-1;	// The process may not have created its group yet
+}
+
+/**
+ * \brief Ask the zygote to create a process
+ *
+ * \param req Description of the process
+ * \return Identifier of the new process, -1 if it could not be created
+ */
+static pid_t zygote_spawn(const SpawnRequest *req) {
+	if (zygote.requests<0) {errno=ECHILD;return -1;}
+	ZygoteRequest header;
+	size_t size=sizeof(header);
+	header.argc=header.envc=0;
+	while (req->args[header.argc]!=0) size+=strlen(req->args[header.argc++])+1;
+	if (req->envp!=0) while (req->envp[header.envc]!=0) size+=strlen(req->envp[header.envc++])+1;
+	char *buffer=(char*)malloc(size);
+	char *p=buffer+sizeof(header);
+	uint32_t i;
+	for (i=0;i<header.argc;++i) p=stpcpy(p,req->args[i])+1;
+	for (i=0;i<header.envc;++i) p=stpcpy(p,req->envp[i])+1;
+	int fds[ZYGOTE_MAX_FDS];
+	int num=0;
+	fds[num++]=req->exec_fd;
+	header.in=(req->in>=0)?(fds[num]=req->in,num++):-1;
+	header.out=(req->out>=0)?(fds[num]=req->out,num++):-1;
+	header.script=(req->script>=0)?(fds[num]=req->script,num++):-1;
+	header.group=req->group;
+	header.pid=0;
+	header.sig=0;
+	memcpy(buffer,&header,sizeof(header));
+	union {
+		char buf[CMSG_SPACE(ZYGOTE_MAX_FDS*sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov={buffer,size};
+	struct msghdr msg;
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buf;
+	msg.msg_controllen=CMSG_SPACE(num*sizeof(int));
+	struct cmsghdr *cmsg=CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level=SOL_SOCKET;
+	cmsg->cmsg_type=SCM_RIGHTS;
+	cmsg->cmsg_len=CMSG_LEN(num*sizeof(int));
+	memcpy(CMSG_DATA(cmsg),fds,num*sizeof(int));
+	pid_t pid=-1;
+	pthread_mutex_lock(&zygote.lock);
+	if (sendmsg(zygote.requests,&msg,MSG_NOSIGNAL)==(ssize_t)size) {
+		ssize_t n;
+		while ((n=recv(zygote.requests,&pid,sizeof(pid),0))<0 && errno==EINTR);
+		if (n!=sizeof(pid)) pid=-1;
+	}
+	pthread_mutex_unlock(&zygote.lock);
+	free(buffer);
+	if (pid<0) errno=EAGAIN;
+	return pid;
+}
+
+/**
+ * \brief Create the process described by a request received by the zygote
+ *
+ * This function is executed in the zygote.
+ * \param requests Socket on which the requests are received
+ * \return 0 if the zygote should go on, -1 if the socket has been closed
+ */
+static int zygote_serve(int requests) {
+	ssize_t size=recv(requests,0,0,MSG_PEEK | MSG_TRUNC);
+	if (size<=0) return (size<0 && errno==EINTR)?0:-1;
+	char *buffer=(char*)malloc(size+1);
+	union {
+		char buf[CMSG_SPACE(ZYGOTE_MAX_FDS*sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov={buffer,size};
+	struct msghdr msg;
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control.buf;
+	msg.msg_controllen=sizeof(control.buf);
+	ssize_t num=recvmsg(requests,&msg,MSG_CMSG_CLOEXEC);
+	int fds[ZYGOTE_MAX_FDS];
+	int nfds=0;
+	struct cmsghdr *cmsg;
+	for (cmsg=CMSG_FIRSTHDR(&msg);cmsg!=0;cmsg=CMSG_NXTHDR(&msg,cmsg)) if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_RIGHTS) {
+		nfds=(cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+		if (nfds>ZYGOTE_MAX_FDS) nfds=ZYGOTE_MAX_FDS;
+		memcpy(fds,CMSG_DATA(cmsg),nfds*sizeof(int));
+	}
+	pid_t pid=-1;
+	ZygoteRequest header;
+	if (num>=(ssize_t)sizeof(ZygoteRequest)) memcpy(&header,buffer,sizeof(header));
+	if (num>=(ssize_t)sizeof(ZygoteRequest) && header.pid>0) {	// The child is only signaled if it has not been reaped, which can not happen meanwhile since the zygote reaps in this thread
+		siginfo_t info;
+		if (waitid(P_PID,header.pid,&info,WEXITED | WNOHANG | WNOWAIT)==0) pid=(signal_group(header.pid,header.sig)==0)?header.pid:-1;
+	} else if (num>=(ssize_t)sizeof(ZygoteRequest) && nfds>0) {
+		buffer[num]=0;
+		size_t count=(size_t)header.argc+header.envc;
+		char **strings=(char**)malloc((count+2)*sizeof(char*));	// Arguments and environment, each array ending with a null pointer
+		char *p=buffer+sizeof(header);
+		size_t i;
+		for (i=0;i<count && p<buffer+num;++i) {
+			strings[(i<header.argc)?i:i+1]=p;
+			p+=strlen(p)+1;
+		}
+		if (i==count && header.argc>0) {
+			strings[header.argc]=0;
+			strings[count+1]=0;
+			SpawnRequest req;
+			req.exec_fd=fds[0];
+			req.args=(const char**)strings;
+			req.envp=strings+header.argc+1;
+			req.in=(header.in>0 && header.in<nfds)?fds[header.in]:-1;
+			req.out=(header.out>0 && header.out<nfds)?fds[header.out]:-1;
+			req.script=(header.script>0 && header.script<nfds)?fds[header.script]:-1;
+			req.group=header.group;
+			pid=spawn_process(SPAWN_FORK,&req);
+		}
+		free(strings);
+	}
+	int i;
+	for (i=0;i<nfds;++i) close(fds[i]);
+	free(buffer);
+	send(requests,&pid,sizeof(pid),MSG_NOSIGNAL);
+	return 0;
+}
+
+/**
+ * \brief Main loop of the zygote
+ *
+ * The zygote creates the processes requested on the first socket, and sends the exit statuses of its children on the second one as soon as they end. It never returns.
+ * \param requests Socket on which the requests are received
+ * \param exits Socket on which the exit statuses are sent
+ */
+static void zygote_loop(int requests,int exits) {
+	setsid();	// Signals sent to the group of the terminal, like SIGINT, do not stop the zygote
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGCHLD);
+	sigprocmask(SIG_BLOCK,&mask,0);
+	int sfd=signalfd(-1,&mask,SFD_CLOEXEC);
+	if (sfd<0) _exit(1);
+	struct pollfd fds[2]={{requests,POLLIN,0},{sfd,POLLIN,0}};
+	for (;;) {
+		if (poll(fds,2,-1)<0) {
+			if (errno==EINTR) continue;
+			break;
+		}
+		if (fds[1].revents!=0) {	// Report the children which have ended
+			struct signalfd_siginfo info;
+			if (read(sfd,&info,sizeof(info))<0 && errno!=EAGAIN && errno!=EINTR) break;
+			ZygoteExit e;
+			while ((e.pid=waitpid(-1,&e.status,WNOHANG))>0) send(exits,&e,sizeof(e),MSG_NOSIGNAL);
+		}
+		if (fds[0].revents!=0 && zygote_serve(requests)!=0) break;
+	}
+	_exit(0);
+}
+
+/**
+ * \brief Wait for the exit status of a process created by the zygote
+ *
+ * One of the waiting threads reads the statuses sent by the zygote and stores them, the others wait until their status arrives.
+ * \param pid Identifier of the process
+ * \return Status of the process, as returned by waitpid, -1 if the zygote has stopped
+ */
+static int zygote_wait(pid_t pid) {
+	int status=-1;
+	pthread_mutex_lock(&zygote.wait_lock);
+	for (;;) {
+		size_t i;
+		for (i=0;i<zygote.count && zygote.done[i].pid!=pid;++i);
+		if (i<zygote.count) {
+			status=zygote.done[i].status;
+			zygote.done[i]=zygote.done[--zygote.count];
+			break;
+		}
+		if (zygote.dead) break;
+		if (zygote.reading) {pthread_cond_wait(&zygote.exited,&zygote.wait_lock);continue;}
+		zygote.reading=1;
+		pthread_mutex_unlock(&zygote.wait_lock);
+		ZygoteExit e;
+		ssize_t n=recv(zygote.exits,&e,sizeof(e),0);
+		int error=errno;
+		pthread_mutex_lock(&zygote.wait_lock);
+		zygote.reading=0;
+		if (n==sizeof(e)) {
+			if (zygote.count==zygote.capacity) {
+				zygote.capacity=(zygote.capacity==0)?16:2*zygote.capacity;
+				zygote.done=(ZygoteExit*)realloc(zygote.done,zygote.capacity*sizeof(ZygoteExit));
+			}
+			zygote.done[zygote.count++]=e;
+		} else if (n==0 || error!=EINTR) zygote.dead=1;
+		pthread_cond_broadcast(&zygote.exited);
+	}
+	pthread_mutex_unlock(&zygote.wait_lock);
+	return status;
+}
+
+int start_zygote() {
+	int requests[2],exits[2];
+	if (socketpair(AF_UNIX,SOCK_SEQPACKET | SOCK_CLOEXEC,0,requests)!=0) return -1;
+	if (socketpair(AF_UNIX,SOCK_SEQPACKET | SOCK_CLOEXEC,0,exits)!=0) {close(requests[0]);close(requests[1]);return -1;}
+	pid_t pid=fork();
+	if (pid==0) {
+		close(requests[0]);
+		close(exits[0]);
+		zygote_loop(requests[1],exits[1]);
+	}
+	close(requests[1]);
+	close(exits[1]);
+	if (pid<0) {close(requests[0]);close(exits[0]);return -1;}
+	zygote.pid=pid;
+	zygote.requests=requests[0];
+	zygote.exits=exits[0];
+	zygote.dead=0;
+	return 0;
+}
+
+void stop_zygote() {
+	if (zygote.pid<0) return;
+	close(zygote.requests);	// The zygote stops when its socket is closed
+	close(zygote.exits);
+	waitpid(zygote.pid,0,0);	// Fails if the zygote is not a child any more, after the program became a daemon
+	zygote.pid=-1;
+	zygote.requests=zygote.exits=-1;
+	free(zygote.done);
+	zygote.done=0;
+	zygote.count=zygote.capacity=0;
+}
+
+pid_t spawn_process(Spawner spawner,const SpawnRequest *req) {
+	if (spawner==SPAWN_ZYGOTE) return zygote_spawn(req);
+	SpawnRequest r=*req;
+	if (r.script>=0 && r.exec_fd<=SPAWN_SCRIPT_FD) {	// The executable must not be overwritten by the script descriptor before it is loaded
+		r.exec_fd=fcntl(req->exec_fd,F_DUPFD_CLOEXEC,SPAWN_SCRIPT_FD+1);
+		if (r.exec_fd<0) return -1;
+	}
+	pid_t pid;
+	if (spawner==SPAWN_POSIX) pid=spawn_posix(&r);
+	else {
+		// Block all signals so that no handler of the caller runs in the child before it is reset
+		sigset_t all,old;
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK,&all,&old);
+		pid=(spawner==SPAWN_VFORK)?vfork():fork();
+		if (pid==0) spawn_child(&r);
+		if (pid>0 && r.group) setpgid(pid,pid);	// Also done by the parent, so that the group exists when the function returns
+		pthread_sigmask(SIG_SETMASK,&old,0);
+	}
+	if (r.exec_fd!=req->exec_fd) {
+		int error=errno;
+		close(r.exec_fd);
+		errno=error;
+	}
+	return pid;
+}
+
+int wait_process(pid_t pid) {
+	int code;
+	while (waitpid(pid,&code,0)<0) {
+		if (errno==EINTR) continue;
+		if (errno!=ECHILD || zygote.requests<0) return 1;
+		code=zygote_wait(pid);	// The process is a child of the zygote
+		if (code<0) return 1;
+		break;
+	}
+	if (WIFEXITED(code)) return WEXITSTATUS(code);
+	return 1;
+}
+
+int process_descriptor(pid_t pid) {
+#ifdef SYS_pidfd_open
+	return (int)syscall(SYS_pidfd_open,pid,0);	// The descriptor has the close-on-exec flag
+#else
+	errno=ENOSYS;
+	return -1;
+#endif
+}
+
+int signal_process(pid_t pid,int sig) {
+	siginfo_t info;
+	if (waitid(P_PID,pid,&info,WEXITED | WNOHANG | WNOWAIT)==0 || errno!=ECHILD || zygote.requests<0) return signal_group(pid,sig);
+	ZygoteRequest header;	// The process is a child of the zygote, which signals it only if it has not reaped it yet
+	memset(&header,0,sizeof(header));
+	header.in=header.out=header.script=-1;
+	header.pid=pid;
+	header.sig=sig;
+	pid_t reply=-1;
+	pthread_mutex_lock(&zygote.lock);
+	if (send(zygote.requests,&header,sizeof(header),MSG_NOSIGNAL)==(ssize_t)sizeof(header)) {
+		ssize_t n;
+		while ((n=recv(zygote.requests,&reply,sizeof(reply),0))<0 && errno==EINTR);
+		if (n!=sizeof(reply)) reply=-1;
+	}
+	pthread_mutex_unlock(&zygote.lock);
+	if (reply<0) {errno=ESRCH;return -1;}
+	return 0;
+}
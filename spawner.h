@@ -0,0 +1,118 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  spawner.h
+ *
+ *    Description:  Creation of the processes executing external programs
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 11:02:18
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  SPAWNER_INC
+#define  SPAWNER_INC
+
+#include <sys/types.h>
+
+#define	SPAWN_SCRIPT_FD 3	//!< Descriptor number under which the script file is given to the new process
+#define	SPAWN_SCRIPT_PATH "/proc/self/fd/3"	//!< Path designating the script file in the new process
+
+/**
+ * \brief Method used to create new processes
+ *
+ * Every method gives the same result, but their cost differs. fork copies the page tables of the caller, which becomes expensive when the caller uses a lot of memory. vfork and posix_spawn share the memory of the caller until the new program is loaded. The zygote is a small process forked at the start of the program, before it grows, which creates the processes on behalf of the caller.
+ */
+typedef enum Spawner {
+	SPAWN_POSIX,	//!< Use posix_spawn, the file actions being done by the C library
+	SPAWN_VFORK,	//!< Use vfork, then redirect descriptors and call fexecve in the child
+	SPAWN_FORK,	//!< Use fork, then redirect descriptors and call fexecve in the child
+	SPAWN_ZYGOTE	//!< Ask the zygote process, started with start_zygote, to fork itself and load the program
+} Spawner;
+
+/**
+ * \brief Description of a process which has to be created
+ *
+ * The structure holds everything needed to create the process. All the descriptors should have the close-on-exec flag, the spawn functions take care of installing the ones needed by the new program.
+ */
+typedef struct SpawnRequest {
+	int exec_fd;	//!< Descriptor of the executable file
+	const char **args;	//!< Array of arguments ending with a null pointer, the first one being the name of the program
+	char **envp;	//!< Array of environment variables ending with a null pointer
+	int in;	//!< Descriptor which will be the standard input of the program, -1 to close the standard input
+	int out;	//!< Descriptor which will be the standard output of the program, -1 to send the standard output to the standard error
+	int script;	//!< Descriptor which will be given to the program under the number SPAWN_SCRIPT_FD, so that it can open the script through SPAWN_SCRIPT_PATH, -1 if no script is given
+	int group;	//!< Tells if the program should lead a new process group, so that it can be stopped with the processes it creates
+} SpawnRequest;
+
+/**
+ * \brief Read the name of a spawn method
+ *
+ * \param str Name of the method: \c posix_spawn, \c vfork, \c fork or \c zygote
+ * \param spawner Pointer to the variable receiving the method
+ * \return 1 if the name is valid, 0 otherwise
+ */
+int parse_spawner(const char *str,Spawner *spawner);
+
+/**
+ * \brief Create a process executing a program
+ *
+ * The function creates a new process, redirects its standard input and output and installs the script descriptor as described in the request, resets the signal mask and the signal handlers inherited from the caller, and loads the program. It can be called by several threads at the same time.
+ * \param spawner Method used to create the process
+ * \param req Description of the process
+ * \return Identifier of the new process, -1 if it could not be created
+ */
+pid_t spawn_process(Spawner spawner,const SpawnRequest *req);
+
+/**
+ * \brief Wait for the end of a process
+ *
+ * The process can be a child of the caller or of the zygote, in which case its exit status is received from the zygote. This function can be called by several threads at the same time.
+ * \param pid Identifier of the process
+ * \return Exit code of the process, or 1 if it did not exit normally
+ */
+int wait_process(pid_t pid);
+
+/**
+ * \brief Open a descriptor which becomes readable when a process ends
+ *
+ * The process can be a child of the caller or of the zygote. The function should be called just after the process was created, before it may have been reaped. It needs Linux 5.3 or later.
+ * \param pid Identifier of the process
+ * \return Descriptor of the process, to be closed by the caller, -1 if it could not be opened
+ */
+int process_descriptor(pid_t pid);
+
+/**
+ * \brief Send a signal to a process and to the process group it leads
+ *
+ * The process can be a child of the caller or of the zygote. A child of the zygote is signaled by the zygote itself, and only as long as the zygote has not reaped it, so that the signal never reaches another process which reused its identifier. The caller has to make sure the same holds for its own children, by not reaping them while they may be signaled. This function can be called by several threads at the same time.
+ * \param pid Identifier of the process
+ * \param sig Signal
+ * \return 0 if the signal was sent, -1 otherwise
+ */
+int signal_process(pid_t pid,int sig);
+
+/**
+ * \brief Start the zygote process
+ *
+ * The zygote is forked from the caller, and should be started as early as possible, while the caller is small and has only one thread. It receives the descriptions of the processes to create through a socket, the descriptors being passed with SCM_RIGHTS, creates them with fork from its own small memory, and sends back their identifiers and then, asynchronously, their exit statuses. It stops when the caller closes the socket or exits.
+ * \return 0 if the zygote is running, -1 otherwise
+ */
+int start_zygote();
+
+/**
+ * \brief Stop the zygote process
+ *
+ * The processes created by the zygote are not waited for any longer.
+ */
+void stop_zygote();
+
+#endif   /* ----- #ifndef SPAWNER_INC  ----- */
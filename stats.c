@@ -0,0 +1,244 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  stats.c
+ *
+ *    Description:  Implementation of the counters of the activity of the file system
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 20:15:10
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_GNU_SOURCE	//!< Needed for open_memstream
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "procedures.h"
+#include "operations.h"
+#include "cache.h"
+#include "output.h"
+#include "prefetch.h"
+#include "admission.h"
+#include "flight.h"
+#include "watchdog.h"
+#include "stats.h"
+
+/**
+ * \brief Counters of one kind of event with a duration
+ *
+ * The structure is aligned on a cache line, so that threads counting different operations do not share lines.
+ */
+typedef struct Histogram {
+	unsigned long count;	//!< Number of events
+	unsigned long buckets[HISTOGRAM_BUCKETS];	//!< Number of events in each range of durations
+} __attribute__((aligned(64))) Histogram;
+
+static const char *operation_names[OP_COUNT]={"lookup","forget","getattr","setattr","access","readlink","symlink","link","opendir","readdir","releasedir","mkdir","unlink","rmdir","rename","statfs","open","read","write","release","fsync","flush","create"};	//!< Names of the operations in the report
+
+static unsigned long long started;	//!< Time at which the counting started
+static Histogram operations[OP_COUNT];	//!< Counters of the operations
+static Histogram executions;	//!< Counters of the executions of scripts
+static Histogram waits;	//!< Counters of the time spent by the executions waiting for their admission
+static unsigned long exit_codes[STATS_EXIT_CODES];	//!< Number of executions which ended with each exit code
+static unsigned long script_bytes;	//!< Number of bytes read from the outputs of scripts
+static unsigned long file_bytes;	//!< Number of bytes read from regular files
+
+/********************************************/
+/*                HISTOGRAMS                */
+/********************************************/
+/**
+ * \brief Find the bucket of a duration
+ *
+ * Durations below 8 ns have a bucket each, then each power of two is split in 8 buckets of the same width.
+ * \param ns Duration in nanoseconds
+ * \return Index of the bucket
+ */
+static size_t histogram_bucket(unsigned long long ns) {
+	if (ns<8) return (size_t)ns;
+	int msb=63-__builtin_clzll(ns);
+	return (size_t)(msb-2)*8+((ns>>(msb-3)) & 7);
+}
+
+/**
+ * \brief Get the smallest duration of a bucket
+ *
+ * \param bucket Index of the bucket
+ * \return Duration in nanoseconds
+ */
+static unsigned long long bucket_bound(size_t bucket) {
+	if (bucket<8) return bucket;
+	if (bucket>=HISTOGRAM_BUCKETS) return ~0ULL;
+	return (8ULL+bucket%8)<<(bucket/8-1);
+}
+
+/**
+ * \brief Add an event to a histogram
+ *
+ * \param histogram Histogram
+ * \param start Time at which the event started
+ */
+static void histogram_add(Histogram *histogram,unsigned long long start) {
+	unsigned long long now=stats_clock();
+	__atomic_fetch_add(&histogram->count,1,__ATOMIC_RELAXED);
+	__atomic_fetch_add(histogram->buckets+histogram_bucket((now>start)?now-start:0),1,__ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Compute a percentile of the durations of a histogram
+ *
+ * \param buckets Snapshot of the buckets of the histogram
+ * \param total Sum of the buckets
+ * \param p Fraction of the events, between 0 and 1
+ * \return Upper bound in microseconds of the bucket holding the percentile, 0 if the histogram is empty
+ */
+static double histogram_percentile(const unsigned long *buckets,unsigned long total,double p) {
+	if (total==0) return 0;
+	unsigned long rank=(unsigned long)(p*total);
+	if ((double)rank<p*total || rank==0) ++rank;
+	unsigned long sum=0;
+	size_t i;
+	for (i=0;i<HISTOGRAM_BUCKETS-1;++i) {
+		sum+=buckets[i];
+		if (sum>=rank) break;
+	}
+	return (double)bucket_bound(i+1)/1000.0;
+}
+
+/**
+ * \brief Write the counters of a histogram in a report
+ *
+ * \param f Stream of the report
+ * \param name Prefix of the names of the counters
+ * \param histogram Histogram
+ */
+static void histogram_report(FILE *f,const char *name,const Histogram *histogram) {
+	unsigned long buckets[HISTOGRAM_BUCKETS];
+	unsigned long total=0;
+	size_t i;
+	for (i=0;i<HISTOGRAM_BUCKETS;++i) total+=(buckets[i]=__atomic_load_n(histogram->buckets+i,__ATOMIC_RELAXED));	// The buckets are read once, so that the percentiles are consistent with each other
+	fprintf(f,"%s.count %lu\n",name,total);
+	fprintf(f,"%s.p50_us %.1f\n",name,histogram_percentile(buckets,total,0.5));
+	fprintf(f,"%s.p99_us %.1f\n",name,histogram_percentile(buckets,total,0.99));
+}
+
+/********************************************/
+/*                 COUNTERS                 */
+/********************************************/
+void init_stats() {
+	started=stats_clock();
+}
+
+unsigned long long stats_clock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+const char *operation_name(Operation op) {
+	return (op>=0 && op<OP_COUNT)?operation_names[op]:"-";
+}
+
+void stats_operation(Operation op,unsigned long long start) {
+	histogram_add(operations+op,start);
+}
+
+void stats_execution(int code,unsigned long long start) {
+	histogram_add(&executions,start);
+	__atomic_fetch_add(exit_codes+((code>=0 && code<STATS_EXIT_CODES-1)?code:STATS_EXIT_CODES-1),1,__ATOMIC_RELAXED);
+}
+
+void stats_wait(unsigned long long start) {
+	histogram_add(&waits,start);
+}
+
+void stats_served(int script,size_t size) {
+	__atomic_fetch_add(script?&script_bytes:&file_bytes,size,__ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Write the counters of a cache in a report
+ *
+ * \param f Stream of the report
+ * \param name Name of the cache
+ * \param stats Counters of the cache
+ */
+static void cache_report(FILE *f,const char *name,const CacheStats *stats) {
+	unsigned long total=stats->hits+stats->misses;
+	fprintf(f,"cache.%s.hits %lu\n",name,stats->hits);
+	fprintf(f,"cache.%s.misses %lu\n",name,stats->misses);
+	fprintf(f,"cache.%s.hit_ratio %.3f\n",name,(total==0)?0.0:(double)stats->hits/total);
+}
+
+Output *stats_report() {
+	char *data=0;
+	size_t size=0;
+	FILE *f=open_memstream(&data,&size);
+	if (f==0) return output_from_buffer(0,0);
+	fprintf(f,"uptime_s %llu\n",(stats_clock()-started)/1000000000ULL);
+	size_t i;
+	char name[32];
+	for (i=0;i<OP_COUNT;++i) {
+		snprintf(name,sizeof(name),"op.%s",operation_names[i]);
+		histogram_report(f,name,operations+i);
+	}
+	const Procedures *procs;
+	for (procs=persistent.procs,i=0;procs!=0;procs=procs->next,++i) {
+		const Procedure *proc=procs->procedure;
+		unsigned long tests=__atomic_load_n(&proc->tests,__ATOMIC_RELAXED);
+		unsigned long matches=__atomic_load_n(&proc->matches,__ATOMIC_RELAXED);
+		fprintf(f,"proc.%zu.tests %lu\n",i,tests);
+		fprintf(f,"proc.%zu.matches %lu\n",i,matches);
+		fprintf(f,"proc.%zu.match_rate %.3f\n",i,(tests==0)?0.0:(double)matches/tests);
+		fprintf(f,"proc.%zu.executions %lu\n",i,__atomic_load_n(&proc->executions,__ATOMIC_RELAXED));
+	}
+	histogram_report(f,"exec",&executions);
+	for (i=0;i<STATS_EXIT_CODES;++i) {
+		unsigned long count=__atomic_load_n(exit_codes+i,__ATOMIC_RELAXED);
+		if (count==0) continue;
+		if (i<STATS_EXIT_CODES-1) fprintf(f,"exec.exit.%zu %lu\n",i,count); else fprintf(f,"exec.exit.other %lu\n",count);
+	}
+	AdmissionStats admitted;
+	admission_stats(&admitted);
+	fprintf(f,"admission.admitted %lu\n",admitted.admitted);
+	fprintf(f,"admission.waited %lu\n",admitted.waited);
+	fprintf(f,"admission.rejected %lu\n",admitted.rejected);
+	fprintf(f,"admission.running %zu\n",admitted.running);
+	fprintf(f,"admission.waiting %zu\n",admitted.waiting);
+	histogram_report(f,"admission.wait",&waits);
+	FlightStats flights;
+	flight_stats(&flights);
+	fprintf(f,"flight.started %lu\n",flights.started);
+	fprintf(f,"flight.joined %lu\n",flights.joined);
+	fprintf(f,"flight.failed %lu\n",flights.failed);
+	WatchdogStats watchdog;
+	watchdog_stats(&watchdog);
+	fprintf(f,"timeout.expired %lu\n",watchdog.expired);
+	fprintf(f,"timeout.killed %lu\n",watchdog.killed);
+	CacheStats stats;
+	verdict_cache_stats(&stats);
+	cache_report(f,"verdict",&stats);
+	header_cache_stats(&stats);
+	cache_report(f,"header",&stats);
+	output_cache_stats(&stats);
+	cache_report(f,"output",&stats);
+	PrefetchStats prefetched;
+	prefetch_stats(&prefetched);
+	fprintf(f,"prefetch.queued %lu\n",prefetched.queued);
+	fprintf(f,"prefetch.dropped %lu\n",prefetched.dropped);
+	fprintf(f,"prefetch.cancelled %lu\n",prefetched.cancelled);
+	fprintf(f,"prefetch.skipped %lu\n",prefetched.skipped);
+	fprintf(f,"prefetch.executed %lu\n",prefetched.executed);
+	fprintf(f,"served.script_bytes %lu\n",__atomic_load_n(&script_bytes,__ATOMIC_RELAXED));
+	fprintf(f,"served.file_bytes %lu\n",__atomic_load_n(&file_bytes,__ATOMIC_RELAXED));
+	fclose(f);
+	return output_from_buffer(data,size);
+}
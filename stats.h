@@ -0,0 +1,126 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  stats.h
+ *
+ *    Description:  Counters of the activity of the file system
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 20:07:44
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  STATS_INC
+#define  STATS_INC
+
+#include <sys/types.h>
+
+#define	HISTOGRAM_BUCKETS 0x1f0	//!< Number of buckets of a latency histogram, 8 for each power of two of nanoseconds
+#define	STATS_EXIT_CODES 0x101	//!< Number of counters of exit codes, the last one counting the codes outside 0-255
+
+struct Output;	//!< Forward definition of the Output type
+
+/**
+ * \brief Operations of the file system which are counted
+ */
+typedef enum Operation {
+	OP_LOOKUP,	//!< Lookup of a name in a folder
+	OP_FORGET,	//!< Forget of one or several inodes
+	OP_GETATTR,	//!< Read of the attributes of a file
+	OP_SETATTR,	//!< Change of the attributes of a file
+	OP_ACCESS,	//!< Check of the permissions of a file
+	OP_READLINK,	//!< Read of the target of a symbolic link
+	OP_SYMLINK,	//!< Creation of a symbolic link
+	OP_LINK,	//!< Creation of a hard link
+	OP_OPENDIR,	//!< Opening of a folder
+	OP_READDIR,	//!< Read of the entries of a folder
+	OP_RELEASEDIR,	//!< Closing of a folder
+	OP_MKDIR,	//!< Creation of a folder
+	OP_UNLINK,	//!< Removal of a file
+	OP_RMDIR,	//!< Removal of a folder
+	OP_RENAME,	//!< Rename of a file
+	OP_STATFS,	//!< Read of the statistics of the file system
+	OP_OPEN,	//!< Opening of a file, including the execution of a script
+	OP_READ,	//!< Read of the content of a file
+	OP_WRITE,	//!< Write of the content of a file
+	OP_RELEASE,	//!< Closing of a file
+	OP_FSYNC,	//!< Synchronization of a file
+	OP_FLUSH,	//!< Flush of a file before it is closed
+	OP_CREATE,	//!< Creation of a file
+	OP_COUNT	//!< Number of operations
+} Operation;
+
+/**
+ * \brief Start counting
+ *
+ * The function remembers the start time of the file system. The counters themselves are static variables which start at zero.
+ */
+void init_stats();
+
+/**
+ * \brief Read the monotonic clock
+ *
+ * \return Current time in nanoseconds
+ */
+unsigned long long stats_clock();
+
+/**
+ * \brief Get the name of an operation of the file system
+ *
+ * \param op Operation
+ * \return Name of the operation, as written in the reports
+ */
+const char *operation_name(Operation op);
+
+/**
+ * \brief Count an operation of the file system
+ *
+ * The counter and the latency histogram of the operation are updated with atomic additions, so that no lock is taken. This function is thread-safe.
+ * \param op Operation
+ * \param start Time at which the operation started, as returned by stats_clock
+ */
+void stats_operation(Operation op,unsigned long long start);
+
+/**
+ * \brief Count an execution of a script
+ *
+ * This function is thread-safe.
+ * \param code Exit code of the program
+ * \param start Time at which the program was started, as returned by stats_clock
+ */
+void stats_execution(int code,unsigned long long start);
+
+/**
+ * \brief Count the time an execution waited for its admission
+ *
+ * This function is thread-safe.
+ * \param start Time at which the execution asked to be admitted, as returned by stats_clock
+ */
+void stats_wait(unsigned long long start);
+
+/**
+ * \brief Count bytes returned to the readers of files
+ *
+ * This function is thread-safe.
+ * \param script Tells if the bytes were read from the output of a script, or from a regular file
+ * \param size Number of bytes
+ */
+void stats_served(int script,size_t size);
+
+/**
+ * \brief Write a report of all the counters
+ *
+ * The report holds one counter per line, written as a name and a value separated by a space: the number of calls and the 50th and 99th percentiles of the latency of each operation, the number of tests, matches and executions of each procedure in the order of the command-line, the distribution of the exit codes and the percentiles of the execution time of the scripts, the counters of the admission control and the percentiles of the time spent waiting to be admitted, the number of executions shared by concurrent openings, the number of programs stopped by their timeout, the hits and misses of the caches, the counters of the scripts executed in advance and the number of bytes served. The percentiles are the upper bounds of the buckets of the histograms, which are precise to about 12%.
+ * \return Newly-allocated complete output holding the report, which the caller should release with output_unref
+ */
+struct Output *stats_report();
+
+#endif   /* ----- #ifndef STATS_INC  ----- */
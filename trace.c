@@ -0,0 +1,232 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  trace.c
+ *
+ *    Description:  Implementation of the recording of the events of the file system
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 21:10:52
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_GNU_SOURCE	//!< Needed for open_memstream
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+
+/**
+ * \brief Event recorded in a buffer
+ */
+typedef struct TraceEvent {
+	unsigned long long time;	//!< Time of the event in nanoseconds, as returned by stats_clock
+	long long value;	//!< Value of the event
+	pid_t tid;	//!< Identifier of the thread which recorded the event
+	unsigned short type;	//!< Kind of the event
+	unsigned short op;	//!< Operation of the file system of the event
+	char name[TRACE_NAME_LENGTH];	//!< Name of the event, empty if there is none
+} TraceEvent;
+
+/**
+ * \brief Ring buffer of the events of a thread
+ *
+ * Only the thread which owns the buffer writes in it. The counter of events is increased after each event is written, so that a reader knows which events are complete.
+ */
+typedef struct TraceBuffer {
+	TraceEvent *events;	//!< Slots of the events, event i being in slot i modulo the capacity
+	unsigned long head;	//!< Number of events written in the buffer
+	int owned;	//!< Tells if the buffer belongs to a running thread
+	struct TraceBuffer *next;	//!< Next buffer in the list of all the buffers
+} TraceBuffer;
+
+/**
+ * \brief State of the recording of events
+ */
+static struct {
+	pthread_mutex_t lock;	//!< Lock protecting the list of buffers and their owners
+	pthread_key_t key;	//!< Key of the buffer of each thread, which destructor gives the buffer back
+	TraceBuffer *buffers;	//!< List of all the buffers
+	size_t capacity;	//!< Number of events of each buffer, a power of two
+	int enabled;	//!< Tells if the events are recorded
+	int ready;	//!< Tells if init_trace was called
+} trace;
+
+static __thread TraceBuffer *local=0;	//!< Buffer of the current thread
+static __thread pid_t local_tid=0;	//!< Identifier of the current thread, 0 until its first event
+
+static const char *type_names[]={"begin","end","script","spawn","exit"};	//!< Names of the kinds of events in the report
+
+/**
+ * \brief Switch the recording on or off
+ *
+ * This function is the handler of TRACE_SIGNAL.
+ * \param sig Number of the signal
+ */
+static void trace_toggle(int sig) {
+	__atomic_xor_fetch(&trace.enabled,1,__ATOMIC_RELAXED);
+}
+
+/**
+ * \brief Give back the buffer of a thread which ends
+ *
+ * The buffer keeps its events, which are overwritten by the next thread taking it.
+ * \param arg Buffer
+ */
+static void trace_release(void *arg) {
+	pthread_mutex_lock(&trace.lock);
+	((TraceBuffer*)arg)->owned=0;
+	pthread_mutex_unlock(&trace.lock);
+}
+
+/**
+ * \brief Get a buffer for the current thread
+ *
+ * The function takes a buffer given back by an ended thread, or allocates a new one.
+ * \return Pointer to the buffer, or a null pointer if it can not be allocated
+ */
+static TraceBuffer *trace_buffer() {
+	pthread_mutex_lock(&trace.lock);
+	TraceBuffer *buffer=trace.buffers;
+	while (buffer!=0 && buffer->owned) buffer=buffer->next;
+	if (buffer==0) {
+		buffer=(TraceBuffer*)calloc(1,sizeof(TraceBuffer));
+		if (buffer!=0) buffer->events=(TraceEvent*)malloc(trace.capacity*sizeof(TraceEvent));
+		if (buffer!=0 && buffer->events==0) {free(buffer);buffer=0;}
+		if (buffer!=0) {
+			buffer->next=trace.buffers;
+			trace.buffers=buffer;
+		}
+	}
+	if (buffer!=0) {
+		buffer->owned=1;
+		pthread_setspecific(trace.key,buffer);
+	}
+	pthread_mutex_unlock(&trace.lock);
+	return buffer;
+}
+
+int init_trace(size_t events,int enabled) {
+	pthread_mutex_init(&trace.lock,0);
+	if (pthread_key_create(&trace.key,trace_release)!=0) return -1;
+	trace.capacity=1;
+	while (trace.capacity<events) trace.capacity<<=1;
+	trace.buffers=0;
+	trace.enabled=enabled;
+	trace.ready=1;
+	struct sigaction sa;
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler=trace_toggle;
+	sa.sa_flags=SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	return sigaction(TRACE_SIGNAL,&sa,0);
+}
+
+void free_trace() {
+	if (!trace.ready) return;
+	trace.enabled=0;
+	trace.ready=0;
+	while (trace.buffers!=0) {
+		TraceBuffer *buffer=trace.buffers;
+		trace.buffers=buffer->next;
+		free(buffer->events);
+		free(buffer);
+	}
+	local=0;
+	pthread_key_delete(trace.key);
+	pthread_mutex_destroy(&trace.lock);
+}
+
+void trace_event(TraceType type,int op,long long value,const char *name) {
+	if (!trace.ready || !__atomic_load_n(&trace.enabled,__ATOMIC_RELAXED)) return;
+	if (local==0 && (local=trace_buffer())==0) return;
+	if (local_tid==0) local_tid=(pid_t)syscall(SYS_gettid);
+	unsigned long head=local->head;
+	TraceEvent *event=local->events+(head & (trace.capacity-1));
+	event->time=stats_clock();
+	event->value=value;
+	event->tid=local_tid;
+	event->type=(unsigned short)type;
+	event->op=(unsigned short)op;
+	if (name!=0) {	// The end of a long path tells more than its beginning
+		size_t length=strlen(name);
+		if (length>=TRACE_NAME_LENGTH) {
+			name+=length-(TRACE_NAME_LENGTH-1);
+			length=TRACE_NAME_LENGTH-1;
+		}
+		memcpy(event->name,name,length);
+		event->name[length]=0;
+	} else event->name[0]=0;
+	__atomic_store_n(&local->head,head+1,__ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Compare two events by their time
+ *
+ * \param a Pointer to the first event
+ * \param b Pointer to the second event
+ * \return Negative, null or positive number if the first event happened before, at the same time or after the second one
+ */
+static int compare_events(const void *a,const void *b) {
+	unsigned long long ta=((const TraceEvent*)a)->time,tb=((const TraceEvent*)b)->time;
+	return (ta<tb)?-1:(ta>tb);
+}
+
+Output *trace_report() {
+	TraceEvent *events=0;
+	size_t count=0,allocated=0;
+	if (trace.ready) {
+		pthread_mutex_lock(&trace.lock);	// The list is not changed while it is read, the buffers are still written by their threads
+		TraceBuffer *buffer;
+		for (buffer=trace.buffers;buffer!=0;buffer=buffer->next) {
+			unsigned long head=__atomic_load_n(&buffer->head,__ATOMIC_ACQUIRE);
+			unsigned long first=(head>trace.capacity)?head-trace.capacity:0;
+			if (count+(head-first)>allocated) {
+				allocated=count+(head-first);
+				TraceEvent *e=(TraceEvent*)realloc(events,allocated*sizeof(TraceEvent));
+				if (e==0) break;
+				events=e;
+			}
+			unsigned long i;
+			for (i=first;i<head;++i) events[count+i-first]=buffer->events[i & (trace.capacity-1)];
+			unsigned long after=__atomic_load_n(&buffer->head,__ATOMIC_ACQUIRE);	// The events written meanwhile may have overwritten the oldest copied ones, as well as the slot of the next event
+			unsigned long valid=(after+1>trace.capacity)?after+1-trace.capacity:0;
+			if (valid>first) {
+				size_t skip=(valid<head)?valid-first:head-first;
+				memmove(events+count,events+count+skip,(head-first-skip)*sizeof(TraceEvent));
+				first+=skip;
+			}
+			count+=head-first;
+		}
+		pthread_mutex_unlock(&trace.lock);
+	}
+	qsort(events,count,sizeof(TraceEvent),compare_events);
+	char *data=0;
+	size_t size=0;
+	FILE *f=open_memstream(&data,&size);
+	if (f==0) {free(events);return output_from_buffer(0,0);}
+	fprintf(f,"# time_ns\ttid\tevent\top\tvalue\tname\n");
+	size_t i;
+	for (i=0;i<count;++i) {
+		const TraceEvent *e=events+i;
+		const char *op=(e->type==TRACE_BEGIN || e->type==TRACE_END)?operation_name(e->op):"-";
+		fprintf(f,"%llu\t%d\t%s\t%s\t%lld\t%s\n",e->time,(int)e->tid,type_names[e->type],op,e->value,e->name);
+	}
+	fclose(f);
+	free(events);
+	return output_from_buffer(data,size);
+}
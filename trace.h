@@ -0,0 +1,79 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  trace.h
+ *
+ *    Description:  Recording of the events of the file system in memory
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 21:02:36
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  TRACE_INC
+#define  TRACE_INC
+
+#include <sys/types.h>
+
+#define	TRACE_EVENTS 0x4000	//!< Default number of events kept for each thread
+#define	TRACE_NAME_LENGTH 48	//!< Size of the buffer holding the name of an event, longer names keep their end
+#define	TRACE_SIGNAL SIGUSR1	//!< Signal which starts or stops the recording of events
+
+struct Output;	//!< Forward definition of the Output type
+
+/**
+ * \brief Kind of an event
+ */
+typedef enum TraceType {
+	TRACE_BEGIN,	//!< Start of an operation of the file system, with the inode number as value and the name given to the operation if any
+	TRACE_END,	//!< End of an operation of the file system, with the inode number as value
+	TRACE_SCRIPT,	//!< Classification of a file, with 1 as value if the file is a script and 0 otherwise, and the path of the file
+	TRACE_SPAWN,	//!< Creation of the process of an external program, with the process identifier as value and the path of the program
+	TRACE_EXIT	//!< End of an external program, with its exit code as value and its path
+} TraceType;
+
+/**
+ * \brief Prepare the recording of events
+ *
+ * Each thread records its events in a ring buffer of its own, allocated the first time it records an event, so that recording an event takes no lock. The buffer of a thread which ends is reused by the next new thread, with the events it holds. The function also installs the handler of TRACE_SIGNAL, which switches the recording on or off while the file system is running.
+ * \param events Number of events kept for each thread, rounded up to a power of two, the oldest events being overwritten
+ * \param enabled Tells if the events are recorded from the start
+ * \return 0 if everything went fine, -1 otherwise
+ */
+int init_trace(size_t events,int enabled);
+
+/**
+ * \brief Release the buffers of the events
+ *
+ * This function should be called once no other thread records events.
+ */
+void free_trace();
+
+/**
+ * \brief Record an event
+ *
+ * The function does nothing if the recording is switched off. The event is written in the buffer of the calling thread with its time and the identifier of the thread. This function is thread-safe and lock-free once the thread has its buffer.
+ * \param type Kind of the event
+ * \param op Operation of the file system for TRACE_BEGIN and TRACE_END events, 0 otherwise
+ * \param value Value of the event, which meaning depends on its kind
+ * \param name Name of the event, or a null pointer
+ */
+void trace_event(TraceType type,int op,long long value,const char *name);
+
+/**
+ * \brief Write the events recorded by all the threads
+ *
+ * The events are sorted by time and written one per line, after a header line starting with #. The fields of a line are separated by tabulations: time in nanoseconds on the monotonic clock, thread identifier, kind of event (begin, end, script, spawn or exit), name of the operation or - for the other kinds, value and name of the event. The events overwritten while the report is written are left out.
+ * \return Newly-allocated complete output holding the report, which the caller should release with output_unref
+ */
+struct Output *trace_report();
+
+#endif   /* ----- #ifndef TRACE_INC  ----- */
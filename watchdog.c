@@ -0,0 +1,151 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  watchdog.c
+ *
+ *    Description:  Implementation of the termination of the programs which run too long
+ *
+ *        Version:  1.0
+ *        Created:  17/10/2026 01:19:26
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "spawner.h"
+#include "stats.h"
+#include "watchdog.h"
+
+/**
+ * \brief State of the watchdog
+ *
+ * The watched programs are kept in a list sorted by deadline, protected by the lock with the counters.
+ */
+static struct {
+	pthread_mutex_t lock;	//!< Lock protecting the list and the counters
+	pthread_cond_t changed;	//!< Condition signaled when the first deadline changes and when the thread has to stop, waited for with the monotonic clock
+	pthread_t thread;	//!< Thread sending the signals
+	Watch *first;	//!< Watched program with the nearest deadline
+	int running;	//!< Tells if the thread was started
+	int stop;	//!< Tells if the thread has to stop
+	WatchdogStats stats;	//!< Counters of the watchdog
+} watchdog={PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * \brief Insert a watched program in the list, sorted by deadline
+ *
+ * The lock should be held by the caller.
+ * \param watch Watched program
+ */
+static void insert_watch(Watch *watch) {
+	Watch **w=&watchdog.first;
+	while (*w!=0 && (*w)->deadline<=watch->deadline) w=&(*w)->next;
+	watch->next=*w;
+	*w=watch;
+}
+
+/**
+ * \brief Remove a watched program from the list
+ *
+ * The lock should be held by the caller.
+ * \param watch Watched program
+ * \return 1 if the program was in the list, 0 otherwise
+ */
+static int remove_watch(Watch *watch) {
+	Watch **w=&watchdog.first;
+	while (*w!=0 && *w!=watch) w=&(*w)->next;
+	if (*w==0) return 0;
+	*w=watch->next;
+	return 1;
+}
+
+/**
+ * \brief Send the signals to the programs which deadline has passed, started in a new thread
+ *
+ * \param arg Not used
+ * \return Null pointer
+ */
+static void *watchdog_thread(void *arg) {
+	pthread_mutex_lock(&watchdog.lock);
+	while (!watchdog.stop) {
+		if (watchdog.first==0) {pthread_cond_wait(&watchdog.changed,&watchdog.lock);continue;}
+		unsigned long long now=stats_clock();
+		Watch *watch=watchdog.first;
+		if (watch->deadline>now) {
+			struct timespec ts={(time_t)(watch->deadline/1000000000ULL),(long)(watch->deadline%1000000000ULL)};
+			pthread_cond_timedwait(&watchdog.changed,&watchdog.lock,&ts);
+			continue;
+		}
+		watchdog.first=watch->next;
+		int sig=(watch->signals==0)?SIGTERM:SIGKILL;
+		signal_process(watch->pid,sig);
+		if (watch->signals++==0) {	// The program gets a grace period to end after SIGTERM
+			++watchdog.stats.expired;
+			watch->deadline=now+WATCHDOG_GRACE*1000000ULL;
+			insert_watch(watch);
+		} else ++watchdog.stats.killed;
+	}
+	pthread_mutex_unlock(&watchdog.lock);
+	return 0;
+}
+
+void watchdog_arm(Watch *watch,pid_t pid,unsigned long timeout) {
+	watch->pid=pid;
+	watch->signals=0;
+	watch->deadline=stats_clock()+timeout*1000000ULL;
+	pthread_mutex_lock(&watchdog.lock);
+	if (!watchdog.running && !watchdog.stop) {	// The thread is started after the program has become a daemon, since it would not survive the fork
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+		pthread_cond_init(&watchdog.changed,&attr);
+		pthread_condattr_destroy(&attr);
+		if (pthread_create(&watchdog.thread,0,watchdog_thread,0)==0) watchdog.running=1;
+		else pthread_cond_destroy(&watchdog.changed);
+	}
+	if (watchdog.running) {
+		insert_watch(watch);
+		if (watchdog.first==watch) pthread_cond_signal(&watchdog.changed);
+	}
+	++watchdog.stats.armed;
+	pthread_mutex_unlock(&watchdog.lock);
+}
+
+int watchdog_disarm(Watch *watch) {
+	pthread_mutex_lock(&watchdog.lock);
+	remove_watch(watch);
+	int expired=(watch->signals>0);
+	pthread_mutex_unlock(&watchdog.lock);
+	return expired;
+}
+
+void free_watchdog() {
+	pthread_mutex_lock(&watchdog.lock);
+	watchdog.stop=1;
+	int running=watchdog.running;
+	if (running) pthread_cond_signal(&watchdog.changed);
+	pthread_mutex_unlock(&watchdog.lock);
+	if (!running) return;
+	pthread_join(watchdog.thread,0);
+	pthread_mutex_lock(&watchdog.lock);
+	watchdog.first=0;
+	watchdog.running=0;
+	pthread_cond_destroy(&watchdog.changed);
+	pthread_mutex_unlock(&watchdog.lock);
+}
+
+void watchdog_stats(WatchdogStats *stats) {
+	pthread_mutex_lock(&watchdog.lock);
+	*stats=watchdog.stats;
+	pthread_mutex_unlock(&watchdog.lock);
+}
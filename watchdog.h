@@ -0,0 +1,82 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  watchdog.h
+ *
+ *    Description:  Termination of the programs which run longer than their timeout
+ *
+ *        Version:  1.0
+ *        Created:  17/10/2026 01:12:40
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  WATCHDOG_INC
+#define  WATCHDOG_INC
+
+#include <sys/types.h>
+
+#define	WATCHDOG_GRACE 2000	//!< Time in milliseconds a program has to end after SIGTERM before it is sent SIGKILL
+
+/**
+ * \brief Program watched by the watchdog
+ *
+ * The structure lives on the stack of the thread which waits for the program, between watchdog_arm and watchdog_disarm.
+ */
+typedef struct Watch {
+	pid_t pid;	//!< Identifier of the process, which leads its own process group
+	unsigned long long deadline;	//!< Time, in nanoseconds of the monotonic clock, at which the next signal is sent
+	int signals;	//!< Number of signals sent to the process group
+	struct Watch *next;	//!< Next watched program, which deadline comes later
+} Watch;
+
+/**
+ * \brief Counters of the watchdog
+ */
+typedef struct WatchdogStats {
+	unsigned long armed;	//!< Number of programs watched
+	unsigned long expired;	//!< Number of programs which ran longer than their timeout and were sent SIGTERM
+	unsigned long killed;	//!< Number of programs which did not end in the grace period after SIGTERM and were sent SIGKILL
+} WatchdogStats;
+
+/**
+ * \brief Watch a program
+ *
+ * When the timeout expires, the whole process group of the program is sent SIGTERM, and SIGKILL WATCHDOG_GRACE milliseconds later if the program has not been waited for meanwhile. The thread of the watchdog is started the first time a program is watched. This function is thread-safe.
+ * \param watch Structure describing the watched program, which should stay alive until watchdog_disarm is called
+ * \param pid Identifier of the process, which should lead its own process group
+ * \param timeout Time in milliseconds the program may run
+ */
+void watchdog_arm(Watch *watch,pid_t pid,unsigned long timeout);
+
+/**
+ * \brief Stop watching a program
+ *
+ * This function should be called once the program has been waited for. It is thread-safe.
+ * \param watch Structure given to watchdog_arm
+ * \return 1 if the program ran longer than its timeout and was sent a signal, 0 otherwise
+ */
+int watchdog_disarm(Watch *watch);
+
+/**
+ * \brief Stop the thread of the watchdog
+ *
+ * The programs still watched are not stopped any more. The function does nothing if the thread was not started.
+ */
+void free_watchdog();
+
+/**
+ * \brief Read the counters of the watchdog
+ *
+ * \param stats Structure receiving the counters
+ */
+void watchdog_stats(WatchdogStats *stats);
+
+#endif   /* ----- #ifndef WATCHDOG_INC  ----- */
@@ -0,0 +1,256 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  watcher.c
+ *
+ *    Description:  Implementation of the detection of the modifications of the mirror folder
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 16:47:55
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#define	_GNU_SOURCE	//!< Needed for nftw with FTW_ACTIONRETVAL
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include "watcher.h"
+
+#define	WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DONT_FOLLOW | IN_ONLYDIR | IN_EXCL_UNLINK)	//!< Events reported for each watched folder
+#define	WATCH_BUFFER 0x10000	//!< Size of the buffer receiving the events
+
+/**
+ * \brief State of the watcher
+ *
+ * The table of paths is only modified by init_watcher before the thread starts, and then by the thread itself, so it needs no lock.
+ */
+static struct {
+	int running;	//!< Tells if the thread is running
+	int fd;	//!< Descriptor of the inotify instance
+	int stop;	//!< Event descriptor used to stop the thread
+	pthread_t thread;	//!< Thread reading the events
+	WatchFunction changed;	//!< Function called for each modification
+	char mirror[32];	//!< Path of the mirror folder through the descriptor of the process, ending with a slash
+	size_t mirror_len;	//!< Length of the path of the mirror folder
+	char **paths;	//!< Path relative to the mirror folder of each watched folder, indexed by watch descriptor
+	int capacity;	//!< Number of elements of the paths array
+	int full;	//!< Tells if the limit on the number of watches has been reached
+} watcher;
+
+/**
+ * \brief Place a watch on a folder
+ *
+ * \param relative Path of the folder relative to the mirror folder, empty for the mirror folder itself
+ * \return 0 if the watch was placed, -1 otherwise
+ */
+static int watch_folder(const char *relative) {
+	char path[watcher.mirror_len+strlen(relative)+1];
+	sprintf(path,"%s%s",watcher.mirror,relative);
+	int wd=inotify_add_watch(watcher.fd,path,WATCH_MASK);
+	if (wd<0) {
+		if (errno==ENOSPC && !watcher.full) {
+			fprintf(stderr,"Warning: too many folders to watch, raise fs.inotify.max_user_watches\n");
+			watcher.full=1;
+		}
+		return -1;
+	}
+	if (wd>=watcher.capacity) {
+		int capacity=(watcher.capacity==0)?0x100:watcher.capacity;
+		while (capacity<=wd) capacity*=2;
+		char **paths=(char**)realloc(watcher.paths,capacity*sizeof(char*));
+		if (paths==0) {inotify_rm_watch(watcher.fd,wd);return -1;}
+		memset(paths+watcher.capacity,0,(capacity-watcher.capacity)*sizeof(char*));
+		watcher.paths=paths;
+		watcher.capacity=capacity;
+	}
+	free(watcher.paths[wd]);	// The same folder may be watched again after having been moved
+	watcher.paths[wd]=strdup(relative);
+	return 0;
+}
+
+/**
+ * \brief Callback of nftw placing a watch on each folder of a tree
+ *
+ * \param path Path of the item, starting with the path of the mirror folder
+ * \param st Attributes of the item
+ * \param type Type of the item
+ * \param ftw Position of the item in the tree
+ * \return Action which nftw should take next
+ */
+static int watch_item(const char *path,const struct stat *st,int type,struct FTW *ftw) {
+	if (type!=FTW_D) return FTW_CONTINUE;
+	const char *relative=path+watcher.mirror_len;
+	if (relative[0]=='.' && (relative[1]==0 || relative[1]=='/')) ++relative;	// The mirror folder itself is walked as its . entry
+	while (*relative=='/') ++relative;
+	if (watch_folder(relative)!=0 && watcher.full) return FTW_STOP;
+	return FTW_CONTINUE;
+}
+
+/**
+ * \brief Place a watch on every folder of a tree
+ *
+ * \param relative Path of the root of the tree relative to the mirror folder, empty for the mirror folder itself
+ */
+static void watch_tree(const char *relative) {
+	if (watcher.full) return;
+	char path[watcher.mirror_len+strlen(relative)+2];
+	sprintf(path,"%s%s",watcher.mirror,(relative[0]!=0)?relative:".");	// nftw would not enter the link to the descriptor of the mirror folder
+	nftw(path,watch_item,16,FTW_PHYS | FTW_ACTIONRETVAL);
+}
+
+/**
+ * \brief Tell if a path is inside a folder
+ *
+ * \param path Path relative to the mirror folder
+ * \param folder Path of the folder relative to the mirror folder
+ * \param len Length of the path of the folder
+ * \return 1 if the path is the folder itself or one of its descendants, 0 otherwise
+ */
+static int inside(const char *path,const char *folder,size_t len) {
+	return strncmp(path,folder,len)==0 && (path[len]==0 || path[len]=='/');
+}
+
+/**
+ * \brief Update the paths of the watched folders after a folder has been moved inside the mirror folder
+ *
+ * \param from Previous path of the folder relative to the mirror folder
+ * \param to New path of the folder relative to the mirror folder
+ */
+static void move_tree(const char *from,const char *to) {
+	size_t len=strlen(from);
+	size_t tolen=strlen(to);
+	int wd;
+	for (wd=0;wd<watcher.capacity;++wd) if (watcher.paths[wd]!=0 && inside(watcher.paths[wd],from,len)) {
+		char *path=(char*)malloc(tolen+strlen(watcher.paths[wd]+len)+1);
+		strcpy(path,to);
+		strcpy(path+tolen,watcher.paths[wd]+len);
+		free(watcher.paths[wd]);
+		watcher.paths[wd]=path;
+	}
+}
+
+/**
+ * \brief Remove the watches of a folder which has been moved out of the mirror folder
+ *
+ * \param from Previous path of the folder relative to the mirror folder
+ */
+static void unwatch_tree(const char *from) {
+	size_t len=strlen(from);
+	int wd;
+	for (wd=0;wd<watcher.capacity;++wd) if (watcher.paths[wd]!=0 && inside(watcher.paths[wd],from,len)) {
+		inotify_rm_watch(watcher.fd,wd);
+		free(watcher.paths[wd]);
+		watcher.paths[wd]=0;
+	}
+}
+
+/**
+ * \brief Read and dispatch the events of the inotify instance
+ *
+ * This function is the body of the thread of the watcher. Consecutive events on the same file are only reported once. A folder moved inside the mirror folder is matched with its previous path through the cookie of the events, within the same batch of events.
+ * \param arg Not used
+ * \return Null pointer
+ */
+static void *watch_thread(void *arg) {
+	char buffer[WATCH_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char last[FILENAME_MAX];	// Last path reported, to merge consecutive events
+	char moved[FILENAME_MAX];	// Previous path of a folder waiting for its new name
+	uint32_t cookie=0;	// Cookie of the move of that folder, 0 if no folder is waiting
+	struct pollfd fds[2]={{watcher.fd,POLLIN,0},{watcher.stop,POLLIN,0}};
+	for (;;) {
+		if (poll(fds,2,-1)<0) {
+			if (errno==EINTR) continue;
+			break;
+		}
+		if (fds[1].revents!=0) break;
+		ssize_t num=read(watcher.fd,buffer,sizeof(buffer));
+		if (num<=0) {
+			if (num<0 && (errno==EINTR || errno==EAGAIN)) continue;
+			break;
+		}
+		last[0]=0;
+		char *p;
+		const struct inotify_event *event;
+		for (p=buffer;p<buffer+num;p+=sizeof(struct inotify_event)+event->len) {
+			event=(const struct inotify_event*)p;
+			if (event->mask & IN_Q_OVERFLOW) {watcher.changed(0);last[0]=0;continue;}
+			if (event->wd<0 || event->wd>=watcher.capacity || watcher.paths[event->wd]==0) continue;
+			if (event->mask & IN_IGNORED) {free(watcher.paths[event->wd]);watcher.paths[event->wd]=0;continue;}
+			const char *dir=watcher.paths[event->wd];
+			char path[FILENAME_MAX];
+			if (event->len==0) snprintf(path,sizeof(path),"%s",(dir[0]!=0)?dir:".");
+			else if (dir[0]!=0) snprintf(path,sizeof(path),"%s/%s",dir,event->name);
+			else snprintf(path,sizeof(path),"%s",event->name);
+			if (event->mask & IN_ISDIR) {
+				if (event->mask & IN_MOVED_FROM) {
+					if (cookie!=0) unwatch_tree(moved);
+					strcpy(moved,path);
+					cookie=event->cookie;
+				} else if ((event->mask & IN_MOVED_TO) && cookie!=0 && event->cookie==cookie) {
+					move_tree(moved,path);
+					cookie=0;
+				} else if (event->mask & (IN_CREATE | IN_MOVED_TO)) watch_tree(path);
+			}
+			if (strcmp(path,last)!=0) {
+				watcher.changed(path);
+				strcpy(last,path);
+			}
+		}
+		if (cookie!=0) {	// The folder has been moved out of the mirror folder
+			unwatch_tree(moved);
+			cookie=0;
+		}
+	}
+	return 0;
+}
+
+/**
+ * \brief Release the resources of the watcher
+ *
+ * The thread of the watcher should not be running.
+ */
+static void release_watcher() {
+	close(watcher.stop);
+	close(watcher.fd);
+	int wd;
+	for (wd=0;wd<watcher.capacity;++wd) free(watcher.paths[wd]);
+	free(watcher.paths);
+	watcher.running=0;
+}
+
+int init_watcher(int mirror,WatchFunction changed) {
+	memset(&watcher,0,sizeof(watcher));
+	watcher.fd=inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (watcher.fd<0) return -1;
+	watcher.stop=eventfd(0,EFD_CLOEXEC);
+	if (watcher.stop<0) {close(watcher.fd);return -1;}
+	watcher.changed=changed;
+	watcher.mirror_len=sprintf(watcher.mirror,"/proc/self/fd/%d/",mirror);	// The path is resolved through the descriptor, since the mirror folder may be hidden by the virtual file system mounted over it
+	watch_tree("");
+	if (pthread_create(&watcher.thread,0,watch_thread,0)!=0) {release_watcher();return -1;}
+	watcher.running=1;
+	return 0;
+}
+
+void free_watcher() {
+	if (!watcher.running) return;
+	uint64_t one=1;
+	if (write(watcher.stop,&one,sizeof(one))==sizeof(one)) pthread_join(watcher.thread,0);
+	release_watcher();
+}
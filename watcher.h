@@ -0,0 +1,48 @@
+/**
+ * \file
+ *
+ * =====================================================================================
+ *
+ *       Filename:  watcher.h
+ *
+ *    Description:  Detection of the modifications of the mirror folder
+ *
+ *        Version:  1.0
+ *        Created:  16/10/2026 16:42:07
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  François Hissel
+ *        Company:
+ *
+ * =====================================================================================
+ */
+
+#ifndef  WATCHER_INC
+#define  WATCHER_INC
+
+/**
+ * \brief Function called when a file of the mirror folder changes
+ *
+ * The function receives the path of the file relative to the mirror folder, or a null pointer if any file may have changed, for example because some events were lost.
+ */
+typedef void (*WatchFunction)(const char *file);
+
+/**
+ * \brief Start watching the mirror folder
+ *
+ * The function places an inotify watch on every folder of the mirror tree, then starts a thread which calls the function given as argument each time a file or a folder is created, modified, moved or deleted. The folders created later are watched as well. If the system limit on the number of watches is reached, the remaining folders are not watched and a warning is printed. This function should be called after the program has become a daemon, since the thread does not survive a fork.
+ * \param mirror Descriptor of the mirror folder, opened before the virtual file system was mounted, which should stay open until free_watcher is called
+ * \param changed Function called for each modification
+ * \return 0 if the watcher was started, -1 otherwise
+ */
+int init_watcher(int mirror,WatchFunction changed);
+
+/**
+ * \brief Stop watching the mirror folder
+ *
+ * The function stops the thread started by init_watcher and releases its resources. It does nothing if the watcher was not started.
+ */
+void free_watcher();
+
+#endif   /* ----- #ifndef WATCHER_INC  ----- */